@@ -0,0 +1,31 @@
+#include <iostream>
+#include <unistd.h>
+#include <thread>
+
+#include "agg.h"
+
+using namespace std;
+
+AGG::AGG(const LSockAddr &addr, int port, int id, const char *name, int lnetport, int deadlineMs)
+{
+  this->_info = new AggInfo();
+  this->_info->id = id;
+  strncpy(this->_info->name, name, sizeof(this->_info->name));
+  ::gethostname(this->_info->hostname, sizeof(this->_info->hostname));
+  this->_info->listenport = lnetport;
+  this->_aggNet = new LnetAgg(addr, port, this->_info, deadlineMs);
+  this->_parentConnected = this->_aggNet->pubAggInfoToParent();
+}
+
+AGG::~AGG()
+{
+  delete this->_aggNet;
+  delete this->_info;
+}
+
+void AGG::eventLoop()
+{
+  if (!this->_parentConnected) return;
+  thread lnetThread( [=] { this->_aggNet->eventLoop(); });
+  lnetThread.join();
+}
@@ -0,0 +1,78 @@
+#ifndef _AGG_H_
+#define _AGG_H_
+
+#include <vector>
+#include <map>
+#include <set>
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+
+#include "lnet.h"
+
+// Aggregator: sits between a parent (the MDS or another aggregator) and a
+// subtree of OSTs and aggregators. It fans the Timer of an epoch out to
+// its children, merges their responses into one AggTimerResp for the
+// parent, and relays the Allocs down to the OSTs. The parent only talks
+// to its direct children, so an epoch takes a number of hops that grows
+// with the depth of the tree instead of the number of OSTs.
+class LnetAgg: public LnetServer
+{
+  private:
+    const AggInfo *_info;
+    MdsInfo *_parentInfo;
+    LnetClient *_toParent;
+    std::vector<LnetEntity*> _children;
+    std::map<int, const LnetEntity*> _route; // OST id -> child relaying to it
+    std::chrono::milliseconds _deadline;
+
+    // Open epoch, guarded by _lock
+    std::mutex *_lock;
+    std::condition_variable *_epochReady;
+    size_t _seq;
+    bool _epochOpen;
+    std::chrono::steady_clock::time_point _epochEnd;
+    std::set<const LnetEntity*> _waiting;
+    std::vector<OstMsg_t> _resps;
+    bool _stop; // ends deadlineLoop()
+    std::thread *_deadlineThread;
+
+    void addChild(const LSocket &, LnetEntity *);
+    void setChildOsts(const LnetEntity *, const LnetMsg *);
+    void sendOstsToParent();
+    void relayTimer(const LnetMsg *);
+    void relayAllocs(const LnetMsg *);
+    void relayAllocsResync(const LnetEntity *, const LnetMsg *);
+    void requestAllocsResync(int ostId);
+    void addTimerResponse(const LnetEntity *, const LnetMsg *);
+    void closeEpoch();
+    void deadlineLoop();
+
+  protected:
+    virtual void onConnect();
+    virtual void onDisconnect(const LnetEntity *);
+    virtual void onClientRequest(const LnetEntity *, LnetMsg *);
+    virtual void onRemoteServerRequest(const LnetEntity *, LnetMsg *);
+
+  public:
+    LnetAgg(const LSockAddr &, int , const AggInfo *, int deadlineMs);
+    ~LnetAgg();
+    bool pubAggInfoToParent();
+};
+
+class AGG
+{
+  private:
+    AggInfo *_info;
+    LnetAgg *_aggNet;
+    bool _parentConnected;
+
+  public:
+    AGG(const LSockAddr &addr, int port, int id, const char *name, int lnetport, int deadlineMs);
+    ~AGG();
+
+    void eventLoop();
+};
+
+#endif // ifndef _AGG_H_
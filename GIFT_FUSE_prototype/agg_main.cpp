@@ -0,0 +1,37 @@
+#include <iostream>
+#include <unistd.h>
+#include <thread>
+
+#include "agg.h"
+
+using namespace std;
+
+// Must be below the deadline of the parent, less at each level of the tree
+const int DEFAULT_DEADLINE_MS = 1000;
+
+static void
+printUsage()
+{
+  cerr << "Usage: agg [parent-host] [parent-port] [agg-id] [agg-name] [agg-lnetport] [deadline-ms]" << endl;
+}
+
+int
+main(int argc, char *argv[])
+{
+  if (argc < 6) {
+    printUsage();
+    return -1;
+  }
+  const char *hostname = argv[1];
+  int port = atoi(argv[2]);
+  int id = atoi(argv[3]);
+  const char *name = argv[4];
+  int lnetport = atoi(argv[5]);
+  int deadlineMs = argc > 6 ? atoi(argv[6]) : DEFAULT_DEADLINE_MS;
+
+  LSockAddr addr(hostname, port);
+  AGG *agg = new AGG(addr, port, id, name, lnetport, deadlineMs);
+  agg->eventLoop();
+  delete agg;
+  return 0;
+}
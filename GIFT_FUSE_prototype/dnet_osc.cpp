@@ -4,13 +4,18 @@
 #include "dnet_osc.h"
 #include "ost_ops.h"
 
-DatanetOsc::DatanetOsc(const OscInfo *info)
- : _info(info)
+DatanetOsc::DatanetOsc(const OscInfo *info, size_t rpcDepth)
+ : _info(info),
+   _rpcDepth(rpcDepth)
 {
 }
 
 DatanetOsc::~DatanetOsc()
 {
+  for (auto r : this->_ostRpcs) {
+    delete r;
+  }
+  this->_ostRpcs.clear();
   this->_toOsts.clear();
 }
 
@@ -28,6 +33,7 @@ bool DatanetOsc::connectToOsts(const std::vector<OstInfo*>& osts, const OscInfo
     LnetClient *n = new LnetClient(addr, s->dataport);
     this->_toOsts.push_back(n);
     this->pubOscInfoToOst(n);
+    this->_ostRpcs.push_back(new RpcChannel(n, this->_rpcDepth));
   }
   return true;
 }
@@ -55,3 +61,12 @@ ssize_t DatanetOsc::recvMsgFromOst(unsigned idx, LnetMsg *msg)
   if (idx >= this->_toOsts.size()) return -1;
   return this->_toOsts.at(idx)->recvMsgFromRemote(msg);
 }
+
+// Send a Read or Write with the data to write, and wait for the response
+// and the data read
+ssize_t DatanetOsc::callOst(unsigned idx, const LnetMsg *msg, LnetMsg *res,
+                            const void *out, size_t outLen, void *in, size_t inLen)
+{
+  if (idx >= this->_ostRpcs.size()) return -1;
+  return this->_ostRpcs.at(idx)->call(msg, res, out, outLen, in, inLen);
+}
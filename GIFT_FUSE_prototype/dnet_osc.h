@@ -12,17 +12,21 @@ class DatanetOsc
   private:
     const OscInfo *_info;
     std::vector<LnetClient*> _toOsts;
+    std::vector<RpcChannel*> _ostRpcs;
+    size_t _rpcDepth;
 
     bool pubOscInfoToOst(const LnetClient *);
 
   public:
-    DatanetOsc(const OscInfo *);
+    DatanetOsc(const OscInfo *, size_t rpcDepth);
     ~DatanetOsc();
     bool connectToOsts(const std::vector<OstInfo*>& , const OscInfo *);
     ssize_t sendDataToOst(unsigned , const void *, size_t );
     ssize_t recvDataFromOst(unsigned , void *, size_t );
     ssize_t sendMsgToOst(unsigned , const LnetMsg* );
     ssize_t recvMsgFromOst(unsigned , LnetMsg* );
+    ssize_t callOst(unsigned , const LnetMsg *, LnetMsg *,
+                    const void *, size_t , void *, size_t );
 };
 
 #endif // ifndef _DATANET_H_
@@ -1,3 +1,5 @@
+#include <chrono>
+#include <cstring>
 #include <iostream>
 #include <fstream>
 #include <vector>
@@ -13,32 +15,131 @@
 
 using namespace std;
 
+const size_t MAX_BW = 100 * 1024 * 1024; // MB/s
+const string CGROUP_ROOT = "/sys/fs/cgroup/blkio/";
+const double TOKEN_BURST = 0.1; // s of an app's rate that may be used at once
+
+static size_t getOstWorkersFromEnv()
+{
+  const char *workers = getenv("GIFT_OST_WORKERS");
+  if (!workers) return DEFAULT_OST_WORKERS;
+  int n = atoi(workers);
+  if (n <= 0) {
+    cerr << "Invalid number of OST workers " << workers << ", using "
+         << DEFAULT_OST_WORKERS << endl;
+    return DEFAULT_OST_WORKERS;
+  }
+  return n;
+}
+
+// Allocation enforcer named by $GIFT_BW_ENFORCER, token buckets by default
+static BwEnforcer_t getBwEnforcerFromEnv()
+{
+  const char *name = getenv("GIFT_BW_ENFORCER");
+  if (!name || strcmp(name, "tokens") == 0) return TokenBucket;
+  if (strcmp(name, "blkio") == 0) return BlkioCgroup;
+  if (strcmp(name, "iomax") == 0) return IoMaxCgroup;
+  cerr << "Unknown bandwidth enforcer " << name << ", using tokens" << endl;
+  return TokenBucket;
+}
+
+static void refill(TokenBucket_t &b, chrono::steady_clock::time_point now)
+{
+  chrono::duration<double> dt = now - b.last;
+  b.tokens = min(b.tokens + b.rate * dt.count(), b.rate * TOKEN_BURST);
+  b.last = now;
+}
+
+static string appCgroup(int id)
+{
+  return CGROUP_ROOT + "app-" + to_string(id) + "/";
+}
+
+static void freeJob(const RwJob_t &job)
+{
+  delete job.msg;
+  delete[] job.data;
+}
+
+static void deleteStream(Stream_t *s)
+{
+  for (auto job : s->jobs) {
+    freeJob(job);
+  }
+  delete s;
+}
+
 DatanetOst::DatanetOst(const OstInfo *info)
   : LnetServer(info->dataport),
     _info(info)
 {
+  this->_stopWorkers = false;
+  this->_activeAppsChanged = false;
+  this->_enforcer = getBwEnforcerFromEnv();
+  this->_io = NULL;
+  if (this->_enforcer == IoMaxCgroup) {
+    this->_io = new IoCgroups();
+    if (!this->_io->init(info->id)) {
+      cerr << "[Datanet] No io.max groups, using token buckets" << endl;
+      delete this->_io;
+      this->_io = NULL;
+      this->_enforcer = TokenBucket;
+    }
+  }
   this->_reqLock = new std::mutex();
-  this->_deletedReqsLock = new std::mutex();
+  this->_workReady = new std::condition_variable();
+  this->_oscLock = new std::mutex();
+  size_t n = getOstWorkersFromEnv();
+  for (size_t i = 0; i < n; i++) {
+    this->_workers.push_back(new std::thread([=] { this->workerLoop(); }));
+  }
 }
 
 DatanetOst::~DatanetOst()
 {
+  // No handler may run on the members freed below
+  this->stopEventLoop();
+  {
+    std::lock_guard<std::mutex> lock(*this->_reqLock);
+    this->_stopWorkers = true;
+  }
+  this->_workReady->notify_all();
+  for (auto w : this->_workers) {
+    w->join();
+    delete w;
+  }
+  // Released streams with jobs left are only on the run queue
+  for (auto s : this->_runnable) {
+    if (s->closed) deleteStream(s);
+  }
+  for (auto s : this->_streams) {
+    deleteStream(s.second);
+  }
+  for (auto l : this->_sendLocks) {
+    delete l.second;
+  }
+  delete this->_io;
   delete this->_reqLock;
-  delete this->_deletedReqsLock;
+  delete this->_workReady;
+  delete this->_oscLock;
   this->_oscs.clear();
   this->_oscSocks.clear();
-  this->_reqs.clear();
-  this->_deletedReqs.clear();
+  this->_streams.clear();
+  this->_runnable.clear();
 }
 
 void DatanetOst::addOsc(const LSocket &remote, const OscInfo *info)
 {
   LSocket *sock = new LSocket(remote.sockfd());
-  this->_oscSocks.push_back(sock);
   OscInfo *i = new OscInfo(info);
   i->sock = sock;
   std::cerr << "[Datanet] OSC " << *i << " connected" << std::endl;
-  this->_oscs.push_back(i);
+  {
+    std::lock_guard<std::mutex> lk(*this->_oscLock);
+    this->_oscSocks.push_back(sock);
+    this->_oscs.push_back(i);
+    this->_sendLocks[i] = new std::mutex();
+  }
   this->addClient(i);
 }
 
@@ -53,11 +154,7 @@ void DatanetOst::onConnect()
     remote.close();
     return;
   }
-  remote >> msg;
-  if (msg.extraData && msg.len > 0) {
-    msg.data = malloc(msg.len);
-    remote.readAll(msg.data, msg.len);
-  }
+  readMsg(&remote, &msg);
   switch (msg.t) {
     case AddOsc:
       this->addOsc(remote, (OscInfo*)msg.data);
@@ -71,20 +168,27 @@ void DatanetOst::onConnect()
 
 void DatanetOst::onDisconnect(const LnetEntity *remote)
 {
-  auto osc = std::find(this->_oscs.begin(), this->_oscs.end(), remote);
-  if (osc != std::end(this->_oscs)) {
-    this->removeClient(remote);
-    std::cerr << "[Datanet] OSC " << *remote << " disconnected" << std::endl;
+  {
+    std::lock_guard<std::mutex> lk(*this->_oscLock);
+    auto osc = std::find(this->_oscs.begin(), this->_oscs.end(), remote);
+    if (osc == std::end(this->_oscs)) return;
     this->_oscs.erase(osc);
-    return;
+    // Let a worker that is answering on the connection finish first
+    auto l = this->_sendLocks.find(remote);
+    if (l != std::end(this->_sendLocks)) {
+      l->second->lock();
+      l->second->unlock();
+      delete l->second;
+      this->_sendLocks.erase(l);
+    }
   }
+  this->removeClient(remote);
+  std::cerr << "[Datanet] OSC " << *remote << " disconnected" << std::endl;
 }
 
-void DatanetOst::onClientRequest(const LnetEntity *remote)
+void DatanetOst::onClientRequest(const LnetEntity *remote, LnetMsg *msg)
 {
   if (!remote || !remote->sock || !remote->sock->isValid()) return;
-  LnetMsg *msg = new LnetMsg(Unknown);
-  remote->recvMsgFromRemote(msg);
   // std::cerr << "[Datanet] received msg " << *msg << " from client: " << remote->name << std::endl;
   switch (msg->t) {
     case FsRequest:
@@ -96,7 +200,7 @@ void DatanetOst::onClientRequest(const LnetEntity *remote)
   }
 }
 
-void DatanetOst::onRemoteServerRequest(const LnetEntity *remote)
+void DatanetOst::onRemoteServerRequest(const LnetEntity *remote, LnetMsg *msg)
 {
   if (!remote || !remote->sock || !remote->sock->isValid()) return;
 }
@@ -107,76 +211,187 @@ void DatanetOst::handleClientFsRequest(const LnetEntity *remote, const LnetMsg *
     case Read:
     case Write:
       // this->handleClientRwRequest(remote, msg, msg->f == Write);
-      this->sendMsgToRwThread(remote, msg);
+      this->submitRw(remote, msg);
       break;
     default:
       break;
   }
 }
 
-void DatanetOst::sendMsgToRwThread(const LnetEntity *remote, const LnetMsg *msg)
+// Queue a read or write on the stream of its file. The data of a write
+// is taken here only as far as the event loop has it; otherwise the
+// connection is held for the worker to read the data, since the next msg
+// follows it. The disk I/O is left to the worker.
+void DatanetOst::submitRw(const LnetEntity *remote, const LnetMsg *msg)
 {
   assert(msg->t == FsRequest);
-  assert(msg->f == Read || msg->f == Write || msg->f == Release);
+  assert(msg->f == Read || msg->f == Write);
 
   size_t size;
   off_t offset;
   uint64_t fd;
   std::string fname;
+  msg->unmarshall(&size, &offset, &fd, &fname);
 
-  if (msg->f == Read || msg->f == Write) {
-    msg->unmarshall(&size, &offset, &fd, &fname);
-  } else { // msg->f == Close
-    msg->unmarshall(&fd, &fname);
+  RwJob_t job = {remote, new LnetMsg(Unknown), NULL, size, false};
+  job.msg->deepcopy(msg); // The payload of msg belongs to the event loop
+  if (msg->f == Write && size > 0) {
+    if (size < SPLICE_MIN && this->bulkBuffered(remote) >= size) {
+      job.data = new char[size];
+      this->recvBulk(remote, job.data, size);
+    } else {
+      job.held = true;
+    }
   }
 
-  std::lock_guard<std::mutex> lock(*this->_reqLock);
-  // Match on <remote, fd> to uniquely identify the open thread stream
-  auto req = std::find_if(this->_reqs.begin(), this->_reqs.end(),
-                         [=](const RwReq_t& elt)
-                         { return memcmp(&std::get<9>(elt), &msg->_i, sizeof msg->_i)  == 0&&
-                                  std::get<2>(elt) == (int)fd; });
-  if (req != std::end(this->_reqs)) {
-    LnetMsg *msgBuf = std::get<1>(*req);
-    msgBuf->copy(msg); // TODO: Replace this with a pointer
-    // Wake up the RW thread to process the msg
-    // LnetEntity *ent = const_cast<LnetEntity*>(std::get<0>(*req));
-    *std::get<0>(*req) = remote;
-    std::mutex *m = std::get<5>(*req);
-    std::condition_variable *cv = std::get<6>(*req);
-    bool *p = std::get<7>(*req);
-    bool *c = std::get<8>(*req);
-    this->wakeUpForMsgProcess(m, cv, p);
-    this->waitForMsgProcess(m, cv, c);
+  {
+    std::lock_guard<std::mutex> lock(*this->_reqLock);
+    auto s = this->_streams.find(StreamKey_t(msg->_i.id, (int)fd));
+    if (s != std::end(this->_streams)) {
+      Stream_t *stream = s->second;
+      if (job.held) {
+        this->holdBulk(remote);
+      }
+      stream->last = msg->f;
+      stream->jobs.push_back(job);
+      if (!stream->scheduled) {
+        stream->scheduled = true;
+        this->_runnable.push_back(stream);
+        this->_workReady->notify_one();
+      }
+      return;
+    }
   }
+  std::cerr << "[Datanet] No open stream for fd " << fd << " of App-"
+            << msg->_i.id << std::endl;
+  freeJob(job);
+  this->failRw(remote, msg, EBADF);
 }
 
-void DatanetOst::waitForMsg(std::mutex *m, std::condition_variable *cv, bool *c)
+// Answer a read or write that is not done with the error err
+void DatanetOst::failRw(const LnetEntity *remote, const LnetMsg *msg, int err)
 {
-  std::unique_lock<std::mutex> lk(*m);
-  cv->wait(lk, [=]{return *c;});
-  *c = false;
+  int ret = -1;
+  LnetMsg res(FsResponse, sizeof(ret) + sizeof(err));
+  res.reqId = msg->reqId;
+  res.marshall(&ret, &err);
+  this->sendMsgToOsc(remote, &res);
 }
 
-void DatanetOst::waitForMsgProcess(std::mutex *m, std::condition_variable *cv, bool *c)
+// Take the first runnable stream whose app is not in debt. If there is
+// none, *wakeAt is set to when the first debt is paid off.
+Stream_t *DatanetOst::takeRunnable(chrono::steady_clock::time_point *wakeAt)
 {
-  std::unique_lock<std::mutex> lk(*m);
-  cv->wait(lk, [=]{return *c;});
-  *c = false;
+  auto now = chrono::steady_clock::now();
+  *wakeAt = chrono::steady_clock::time_point::max();
+  for (auto s = this->_runnable.begin(); s != this->_runnable.end(); s++) {
+    auto b = this->_buckets.find((*s)->app.id);
+    if (b != std::end(this->_buckets)) {
+      refill(b->second, now);
+      if (b->second.tokens < 0) {
+        chrono::duration<double> debt(-b->second.tokens / b->second.rate);
+        *wakeAt = min(*wakeAt, now + chrono::duration_cast<chrono::steady_clock::duration>(debt));
+        continue;
+      }
+    }
+    Stream_t *stream = *s;
+    this->_runnable.erase(s);
+    return stream;
+  }
+  return NULL;
 }
 
-void DatanetOst::wakeUp(std::mutex *m, std::condition_variable *cv, bool *c)
+// Charge a job to the bucket of its app, if the app has a share
+void DatanetOst::takeTokens(int id, size_t bytes)
 {
-  std::lock_guard<std::mutex> lk(*m);
-  *c = true;
-  cv->notify_one();
+  auto b = this->_buckets.find(id);
+  if (b != std::end(this->_buckets)) {
+    b->second.tokens -= bytes;
+  }
 }
 
-void DatanetOst::wakeUpForMsgProcess(std::mutex *m, std::condition_variable *cv, bool *c)
+// Run the jobs of the runnable streams, one job of a stream per turn.
+// With token buckets a stream waits while its app is in debt, without
+// holding a worker. With blkio cgroups the worker instead joins the cgroup
+// of the job's app, so that the app is throttled to its share whichever
+// workers run its streams.
+void DatanetOst::workerLoop()
 {
-  std::lock_guard<std::mutex> lk(*m);
-  *c = true;
-  cv->notify_one();
+  pid_t tid = syscall(SYS_gettid);
+  string cgroup = CGROUP_ROOT;
+  std::unique_lock<std::mutex> lk(*this->_reqLock);
+  while (true) {
+    this->_workReady->wait(lk, [=]{ return this->_stopWorkers || !this->_runnable.empty(); });
+    if (this->_stopWorkers) return;
+    chrono::steady_clock::time_point wakeAt;
+    Stream_t *s = this->takeRunnable(&wakeAt);
+    if (!s) {
+      this->_workReady->wait_until(lk, wakeAt);
+      continue;
+    }
+    RwJob_t job = s->jobs.front();
+    s->jobs.pop_front();
+
+    if (this->_enforcer == TokenBucket) {
+      this->takeTokens(s->app.id, job.size);
+    } else {
+      // The cgroup of an app is removed while it has no open streams
+      auto rate = this->_allocs.rates.find(s->app.id);
+      bool throttled = rate != std::end(this->_allocs.rates);
+      if (throttled && !this->_cgroups.count(s->app.id)) {
+        this->applyAllocation(s->app.id, rate->second);
+      }
+      string target = throttled ? appCgroup(s->app.id) : CGROUP_ROOT;
+      if (this->_enforcer == BlkioCgroup && target != cgroup &&
+          this->moveToCgroup(tid, target)) {
+        cgroup = target;
+      }
+    }
+    lk.unlock();
+
+    if (job.msg->f == Write) {
+      OstOps::ost_write(this, job.remote, job.msg, job.data);
+      if (job.held) {
+        this->resumeBulk(job.remote);
+      }
+    } else {
+      OstOps::ost_read(this, job.remote, job.msg);
+    }
+    freeJob(job);
+
+    lk.lock();
+    if (!s->jobs.empty()) {
+      this->_runnable.push_back(s); // Take turns with the other streams
+    } else {
+      s->scheduled = false;
+      if (s->closed) delete s;
+    }
+  }
+}
+
+// Answer a request on the data connection of an OSC. Workers running
+// streams of the same OSC take turns on the connection.
+ssize_t DatanetOst::sendMsgToOsc(const LnetEntity *remote, const LnetMsg *msg,
+                                 const void *bulk, size_t bulkLen) const
+{
+  std::unique_lock<std::mutex> lk(*this->_oscLock);
+  auto l = this->_sendLocks.find(remote);
+  if (l == std::end(this->_sendLocks)) return -1; // Disconnected
+  std::lock_guard<std::mutex> sendLk(*l->second);
+  lk.unlock();
+  return remote->sendMsgToRemote(msg, bulk, bulkLen);
+}
+
+// Like sendMsgToOsc(), with the raw data sent from a file
+ssize_t DatanetOst::sendFileToOsc(const LnetEntity *remote, const LnetMsg *msg,
+                                  int fd, off_t offset, size_t len) const
+{
+  std::unique_lock<std::mutex> lk(*this->_oscLock);
+  auto l = this->_sendLocks.find(remote);
+  if (l == std::end(this->_sendLocks)) return -1; // Disconnected
+  std::lock_guard<std::mutex> sendLk(*l->second);
+  lk.unlock();
+  return remote->sendFileToRemote(msg, fd, offset, len);
 }
 
 // For one thread per write request
@@ -223,136 +438,189 @@ void DatanetOst::wakeUpForMsgProcess(std::mutex *m, std::condition_variable *cv,
 //   cv->notify_one();
 // }
 
-void DatanetOst::enqueue(const LnetEntity **remote,
-                         LnetMsg *msg,
-                         int fd,
-                         const std::thread *th,
-                         pid_t tid,
-                         std::mutex *m,
-                         std::condition_variable *cv,
-                         bool *pThreadReady,
-                         bool *wThreadReqProcessed,
-                         AppInfo i)
+void DatanetOst::openStream(int fd, AppInfo i)
 {
+  if (this->_io) {
+    this->_io->addDevice(fd);
+  }
+  Stream_t *s = new Stream_t();
+  s->app = i;
+  s->fd = fd;
+  s->last = Open;
+  s->scheduled = false;
+  s->closed = false;
   std::lock_guard<std::mutex> lock(*this->_reqLock);
-  this->_reqs.push_back(std::make_tuple(remote, msg, fd, th, tid,
-                                        m, cv, pThreadReady,
-                                        wThreadReqProcessed, i));
+  this->_streams[StreamKey_t(i.id, fd)] = s;
+  if (this->_appStreams[i.id]++ == 0) {
+    this->_activeAppsChanged = true;
+  }
 }
 
-void DatanetOst::dequeue(const LnetEntity *remote, const LnetMsg *msg, AppInfo i)
+// The stream stops counting as active once its file is released, so that
+// the lnet thread sees the change when the release returns. Jobs still
+// queued on it are run before it is deleted.
+void DatanetOst::closeStream(int id, int fd)
 {
   std::lock_guard<std::mutex> lock(*this->_reqLock);
-  auto req = std::find_if(this->_reqs.begin(), this->_reqs.end(),
-                         [=](const RwReq_t& elt)
-                         { return memcmp(&std::get<9>(elt), &i, sizeof i) == 0 &&
-                                  std::get<1>(elt) == msg; });
-  if (req != std::end(this->_reqs)) {
-    this->markReqForDeletion(*req);
-    this->_reqs.erase(req);
+  auto s = this->_streams.find(StreamKey_t(id, fd));
+  if (s == std::end(this->_streams)) return;
+  if (s->second->scheduled) {
+    s->second->closed = true;
+  } else {
+    delete s->second;
+  }
+  this->_streams.erase(s);
+  auto n = this->_appStreams.find(id);
+  if (n != std::end(this->_appStreams) && --n->second == 0) {
+    this->_appStreams.erase(n);
+    this->_activeAppsChanged = true;
+  }
+}
+
+// Read or write a file for an app, through the helper in the app's io
+// group if it has one
+ssize_t DatanetOst::readFile(int id, int fd, void *buf, size_t size, off_t offset) const
+{
+  ssize_t ret;
+  if (this->_io && this->_io->pread(id, fd, buf, size, offset, &ret)) return ret;
+  return ::pread(fd, buf, size, offset);
+}
+
+// Whether the files of an app may be read and written here rather than
+// by its helper
+bool DatanetOst::doesIoHere(int id) const
+{
+  return !this->_io || !this->_io->hasGroup(id);
+}
+
+ssize_t DatanetOst::writeFile(int id, int fd, const void *buf, size_t size, off_t offset) const
+{
+  ssize_t ret;
+  if (this->_io && this->_io->pwrite(id, fd, buf, size, offset, &ret)) return ret;
+  return ::pwrite(fd, buf, size, offset);
+}
+
+// Move a worker into a blkio cgroup:
+// echo $TID > /sys/fs/cgroup/blkio/app-1/tasks
+bool DatanetOst::moveToCgroup(pid_t tid, const string &dirname)
+{
+  ofstream procfile(dirname + "tasks", ofstream::out);
+  if (!procfile.is_open()) {
+    perror("open procfile");
+    return false;
   }
+  procfile << tid;
+  procfile.close();
+  return !procfile.fail();
 }
 
-void DatanetOst::moveToCgroup(pid_t tid, size_t bw)
+// Throttle the app to its share: set the rate of its bucket, keeping the
+// tokens or the debt it has, or that of its cgroup, which the workers join
+// when they run the app's jobs. Called with _reqLock held.
+void DatanetOst::applyAllocation(int id, double r)
 {
-  // sudo mkdir -p /sys/fs/cgroup/blkio/g1
+  if (this->_enforcer == TokenBucket) {
+    auto now = chrono::steady_clock::now();
+    double rate = r * MAX_BW;
+    auto b = this->_buckets.find(id);
+    if (rate <= 0) {
+      // Like a blkio limit of 0, no share means no limit
+      if (b != std::end(this->_buckets)) this->_buckets.erase(b);
+    } else if (b == std::end(this->_buckets)) {
+      this->_buckets[id] = {rate, rate * TOKEN_BURST, now};
+    } else {
+      refill(b->second, now);
+      b->second.rate = rate;
+    }
+    return;
+  }
+  if (this->_enforcer == IoMaxCgroup) {
+    if (this->_io->setLimit(id, (size_t)(max(r, 0.0) * MAX_BW))) {
+      this->_cgroups.insert(id);
+    }
+    return;
+  }
+  // sudo mkdir -p /sys/fs/cgroup/blkio/app-1
   // cat /proc/partitions  # To get the device major:minor number
-  // sudo sh -c echo "8:0 1048576" > /sys/fs/cgroup/blkio/g1/blkio.throttle.write_bps_device
-  // echo $$ > /sys/fs/cgroup/blkio/g1/cgroup.procs # For process
-  // echo $TID > /sys/fs/cgroup/blkio/g1/tasks # For process
-
-  // FIXME: This mkdir and write to tasks file should only happen once on
-  // thread startup
-  string dirname = "/sys/fs/cgroup/blkio/";
-  dirname += to_string(tid);
-  int ret = mkdir(dirname.c_str(), 0777);
-  if (ret < 0) {
+  // sudo sh -c echo "8:0 1048576" > /sys/fs/cgroup/blkio/app-1/blkio.throttle.write_bps_device
+  string dirname = appCgroup(id);
+  if (mkdir(dirname.c_str(), 0777) < 0 && errno != EEXIST) {
     perror("mkdir");
   }
-  string filename = dirname + "/blkio.throttle.write_bps_device";
-  ofstream bwfile(filename, ofstream::out);
+  cerr << "[OST] Set cgroup of App-" << id << " to bw: " << r << endl;
+  ofstream bwfile(dirname + "blkio.throttle.write_bps_device", ofstream::out);
   if (!bwfile.is_open()) {
     perror("open bwfile");
+    return;
   }
-  bwfile << "8:0 " << bw;
+  bwfile << "8:0 " << (size_t)(r * MAX_BW);
   bwfile.close();
-  string procfname = dirname + "/tasks";
-  ofstream procfile(procfname, ofstream::out);
-  if (!procfile.is_open()) {
-    perror("open procfile");
-  }
-  procfile << tid;
-  procfile.close();
+  this->_cgroups.insert(id);
 }
 
-void DatanetOst::setAllocations(const LnetEntity *remote, const LnetMsg *msg)
+// Apply a full or delta Allocs msg to the allocation table. Only the
+// entries that change are applied. Returns false if a delta is not based
+// on the version held here, in which case the MDS must resend the table.
+bool DatanetOst::setAllocations(const LnetEntity *remote, const LnetMsg *msg)
 {
   // Perhaps we can acquire the lock later
   std::lock_guard<std::mutex> lock(*this->_reqLock);
 
-  const size_t MAX_BW = 100 * 1024 * 1024; // MB/s
-  size_t count = 0;
-  size_t offset = 0;
-  msg->extractData(&count, offset);
-  assert(count >= 0);
-  if (count == 0) return;
-  AppAllocs_t bws;
-  for (size_t i = 0; i < count; i++) {
-    int id;
-    double r;
-    msg->extractData(&id, offset);
-    msg->extractData(&r, offset);
-    bws.push_back(std::make_tuple(id, r));
-  }
-
-  for (auto a : bws) {
-    auto r = std::find_if(this->_reqs.begin(), this->_reqs.end(),
-                           [=](const RwReq_t& elt)
-                           { return std::get<9>(elt).id == std::get<0>(a); });
-    if (r != std::end(this->_reqs)) {
-      pid_t tid  = std::get<4>(*r);
-      cerr << "[OST] Assign " << tid << " to cgroup with bw: " << std::get<1>(a) << endl;
-      moveToCgroup(tid, (int)(std::get<1>(a) * MAX_BW));
+  std::map<int, double> changed;
+  if (!this->_allocs.apply(msg, &changed)) return false;
+  for (auto a : changed) {
+    this->applyAllocation(a.first, a.second);
+  }
+  // The apps without a share are no longer held back
+  for (auto b = this->_buckets.begin(); b != this->_buckets.end(); ) {
+    b = this->_allocs.rates.count(b->first) ? std::next(b) : this->_buckets.erase(b);
+  }
+  if (this->_io) {
+    for (auto id : this->_cgroups) {
+      if (!this->_allocs.rates.count(id)) this->_io->setLimit(id, 0);
     }
   }
+  this->_workReady->notify_all();
+  return true;
 }
 
-void DatanetOst::markReqForDeletion(const RwReq_t& req)
+// Remove the cgroups of the apps without open streams. A cgroup that an
+// idle worker is still in is removed on a later pass.
+void DatanetOst::garbageCollectCgroups()
 {
-  std::lock_guard<std::mutex> lock(*this->_deletedReqsLock);
-  this->_deletedReqs.push_back(req);
+  std::lock_guard<std::mutex> lock(*this->_reqLock);
+  for (auto id = this->_cgroups.begin(); id != this->_cgroups.end(); ) {
+    if (this->_appStreams.count(*id)) {
+      ++id;
+    } else if (this->_io) {
+      this->_io->removeGroup(*id);
+      std::cerr << "[Datanet] GC: io group of App-" << *id << std::endl;
+      id = this->_cgroups.erase(id);
+    } else if (rmdir(appCgroup(*id).c_str()) < 0 && errno == EBUSY) {
+      ++id;
+    } else {
+      std::cerr << "[Datanet] GC: cgroup of App-" << *id << std::endl;
+      id = this->_cgroups.erase(id);
+    }
+  }
 }
 
-void DatanetOst::garbageCollectCompletedReqs()
+// Returns true, once, if an app has started or stopped doing I/O on this
+// OST since the last call. Changes in the number of streams of an already
+// active app are left to the next timer epoch.
+bool DatanetOst::takeActiveAppsChange()
 {
-  std::lock_guard<std::mutex> lock(*this->_deletedReqsLock);
-  for (auto req : this->_deletedReqs) {
-    const LnetMsg *msg = std::get<1>(req);
-    delete std::get<0>(req); // delete remote object ptr
-    std::cerr << "[Datanet] GC: " << msg->f << " for App-" << std::get<9>(req).id << std::endl;
-    delete std::get<1>(req); // delete msg
-    // delete std::get<2>(req); // delete thread
-    delete std::get<5>(req); // delete m
-    delete std::get<6>(req); // delete cv
-    delete std::get<7>(req); // delete bool
-    delete std::get<8>(req); // delete bool
-    string dirname = "/sys/fs/cgroup/blkio/";
-    dirname += to_string(std::get<4>(req));
-    int ret = rmdir(dirname.c_str());
-    if (ret < 0) {
-      perror("rmdir");
-    }
-  }
-  this->_deletedReqs.clear();
+  std::lock_guard<std::mutex> lock(*this->_reqLock);
+  bool changed = this->_activeAppsChanged;
+  this->_activeAppsChanged = false;
+  return changed;
 }
 
 void DatanetOst::getActiveRequests(std::vector<ActiveRequest> &reqs) const
 {
   std::lock_guard<std::mutex> lock(*this->_reqLock);
-  for (auto req : this->_reqs) {
-    const LnetMsg *msg = std::get<1>(req);
-    AppInfo inf = std::get<9>(req);
-    ActiveRequest rq = {._info = inf, ._t = msg->f};
+  for (auto s : this->_streams) {
+    ActiveRequest rq = {._info = s.second->app, ._t = s.second->last};
     reqs.push_back(rq);
   }
 }
@@ -2,63 +2,116 @@
 #define _DATANET_OST_H_
 
 #include <ctype.h>
+#include <chrono>
 #include <vector>
+#include <deque>
+#include <map>
+#include <set>
 #include <mutex>
 #include <condition_variable>
 #include <thread>
 
 #include "lsocket.h"
 #include "lnet.h"
+#include "io_cgroup.h"
+
+const size_t DEFAULT_OST_WORKERS = 8;
+const size_t SPLICE_MIN = 64 * 1024; // smaller writes are copied
+
+// How the allocations are enforced, named by $GIFT_BW_ENFORCER
+enum BwEnforcer_t {
+  TokenBucket, // in the workers, for reads and writes alike
+  BlkioCgroup, // by the kernel, for the writes to device 8:0
+  IoMaxCgroup  // by the kernel, through cgroup v2 io.max on the disks used
+};
+
+// A read or write waiting for a worker
+struct RwJob_t
+{
+  const LnetEntity *remote;
+  LnetMsg *msg;   // copy of the request
+  char *data;     // data of a write the event loop had buffered
+  size_t size;    // bytes to read or write
+  bool held;      // the worker reads the rest of the data off the connection
+};
+
+// The bandwidth share of an app. The bytes of each job are taken when it
+// starts, possibly leaving a debt; the app's streams wait out the debt.
+struct TokenBucket_t
+{
+  double rate;   // bytes/s
+  double tokens; // bytes, negative while in debt
+  std::chrono::steady_clock::time_point last; // last refill
+};
+
+// The requests on one open file of an app. A worker runs one job of a
+// stream at a time, so requests on a file are executed in order.
+struct Stream_t
+{
+  AppInfo app;
+  int fd;
+  FsRequestType last;      // type of the last request, reported to the MDS
+  std::deque<RwJob_t> jobs;
+  bool scheduled;          // in _runnable or being run by a worker
+  bool closed;             // released; deleted once its jobs are done
+};
 
 class DatanetOst: public LnetServer
 {
   private:
-    using RwReq_t = std::tuple<const LnetEntity**,
-                               LnetMsg*,
-                               int ,
-                               const std::thread*,
-                               pid_t ,
-                               std::mutex* ,
-                               std::condition_variable* ,
-                               bool *,
-                               bool *,
-                               AppInfo>;
+    using StreamKey_t = std::pair<int, int>; // <app id, fd>
     const OstInfo *_info;
     std::vector<OscInfo*> _oscs;
     std::vector<LSocket*> _oscSocks;
-    std::vector<RwReq_t> _reqs;
-    std::vector<RwReq_t> _deletedReqs;
-    std::mutex *_reqLock;
-    std::mutex *_deletedReqsLock;
+    std::map<const LnetEntity*, std::mutex*> _sendLocks; // one sender per OSC connection
+    std::map<StreamKey_t, Stream_t*> _streams;
+    std::deque<Stream_t*> _runnable; // streams with jobs, in turn order
+    std::vector<std::thread*> _workers;
+    bool _stopWorkers;
+    std::map<int, int> _appStreams; // app id -> number of open streams
+    bool _activeAppsChanged;
+    AllocTable_t _allocs;
+    BwEnforcer_t _enforcer;
+    std::map<int, TokenBucket_t> _buckets; // app id -> bucket, for TokenBucket
+    std::set<int> _cgroups; // apps with a throttled cgroup
+    IoCgroups *_io; // for IoMaxCgroup
+    std::mutex *_reqLock; // guards the streams, the allocations, the buckets and the cgroups
+    std::condition_variable *_workReady;
+    std::mutex *_oscLock; // guards _oscs, _oscSocks and _sendLocks
 
     void addOsc(const LSocket &, const OscInfo *);
     void handleClientFsRequest(const LnetEntity *remote, const LnetMsg *msg);
-    void markReqForDeletion(const RwReq_t& );
-    void moveToCgroup(pid_t , size_t );
+    void submitRw(const LnetEntity *, const LnetMsg *);
+    void failRw(const LnetEntity *, const LnetMsg *, int );
+    void workerLoop();
+    Stream_t *takeRunnable(std::chrono::steady_clock::time_point *);
+    void takeTokens(int , size_t );
+    bool moveToCgroup(pid_t , const std::string& );
+    void applyAllocation(int , double );
 
     // void handleClientRwRequest(const LnetEntity* , const LnetMsg* , bool );
 
   protected:
     virtual void onConnect();
     virtual void onDisconnect(const LnetEntity *);
-    virtual void onClientRequest(const LnetEntity *);
-    virtual void onRemoteServerRequest(const LnetEntity *);
+    virtual void onClientRequest(const LnetEntity *, LnetMsg *);
+    virtual void onRemoteServerRequest(const LnetEntity *, LnetMsg *);
 
   public:
     DatanetOst(const OstInfo *);
     virtual ~DatanetOst();
-    void enqueue(const LnetEntity **, LnetMsg *, int , const std::thread *,
-                 pid_t , std::mutex* , std::condition_variable* ,
-                 bool *, bool *, AppInfo );
-    void dequeue(const LnetEntity *, const LnetMsg *, AppInfo );
-    void sendMsgToRwThread(const LnetEntity *, const LnetMsg *);
-    void setAllocations(const LnetEntity *, const LnetMsg *);
-    void garbageCollectCompletedReqs();
+    void openStream(int , AppInfo );
+    void closeStream(int , int );
+    ssize_t sendMsgToOsc(const LnetEntity *, const LnetMsg *,
+                         const void *bulk = NULL, size_t bulkLen = 0) const;
+    ssize_t sendFileToOsc(const LnetEntity *, const LnetMsg *, int , off_t , size_t ) const;
+    ssize_t readFile(int , int , void *, size_t , off_t ) const;
+    bool doesIoHere(int ) const;
+    ssize_t writeFile(int , int , const void *, size_t , off_t ) const;
+    bool setAllocations(const LnetEntity *, const LnetMsg *);
+    void garbageCollectCgroups();
     void getActiveRequests(std::vector<ActiveRequest>& ) const;
-    void waitForMsg(std::mutex *, std::condition_variable *, bool *);
-    void waitForMsgProcess(std::mutex *, std::condition_variable *, bool *);
-    void wakeUp(std::mutex *, std::condition_variable *, bool *);
-    void wakeUpForMsgProcess(std::mutex *, std::condition_variable *, bool *);
+    bool takeActiveAppsChange();
 };
 
 
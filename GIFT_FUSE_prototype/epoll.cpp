@@ -1,55 +1,523 @@
+#include <algorithm>
 #include <cassert>
+#include <chrono>
+#include <fcntl.h>
+#include <iostream>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
 
 #include "lnet.h"
 
+#ifdef MSG_NOSIGNAL
+static const int SEND_FLAGS = MSG_DONTWAIT | MSG_NOSIGNAL;
+#else // ifdef MSG_NOSIGNAL
+static const int SEND_FLAGS = MSG_DONTWAIT;
+#endif // ifdef MSG_NOSIGNAL
+
+// Peers are watched edge-triggered: the loop reads until the socket would
+// block, so one event is enough for all the msgs that arrived together
+#ifdef EPOLLRDHUP
+static const uint32_t PEER_EVENTS = EPOLLIN | EPOLLRDHUP | EPOLLET;
+#else // ifdef EPOLLRDHUP
+static const uint32_t PEER_EVENTS = EPOLLIN | EPOLLET;
+#endif // ifdef EPOLLRDHUP
+
+// Number of event loops of a server, from GIFT_EVENT_LOOPS
+static size_t getEventLoopsFromEnv()
+{
+  const char *loops = getenv("GIFT_EVENT_LOOPS");
+  if (!loops) return DEFAULT_EVENT_LOOPS;
+  int n = atoi(loops);
+  if (n <= 0) {
+    std::cerr << "Invalid number of event loops " << loops << ", using "
+              << DEFAULT_EVENT_LOOPS << std::endl;
+    return DEFAULT_EVENT_LOOPS;
+  }
+  return n;
+}
+
+static void clearOutQueue(OutQueue_t *q)
+{
+  for (auto b : q->bufs) {
+    LnetBufPool::instance()->release(b.databuf);
+  }
+  q->bufs.clear();
+  q->off = 0;
+}
+
 Epoll::Epoll()
+ : _nextShard(0),
+   _outLock(new std::mutex()),
+   _outDrained(new std::condition_variable()),
+   _inLock(new std::mutex())
 {
-  this->_epollFd = epoll_create(MAX_EVENTS);
-  assert(this->_epollFd > 0);
-  memset(this->_events, 0, sizeof(this->_events));
+  size_t n = getEventLoopsFromEnv();
+  for (size_t i = 0; i < n; i++) {
+    Shard_t *s = new Shard_t();
+    s->epollFd = epoll_create(MAX_EVENTS);
+    assert(s->epollFd > 0);
+    s->stopFd = eventfd(0, EFD_NONBLOCK);
+    assert(s->stopFd >= 0);
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.ptr = s;
+    assert(epoll_ctl(s->epollFd, EPOLL_CTL_ADD, s->stopFd, &ev) != -1);
+    s->wakeFd = eventfd(0, EFD_NONBLOCK);
+    assert(s->wakeFd >= 0);
+    ev.data.ptr = &s->wakeFd;
+    assert(epoll_ctl(s->epollFd, EPOLL_CTL_ADD, s->wakeFd, &ev) != -1);
+    memset(s->events, 0, sizeof(s->events));
+    this->_shards.push_back(s);
+  }
 }
 
 Epoll::~Epoll()
 {
-  this->_epollFd = -1;
-  memset(this->_events, 0, sizeof(this->_events));
+  for (auto s : this->_shards) {
+    ::close(s->epollFd);
+    ::close(s->stopFd);
+    ::close(s->wakeFd);
+    delete s;
+  }
+  this->_shards.clear();
+  for (auto q : this->_outQueues) {
+    clearOutQueue(q.second);
+    delete q.second;
+  }
+  this->_outQueues.clear();
+  this->_inBufs.clear();
+  delete this->_outLock;
+  delete this->_outDrained;
+  delete this->_inLock;
 }
 
 void Epoll::addRemoteServer(const LnetEntity *remote)
 {
   if (!remote || !remote->sock->isValid()) return;
-  struct epoll_event ev;
-
-#ifdef EPOLLRDHUP
-  ev.events = EPOLLIN | EPOLLRDHUP;
-#else // ifdef EPOLLRDHUP
-  ev.events = EPOLLIN;
-#endif // ifdef EPOLLRDHUP
-  ev.data.ptr = (void*)remote;
-  assert(epoll_ctl(this->_epollFd, EPOLL_CTL_ADD, remote->sock->sockfd(), &ev) != -1);
+  this->watch(remote);
 }
 
 void Epoll::addClient(const LnetEntity *remote)
 {
   if (!remote || !remote->sock) return;
+  this->watch(remote);
+}
+
+// Give a peer its queues and make its socket non-blocking before the loop
+// sees it
+void Epoll::watch(const LnetEntity *remote)
+{
+  Shard_t *shard = NULL;
+  {
+    std::lock_guard<std::mutex> lk(*this->_inLock);
+    shard = this->_shards[this->_nextShard++ % this->_shards.size()];
+    this->_inBufs[remote] = std::make_shared<InBuf_t>(shard);
+  }
+  {
+    std::lock_guard<std::mutex> lk(*this->_outLock);
+    this->_outQueues[remote] = new OutQueue_t(shard);
+  }
+  remote->sock->setNonBlocking();
   struct epoll_event ev;
 
-#ifdef EPOLLRDHUP
-  ev.events = EPOLLIN | EPOLLRDHUP;
-#else // ifdef EPOLLRDHUP
-  ev.events = EPOLLIN;
-#endif // ifdef EPOLLRDHUP
+  ev.events = PEER_EVENTS;
   ev.data.ptr = (void*)remote;
-  assert(epoll_ctl(this->_epollFd, EPOLL_CTL_ADD, remote->sock->sockfd(), &ev) != -1);
+  assert(epoll_ctl(shard->epollFd, EPOLL_CTL_ADD, remote->sock->sockfd(), &ev) != -1);
+}
+
+bool Epoll::onLoopThread() const
+{
+  for (auto s : this->_shards) {
+    if (s->loopThread == std::this_thread::get_id()) return true;
+  }
+  return false;
 }
 
 void Epoll::removeClient(const LnetEntity *remote)
 {
   if (!remote || !remote->sock) return;
+  {
+    std::lock_guard<std::mutex> lk(*this->_inLock);
+    // A handler of the peer still running keeps its own reference
+    this->_inBufs.erase(remote);
+  }
+  std::lock_guard<std::mutex> lk(*this->_outLock);
+  auto q = this->_outQueues.find(remote);
+  if (q != std::end(this->_outQueues)) {
+    struct epoll_event ev;
+
+    ev.data.ptr = (void*)remote;
+    assert(epoll_ctl(q->second->shard->epollFd, EPOLL_CTL_DEL, remote->sock->sockfd(), &ev) != -1);
+    clearOutQueue(q->second);
+    delete q->second;
+    this->_outQueues.erase(q);
+  }
+  // Wake up the senders blocked on the queue
+  this->_outDrained->notify_all();
+}
+
+// Queue a msg to a peer and write as much of it as the socket takes without
+// blocking; the event loop writes the rest on EPOLLOUT. While the queue of
+// the peer is full, a sender on an event loop fails at once, as waiting
+// would hold back every peer of its shard, and any other sender waits for
+// at most OUT_QUEUE_TIMEOUT_MS. Returns -1, with errno set to EAGAIN, if
+// the msg is not queued; the caller decides what the loss means.
+ssize_t Epoll::queueMsgToRemote(const LnetEntity *remote, const LnetMsg *msg) const
+{
+  if (!remote || !msg || !remote->sock || !remote->sock->isValid()) return -1;
+  std::unique_lock<std::mutex> lk(*this->_outLock);
+  auto q = this->_outQueues.find(remote);
+  if (q == std::end(this->_outQueues)) {
+    lk.unlock();
+    return remote->sendMsgToRemote(msg);
+  }
+
+  auto until = std::chrono::steady_clock::now() + std::chrono::milliseconds(OUT_QUEUE_TIMEOUT_MS);
+  this->flushOutQueue(remote, q->second);
+  while (q->second->bufs.size() >= MAX_OUT_QUEUE) {
+    if (this->onLoopThread() || std::chrono::steady_clock::now() >= until) {
+      std::cerr << "Outbound queue to " << *remote << " is full, not sending msg "
+                << *msg << std::endl;
+      errno = EAGAIN;
+      return -1;
+    }
+    this->_outDrained->wait_until(lk, until);
+    q = this->_outQueues.find(remote);
+    if (q == std::end(this->_outQueues)) return -1;
+    this->flushOutQueue(remote, q->second);
+  }
+
+  LnetHdr_t hdr;
+  msg->toHdr(&hdr);
+  BufType buf = {sizeof(hdr) + hdr.len, LnetBufPool::instance()->alloc(sizeof(hdr) + hdr.len)};
+  memcpy(buf.databuf, &hdr, sizeof(hdr));
+  if (hdr.len > 0) {
+    memcpy((char*)buf.databuf + sizeof(hdr), msg->data, hdr.len);
+  }
+  q->second->bufs.push_back(buf);
+  this->flushOutQueue(remote, q->second);
+  return buf.sz;
+}
+
+// The socket of a peer has room again. Called on the event loop.
+void Epoll::onWritable(const LnetEntity *remote)
+{
+  std::lock_guard<std::mutex> lk(*this->_outLock);
+  auto q = this->_outQueues.find(remote);
+  if (q != std::end(this->_outQueues)) {
+    this->flushOutQueue(remote, q->second);
+  }
+}
+
+// Write the queued msgs until the socket would block, and wait for EPOLLOUT
+// if some are left. Called with _outLock held.
+void Epoll::flushOutQueue(const LnetEntity *remote, OutQueue_t *q) const
+{
+  bool drained = false;
+  while (!q->bufs.empty()) {
+    const BufType &b = q->bufs.front();
+    ssize_t rc = ::send(remote->sock->sockfd(), (char*)b.databuf + q->off,
+                        b.sz - q->off, SEND_FLAGS);
+    if (rc == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno != EAGAIN && errno != EWOULDBLOCK) {
+        // The peer is gone: drop its msgs, the event loop handles the hangup
+        clearOutQueue(q);
+        drained = true;
+      }
+      break;
+    }
+    q->off += rc;
+    if (q->off == b.sz) {
+      LnetBufPool::instance()->release(b.databuf);
+      q->bufs.pop_front();
+      q->off = 0;
+      drained = true;
+    }
+  }
+  if (drained) {
+    this->_outDrained->notify_all();
+  }
+  this->setWritableEvent(remote, q, !q->bufs.empty());
+}
+
+void Epoll::setWritableEvent(const LnetEntity *remote, OutQueue_t *q, bool enable) const
+{
+  if (q->armed == enable) return;
   struct epoll_event ev;
 
+  ev.events = PEER_EVENTS;
+  if (enable) {
+    ev.events |= EPOLLOUT;
+  }
   ev.data.ptr = (void*)remote;
-  assert(epoll_ctl(this->_epollFd, EPOLL_CTL_DEL, remote->sock->sockfd(), &ev) != -1);
+  if (epoll_ctl(q->shard->epollFd, EPOLL_CTL_MOD, remote->sock->sockfd(), &ev) != -1) {
+    q->armed = enable;
+  }
+}
+
+// Returns NULL once the peer is removed. *held tells whether another
+// thread is taking the raw data of the peer, see holdBulk().
+std::shared_ptr<InBuf_t> Epoll::getInBuf(const LnetEntity *remote, bool *held) const
+{
+  std::lock_guard<std::mutex> lk(*this->_inLock);
+  auto in = this->_inBufs.find(remote);
+  if (in == std::end(this->_inBufs)) return NULL;
+  if (held) {
+    *held = in->second->held;
+  }
+  return in->second;
+}
+
+// Read all that a peer has sent, handing out the msgs as they complete.
+// Returns false if the peer is gone. Called on the event loop.
+bool Epoll::onReadable(const LnetEntity *remote)
+{
+  while (true) {
+    if (!this->handleMsgs(remote)) return false;
+    bool held;
+    std::shared_ptr<InBuf_t> in = this->getInBuf(remote, &held);
+    if (!in) return false;
+    if (held) return true; // Read again on resumeBulk()
+
+    // Make room for the rest of the msg being read
+    if (in->start > 0) {
+      memmove(in->buf, in->buf + in->start, in->end - in->start);
+      in->end -= in->start;
+      in->start = 0;
+    }
+    if (in->end == in->cap) {
+      // Bounded by MAX_MSG_LEN, as handleMsgs() takes every complete msg
+      char *buf = (char*)realloc(in->buf, in->cap * 2);
+      if (!buf) {
+        std::cerr << "No memory for the msgs of " << *remote << std::endl;
+        this->onDisconnect(remote);
+        return false;
+      }
+      in->buf = buf;
+      in->cap *= 2;
+    }
+    ssize_t rc = ::recv(remote->sock->sockfd(), in->buf + in->end, in->cap - in->end, 0);
+    if (rc > 0) {
+      in->end += rc;
+    } else if (rc == -1 && errno == EINTR) {
+      continue;
+    } else if (rc == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      return true;
+    } else {
+      this->onDisconnect(remote);
+      return false;
+    }
+  }
+}
+
+// Hand each complete msg of the input buffer to the server. Returns false
+// if the peer is gone or sent something that cannot be framed.
+bool Epoll::handleMsgs(const LnetEntity *remote)
+{
+  while (true) {
+    bool held;
+    std::shared_ptr<InBuf_t> in = this->getInBuf(remote, &held);
+    if (!in) return false;
+    if (held) break;
+
+    // Drop the raw data the handler of the last msg left
+    size_t skip = std::min(in->bulkLeft, in->end - in->start);
+    in->start += skip;
+    in->bulkLeft -= skip;
+    if (in->bulkLeft > 0 || in->end - in->start < sizeof(LnetHdr_t)) break;
+
+    LnetHdr_t hdr;
+    memcpy(&hdr, in->buf + in->start, sizeof(hdr));
+    LnetMsg msg(Unknown);
+    if (!msg.fromHdr(&hdr)) {
+      std::cerr << "Msg of protocol version " << (int)hdr.version << " received from "
+                << *remote << ", expected " << (int)LNET_VERSION << std::endl;
+      this->onDisconnect(remote);
+      return false;
+    }
+    if (hdr.len > MAX_MSG_LEN || hdr.bulkLen > MAX_BULK_LEN) {
+      std::cerr << "Msg of " << hdr.len << " bytes and " << hdr.bulkLen
+                << " bytes of raw data received from " << *remote << ", dropping it" << std::endl;
+      this->onDisconnect(remote);
+      return false;
+    }
+    if (in->end - in->start < sizeof(hdr) + hdr.len) break;
+    if (msg.extraData && msg.len > 0) {
+      msg.allocData();
+      memcpy(msg.data, in->buf + in->start + sizeof(hdr), msg.len);
+    }
+    in->start += sizeof(hdr) + hdr.len;
+    in->bulkLeft = msg.bulkLen;
+    this->onClientRequest(remote, &msg);
+  }
+  return true;
+}
+
+// Keep the event loop off a peer while another thread takes the raw data
+// following the msg being handled, so that the handler need not wait for
+// it. Called by the handler; the thread calls resumeBulk() when done.
+void Epoll::holdBulk(const LnetEntity *remote)
+{
+  std::lock_guard<std::mutex> lk(*this->_inLock);
+  auto in = this->_inBufs.find(remote);
+  if (in != std::end(this->_inBufs)) {
+    in->second->held = true;
+  }
+}
+
+// Have the event loop of a held peer handle the rest of what it sent
+void Epoll::resumeBulk(const LnetEntity *remote)
+{
+  std::lock_guard<std::mutex> lk(*this->_inLock);
+  auto in = this->_inBufs.find(remote);
+  if (in == std::end(this->_inBufs) || !in->second->held) return;
+  in->second->held = false;
+  Shard_t *shard = in->second->shard;
+  shard->resumed.push_back(std::make_pair(remote, std::weak_ptr<InBuf_t>(in->second)));
+  uint64_t one = 1;
+  if (::write(shard->wakeFd, &one, sizeof(one)) != sizeof(one)) {
+    std::cerr << "Cannot wake up event loop: " << strerror(errno) << std::endl;
+  }
+}
+
+// Read the peers resumed since the last wakeup. Called on the event loop.
+void Epoll::onResumed(Shard_t *shard)
+{
+  uint64_t n;
+  while (::read(shard->wakeFd, &n, sizeof(n)) == -1 && errno == EINTR);
+  std::vector<std::pair<const LnetEntity*, std::weak_ptr<InBuf_t>>> resumed;
+  {
+    std::lock_guard<std::mutex> lk(*this->_inLock);
+    resumed.swap(shard->resumed);
+  }
+  for (auto &r : resumed) {
+    // Skip a peer removed since, even if another took its address
+    std::shared_ptr<InBuf_t> in = this->getInBuf(r.first);
+    if (in && in == r.second.lock()) {
+      this->onReadable(r.first);
+    }
+  }
+}
+
+// Raw data of the msg being handled that recvBulk() returns without
+// reading the socket
+size_t Epoll::bulkBuffered(const LnetEntity *remote) const
+{
+  std::shared_ptr<InBuf_t> in = this->getInBuf(remote);
+  return in ? std::min(in->bulkLeft, in->end - in->start) : 0;
+}
+
+// The raw data of a peer cannot be read in full, so its next msg cannot be
+// found: shut the socket down, and the event loop drops the peer
+static void breakOff(const LnetEntity *remote, const char *why)
+{
+  std::cerr << "Raw data from " << *remote << " " << why << ", dropping it" << std::endl;
+  ::shutdown(remote->sock->sockfd(), SHUT_RDWR);
+}
+
+// Wait until a socket has more raw data, for at most BULK_TIMEOUT_MS
+static bool waitForBulk(int sockfd)
+{
+  struct pollfd pfd = {sockfd, POLLIN, 0};
+  int rc;
+  while ((rc = ::poll(&pfd, 1, BULK_TIMEOUT_MS)) == -1 && errno == EINTR);
+  return rc > 0;
+}
+
+// Read the raw data following the msg being handled, first from what the
+// event loop has buffered, then from the socket. Called by the handler of
+// the msg, which may only read what is buffered, or by the thread it held
+// the peer for. A peer that stalls for BULK_TIMEOUT_MS, or ends, is
+// dropped and -1 returned.
+ssize_t Epoll::recvBulk(const LnetEntity *remote, void *buf, size_t len) const
+{
+  std::shared_ptr<InBuf_t> in = this->getInBuf(remote);
+  if (!in) return -1;
+  len = std::min(len, in->bulkLeft);
+  size_t done = std::min(len, in->end - in->start);
+  memcpy(buf, in->buf + in->start, done);
+  in->start += done;
+  in->bulkLeft -= done;
+
+  int sockfd = remote->sock->sockfd();
+  while (done < len) {
+    ssize_t rc = ::recv(sockfd, (char*)buf + done, len - done, MSG_DONTWAIT);
+    if (rc > 0) {
+      done += rc;
+      in->bulkLeft -= rc;
+    } else if (rc == 0) {
+      breakOff(remote, "ended early");
+      return -1;
+    } else if (errno == EINTR) {
+      continue;
+    } else if (errno != EAGAIN && errno != EWOULDBLOCK) {
+      breakOff(remote, "cannot be read");
+      return -1;
+    } else if (!waitForBulk(sockfd)) {
+      breakOff(remote, "stalled");
+      return -1;
+    }
+  }
+  return done;
+}
+
+// Like recvBulk(), but move the raw data into the pipe p, which the kernel
+// fills from the socket without a copy to user space; only what the event
+// loop has buffered is copied in. Returns once the pipe has some data and
+// either is full or the socket has no more for now, so that the caller can
+// drain the pipe; p->len is grown by the bytes moved.
+ssize_t Epoll::spliceBulk(const LnetEntity *remote, PipeChunk_t *p, size_t len) const
+{
+  std::shared_ptr<InBuf_t> in = this->getInBuf(remote);
+  if (!in) return -1;
+  len = std::min(len, in->bulkLeft);
+  size_t done = 0;
+  while (done < len && in->start < in->end) {
+    ssize_t rc = ::write(p->wfd, in->buf + in->start,
+                         std::min(len - done, in->end - in->start));
+    if (rc > 0) {
+      done += rc;
+      p->len += rc;
+      in->start += rc;
+      in->bulkLeft -= rc;
+    } else if (rc < 0 && errno == EINTR) {
+      continue;
+    } else if (rc < 0 && errno == EAGAIN && p->len > 0) {
+      return done; // The pipe is full
+    } else {
+      return -1;
+    }
+  }
+
+  int sockfd = remote->sock->sockfd();
+  while (done < len) {
+    ssize_t rc = splice(sockfd, NULL, p->wfd, NULL, len - done,
+                        SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    if (rc > 0) {
+      done += rc;
+      p->len += rc;
+      in->bulkLeft -= rc;
+    } else if (rc == 0) {
+      breakOff(remote, "ended early");
+      return -1;
+    } else if (errno == EINTR) {
+      continue;
+    } else if (errno != EAGAIN) {
+      breakOff(remote, "cannot be read");
+      return -1;
+    } else if (p->len > 0) {
+      break; // Either the pipe is full or the socket has no more for now
+    } else if (!waitForBulk(sockfd)) {
+      breakOff(remote, "stalled");
+      return -1;
+    }
+  }
+  return done;
 }
 
 LnetServer::LnetServer(int port)
@@ -60,37 +528,77 @@ LnetServer::LnetServer(int port)
 
 LnetServer::~LnetServer()
 {
+  this->stopEventLoop();
   this->_sock->close();
   delete this->_sock;
 }
 
+// Run the first shard, which also accepts the new peers, on this thread
+// and each other shard on a thread of its own
 void LnetServer::eventLoop()
 {
   struct epoll_event ev;
 
   ev.events = EPOLLIN;
   ev.data.ptr = this->_sock;
-  assert(epoll_ctl(this->_epollFd, EPOLL_CTL_ADD, this->_sock->sockfd(), &ev) != -1);
+  assert(epoll_ctl(this->_shards[0]->epollFd, EPOLL_CTL_ADD, this->_sock->sockfd(), &ev) != -1);
+  for (size_t i = 1; i < this->_shards.size(); i++) {
+    Shard_t *s = this->_shards[i];
+    this->_shardThreads.push_back(std::thread([=] { this->runShard(s); }));
+  }
+  this->runShard(this->_shards[0]);
+}
+
+// Make every shard return, and wait for the threads of all but the first,
+// which returns from eventLoop() on its own thread. The shards stay stopped.
+void LnetServer::stopEventLoop()
+{
+  uint64_t one = 1;
+  for (auto s : this->_shards) {
+    if (::write(s->stopFd, &one, sizeof(one)) != sizeof(one)) {
+      std::cerr << "Cannot stop event loop: " << strerror(errno) << std::endl;
+    }
+  }
+  for (auto &t : this->_shardThreads) {
+    if (t.joinable()) {
+      t.join();
+    }
+  }
+  this->_shardThreads.clear();
+}
+
+void LnetServer::runShard(Shard_t *shard)
+{
+  shard->loopThread = std::this_thread::get_id();
   while (true) {
-    int nfds = epoll_wait(this->_epollFd, this->_events, MAX_EVENTS, -1);
+    int nfds = epoll_wait(shard->epollFd, shard->events, MAX_EVENTS, -1);
     if (nfds == -1 && errno == EINTR) {
       continue;
     }
     for (int n = 0; n < nfds; ++n) {
-      void *ptr = this->_events[n].data.ptr;
-      if ((this->_events[n].events & EPOLLHUP) ||
-#ifdef EPOLLRDHUP
-          (this->_events[n].events & EPOLLRDHUP) ||
-#endif // ifdef EPOLLRDHUP
-          (this->_events[n].events & EPOLLERR)) {
-        assert(ptr != this->_sock);
+      void *ptr = shard->events[n].data.ptr;
+      uint32_t events = shard->events[n].events;
+      if (ptr == (void *)shard) {
+        return;
+      }
+      if (ptr == (void *)this->_sock) {
+        this->onConnect();
+        continue;
+      }
+      if (ptr == (void *)&shard->wakeFd) {
+        this->onResumed(shard);
+        continue;
+      }
+      // Read what the peer sent before its hangup; reading up to the end
+      // of the stream detects the hangup itself
+      if (events & EPOLLIN) {
+        if (!this->onReadable((LnetEntity*)ptr)) continue;
+      } else if (events & (EPOLLHUP | EPOLLERR)) {
         this->onDisconnect((LnetEntity*)ptr);
-      } else if (this->_events[n].events & EPOLLIN) {
-        if (ptr == (void *)this->_sock) {
-          this->onConnect();
-        } else {
-          this->onClientRequest((LnetEntity*)ptr);
-        }
+        continue;
+      }
+      if (events & EPOLLOUT) {
+        this->onWritable((LnetEntity*)ptr);
       }
     }
   }
@@ -0,0 +1,407 @@
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <poll.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <sys/wait.h>
+#include <syscall.h>
+#include <unistd.h>
+
+#include "io_cgroup.h"
+
+using namespace std;
+
+enum IoOp_t {
+  IoRead,
+  IoWrite,
+  IoExit
+};
+
+struct IoCmd_t
+{
+  IoOp_t op;
+  int fd;
+  size_t size;
+  off_t offset;
+};
+
+struct IoRes_t
+{
+  ssize_t ret;
+  int err;
+};
+
+static bool writeFile(const string &path, const string &value)
+{
+  ofstream f(path, ofstream::out);
+  if (!f.is_open()) return false;
+  f << value;
+  f.close();
+  return !f.fail();
+}
+
+// The helper is a copy of one thread of a multithreaded process, so it
+// only makes system calls
+static void helperLoop(int fd, char *arena)
+{
+  IoCmd_t c;
+  while (::read(fd, &c, sizeof(c)) == sizeof(c) && c.op != IoExit) {
+    IoRes_t r;
+    if (c.op == IoWrite) {
+      r.ret = ::pwrite(c.fd, arena, c.size, c.offset);
+    } else {
+      r.ret = ::pread(c.fd, arena, c.size, c.offset);
+    }
+    r.err = r.ret < 0 ? errno : 0;
+    if (::write(fd, &r, sizeof(r)) != sizeof(r)) break;
+  }
+  _exit(0);
+}
+
+// A pidfd turns readable when the process exits
+static int openPidFd(pid_t pid)
+{
+#ifdef SYS_pidfd_open
+  return syscall(SYS_pidfd_open, pid, 0);
+#else
+  return -1;
+#endif
+}
+
+// Kill and reap a helper that failed a job
+static void killHelper(IoHelper_t *h)
+{
+  if (h->pid > 0) {
+    kill(h->pid, SIGKILL);
+    waitpid(h->pid, NULL, 0);
+    h->pid = -1;
+  }
+  h->dead = true;
+}
+
+// Wait for the result of a job. Returns false if the helper exited first:
+// the OST holds the helper's end of the socket through the shared file
+// table, so its exit never shows as an EOF.
+static bool waitForHelper(IoHelper_t *h)
+{
+  struct pollfd pfd[2] = {{h->fd, POLLIN, 0}, {h->pidFd, POLLIN, 0}};
+  while (true) {
+    int n = ::poll(pfd, h->pidFd >= 0 ? 2 : 1, h->pidFd >= 0 ? -1 : HELPER_CHECK_MS);
+    if (n < 0 && errno != EINTR) return false;
+    if (pfd[0].revents & POLLIN) return true;
+    if (pfd[0].revents || pfd[1].revents) return false;
+    if (h->pidFd < 0 && waitpid(h->pid, NULL, WNOHANG) == h->pid) {
+      h->pid = -1;
+      return false;
+    }
+  }
+}
+
+IoCgroups::IoCgroups()
+  : _lock(new std::mutex())
+{
+}
+
+IoCgroups::~IoCgroups()
+{
+  std::map<int, std::shared_ptr<IoHelper_t>> helpers;
+  helpers.swap(this->_helpers);
+  helpers.clear(); // Stops the helpers and removes their groups
+  if (!this->_root.empty()) rmdir(this->_root.c_str());
+  delete this->_lock;
+}
+
+// Find the cgroup v2 hierarchy and make the parent of the app groups, with
+// the io controller on. Returns false if there is no io controller.
+bool IoCgroups::init(int ostId)
+{
+  string mnt;
+  string dev, dir, type, rest;
+  ifstream mounts("/proc/self/mounts");
+  while (mounts >> dev >> dir >> type && getline(mounts, rest)) {
+    if (type == "cgroup2") {
+      mnt = dir;
+      break;
+    }
+  }
+  if (mnt.empty()) {
+    cerr << "[Datanet] No cgroup v2 hierarchy" << endl;
+    return false;
+  }
+  bool io = false;
+  string c;
+  ifstream controllers(mnt + "/cgroup.controllers");
+  while (controllers >> c) {
+    io |= c == "io";
+  }
+  if (!io || !writeFile(mnt + "/cgroup.subtree_control", "+io")) {
+    cerr << "[Datanet] No io controller in " << mnt << endl;
+    return false;
+  }
+  string root = mnt + "/gift-ost-" + to_string(ostId);
+  if (mkdir(root.c_str(), 0755) < 0 && errno != EEXIST) {
+    perror("mkdir");
+    return false;
+  }
+  if (!writeFile(root + "/cgroup.subtree_control", "+io")) {
+    cerr << "[Datanet] Could not enable io in " << root << endl;
+    rmdir(root.c_str());
+    return false;
+  }
+  this->_root = root;
+  return true;
+}
+
+string IoCgroups::appGroup(int id) const
+{
+  return this->_root + "/app-" + to_string(id);
+}
+
+// Take the disk of an opened file, so that the limits also apply to it
+void IoCgroups::addDevice(int fd)
+{
+  struct stat st;
+  if (fstat(fd, &st) < 0) return;
+  string dev = to_string(major(st.st_dev)) + ":" + to_string(minor(st.st_dev));
+  {
+    std::lock_guard<std::mutex> lk(*this->_lock);
+    if (!this->_seen.insert(st.st_dev).second) return;
+  }
+  // io.max takes whole disks; a partition finds its disk in the parent dir
+  string sys = "/sys/dev/block/" + dev;
+  if (access((sys + "/partition").c_str(), F_OK) == 0) {
+    ifstream disk(sys + "/../dev");
+    disk >> dev;
+  } else if (access(sys.c_str(), F_OK) < 0) {
+    cerr << "[Datanet] " << dev << " is not a block device" << endl;
+    return;
+  }
+
+  std::lock_guard<std::mutex> lk(*this->_lock);
+  if (!this->_devices.insert(dev).second) return;
+  cerr << "[Datanet] Throttling disk " << dev << endl;
+  for (auto l : this->_limits) {
+    this->writeLimit(l.first, dev, l.second);
+  }
+}
+
+// Write io.max of an app for a disk, unless it already holds the limit.
+// Called with _lock held.
+void IoCgroups::writeLimit(int id, const string &dev, size_t bps)
+{
+  string limit = bps ? to_string(bps) : "max";
+  string line = dev + " rbps=" + limit + " wbps=" + limit;
+  string &written = this->_written[make_pair(id, dev)];
+  if (written == line) return;
+  if (!writeFile(this->appGroup(id) + "/io.max", line)) {
+    cerr << "[Datanet] Could not set io.max of App-" << id << " to " << line << endl;
+    return;
+  }
+  written = line;
+}
+
+// Limit the reads and writes of an app to bps bytes/s, or lift the limit
+// if bps is 0. The group and the helper of the app are made the first
+// time. Returns false if the app has no group.
+bool IoCgroups::setLimit(int id, size_t bps)
+{
+  std::lock_guard<std::mutex> lk(*this->_lock);
+  if (!this->_helpers.count(id)) {
+    string group = this->appGroup(id);
+    if (mkdir(group.c_str(), 0755) < 0 && errno != EEXIST) {
+      perror("mkdir");
+      return false;
+    }
+    std::shared_ptr<IoHelper_t> h = this->startHelper(id);
+    if (!h) {
+      rmdir(group.c_str());
+      return false;
+    }
+    this->_helpers[id] = h;
+  }
+  this->_limits[id] = bps;
+  for (auto dev : this->_devices) {
+    this->writeLimit(id, dev, bps);
+  }
+  return true;
+}
+
+// Called with _lock held
+std::shared_ptr<IoHelper_t> IoCgroups::startHelper(int id)
+{
+  int fds[2];
+  if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, fds) < 0) {
+    perror("socketpair");
+    return NULL;
+  }
+  void *arena = mmap(NULL, IO_ARENA_SIZE, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (arena == MAP_FAILED) {
+    perror("mmap");
+    ::close(fds[0]);
+    ::close(fds[1]);
+    return NULL;
+  }
+  // Like fork, but the helper keeps sharing the file table with the OST,
+  // so that it sees the files opened later
+  pid_t pid = syscall(SYS_clone, CLONE_FILES | SIGCHLD, 0, NULL, NULL, 0);
+  if (pid == 0) {
+    helperLoop(fds[1], (char*)arena);
+  }
+  IoHelper_t *h = new IoHelper_t();
+  h->pid = pid;
+  h->pidFd = pid > 0 ? openPidFd(pid) : -1;
+  h->fd = fds[0];
+  h->helperFd = fds[1];
+  h->arena = (char*)arena;
+  h->lock = new std::mutex();
+  h->dead = false;
+  if (pid < 0) {
+    perror("clone");
+  } else if (!writeFile(this->appGroup(id) + "/cgroup.procs", to_string(pid))) {
+    cerr << "[Datanet] Could not move the helper of App-" << id << " to its group" << endl;
+  } else {
+    return std::shared_ptr<IoHelper_t>(h, [=](IoHelper_t *h) { this->retireHelper(id, h); });
+  }
+  this->stopHelper(h);
+  return NULL;
+}
+
+void IoCgroups::stopHelper(IoHelper_t *h)
+{
+  if (h->pid > 0) {
+    IoCmd_t c = {IoExit, -1, 0, 0};
+    if (::write(h->fd, &c, sizeof(c)) != sizeof(c)) {
+      kill(h->pid, SIGKILL);
+    }
+    waitpid(h->pid, NULL, 0);
+  }
+  if (h->pidFd >= 0) ::close(h->pidFd);
+  ::close(h->fd);
+  ::close(h->helperFd);
+  munmap(h->arena, IO_ARENA_SIZE);
+  delete h->lock;
+  delete h;
+}
+
+// Stop a helper no job holds any more, and remove the group of its app
+// unless the app has a helper again. Called without _lock held.
+void IoCgroups::retireHelper(int id, IoHelper_t *h)
+{
+  this->stopHelper(h);
+  std::lock_guard<std::mutex> lk(*this->_lock);
+  if (!this->_helpers.count(id) && rmdir(this->appGroup(id).c_str()) < 0) {
+    perror("rmdir");
+  }
+}
+
+// Replace the helper of an app that died, unless another job did already.
+// The jobs still holding the old one fail, and the last one stops it; the
+// caller holds it too, so that it is not stopped under _lock.
+void IoCgroups::restartHelper(int id, const std::shared_ptr<IoHelper_t> &old)
+{
+  std::lock_guard<std::mutex> lk(*this->_lock);
+  auto h = this->_helpers.find(id);
+  if (h == std::end(this->_helpers) || h->second != old) return;
+  std::shared_ptr<IoHelper_t> helper = this->startHelper(id);
+  if (!helper) {
+    cerr << "[Datanet] Could not restart the helper of App-" << id << endl;
+    this->_helpers.erase(h);
+    return;
+  }
+  h->second = helper;
+}
+
+// Drop the helper and the group of an app. A job still running on the
+// helper keeps both until it is done.
+void IoCgroups::removeGroup(int id)
+{
+  std::shared_ptr<IoHelper_t> helper;
+  std::lock_guard<std::mutex> lk(*this->_lock);
+  auto h = this->_helpers.find(id);
+  if (h == std::end(this->_helpers)) return;
+  helper = h->second; // Let go of after _lock
+  this->_helpers.erase(h);
+  this->_limits.erase(id);
+  for (auto dev : this->_devices) {
+    this->_written.erase(make_pair(id, dev));
+  }
+}
+
+bool IoCgroups::hasGroup(int id) const
+{
+  std::lock_guard<std::mutex> lk(*this->_lock);
+  return this->_helpers.count(id) > 0;
+}
+
+// Have the helper of the app do the I/O, through the arena. Returns false
+// if the app has no helper; otherwise *ret is the result of the I/O. A
+// helper that dies fails the job with EIO and is restarted.
+bool IoCgroups::doIo(int id, int op, int fd, char *buf, size_t size, off_t offset,
+                     ssize_t *ret)
+{
+  std::shared_ptr<IoHelper_t> helper;
+  {
+    std::lock_guard<std::mutex> lk(*this->_lock);
+    auto h = this->_helpers.find(id);
+    if (h == std::end(this->_helpers)) return false;
+    helper = h->second;
+  }
+  // A job of the app may run long while its I/O is throttled
+  std::unique_lock<std::mutex> jobLk(*helper->lock);
+
+  size_t done = 0;
+  int err = helper->dead ? EIO : 0;
+  while (!helper->dead && done < size) {
+    size_t n = min(size - done, IO_ARENA_SIZE);
+    if (op == IoWrite) {
+      memcpy(helper->arena, buf + done, n);
+    }
+    IoCmd_t c = {(IoOp_t)op, fd, n, (off_t)(offset + done)};
+    IoRes_t r;
+    if (::write(helper->fd, &c, sizeof(c)) != sizeof(c) || !waitForHelper(helper.get()) ||
+        ::read(helper->fd, &r, sizeof(r)) != sizeof(r)) {
+      cerr << "[Datanet] The helper of App-" << id << " is gone" << endl;
+      killHelper(helper.get());
+      r.ret = -1;
+      r.err = EIO;
+    }
+    if (r.ret < 0) {
+      err = r.err;
+      break;
+    }
+    if (op == IoRead) {
+      memcpy(buf + done, helper->arena, r.ret);
+    }
+    done += r.ret;
+    if ((size_t)r.ret < n) break; // End of file
+  }
+  bool dead = helper->dead;
+  jobLk.unlock();
+  if (dead) {
+    this->restartHelper(id, helper);
+  }
+  if (done == 0 && err) {
+    errno = err;
+    *ret = -1;
+    return true;
+  }
+  *ret = done;
+  return true;
+}
+
+bool IoCgroups::pread(int id, int fd, void *buf, size_t size, off_t offset, ssize_t *ret)
+{
+  return this->doIo(id, IoRead, fd, (char*)buf, size, offset, ret);
+}
+
+bool IoCgroups::pwrite(int id, int fd, const void *buf, size_t size, off_t offset,
+                       ssize_t *ret)
+{
+  return this->doIo(id, IoWrite, fd, (char*)buf, size, offset, ret);
+}
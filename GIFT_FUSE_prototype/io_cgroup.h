@@ -0,0 +1,66 @@
+#ifndef _IO_CGROUP_H_
+#define _IO_CGROUP_H_
+
+#include <sys/types.h>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <mutex>
+
+const size_t IO_ARENA_SIZE = 4 * 1024 * 1024;
+const int HELPER_CHECK_MS = 1000; // how often a job checks on its helper without a pidfd
+
+// A process in the group of an app that does the app's reads and writes.
+// It shares the file table of the OST and takes the data through an arena
+// shared with the OST.
+struct IoHelper_t
+{
+  pid_t pid;        // -1 once reaped
+  int pidFd;        // readable once the helper exits; -1 if there is none
+  int fd;           // jobs to the helper and their results
+  int helperFd;     // the helper's end
+  char *arena;      // IO_ARENA_SIZE bytes
+  std::mutex *lock; // one job at a time
+  bool dead;        // failed a job; replaced by restartHelper()
+};
+
+// The jobs running on a helper share it with the app's entry in
+// IoCgroups, so that a helper replaced or removed meanwhile is stopped by
+// whichever lets go of it last.
+
+// One cgroup v2 group per app, throttled through io.max on the disks of
+// the files opened here. The io controller accounts I/O to processes, not
+// to threads, so the I/O of an app is done by a helper in its group.
+class IoCgroups
+{
+  private:
+    std::string _root; // parent of the app groups
+    std::set<dev_t> _seen; // devices of the files opened so far
+    std::set<std::string> _devices; // "major:minor" of the disks
+    std::map<int, std::shared_ptr<IoHelper_t>> _helpers; // app id -> helper
+    std::map<int, size_t> _limits; // app id -> bytes/s, 0 for none
+    std::map<std::pair<int, std::string>, std::string> _written; // <app id, disk> -> io.max line
+    std::mutex *_lock; // guards the above
+
+    std::string appGroup(int ) const;
+    void writeLimit(int , const std::string &, size_t );
+    std::shared_ptr<IoHelper_t> startHelper(int );
+    void stopHelper(IoHelper_t *);
+    void retireHelper(int , IoHelper_t *);
+    void restartHelper(int , const std::shared_ptr<IoHelper_t> &);
+    bool doIo(int , int , int , char *, size_t , off_t , ssize_t *);
+
+  public:
+    IoCgroups();
+    ~IoCgroups();
+    bool init(int );
+    void addDevice(int );
+    bool setLimit(int , size_t );
+    void removeGroup(int );
+    bool hasGroup(int ) const;
+    bool pread(int , int , void *, size_t , off_t , ssize_t *);
+    bool pwrite(int , int , const void *, size_t , off_t , ssize_t *);
+};
+
+#endif // ifndef _IO_CGROUP_H_
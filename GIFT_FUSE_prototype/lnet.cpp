@@ -2,10 +2,16 @@
 #include <cassert>
 #include <cstdlib>
 #include <cstring>
+#include <fcntl.h>
 #include <iostream>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <vector>
 
 #include "lnet.h"
 
+const size_t FILE_CHUNK = 1024 * 1024;
+
 std::ostream& operator<<(std::ostream &os, const FsRequestType &t)
 {
   switch (t) {
@@ -58,6 +64,13 @@ std::ostream& operator<<(std::ostream &os, const MsgType &t)
     case FsRequest:  os << "FsRequest"; break;
     case FsResponse: os << "FsResponse"; break;
     case Data:       os << "Data"; break;
+    case OstChange:  os << "OstChange"; break;
+    case AllocsResync: os << "AllocsResync"; break;
+    case AddAgg:     os << "AddAgg"; break;
+    case AggOsts:    os << "AggOsts"; break;
+    case AggTimer:   os << "AggTimer"; break;
+    case AggTimerResp: os << "AggTimerResp"; break;
+    case AggAllocs:  os << "AggAllocs"; break;
     default:         os << "Ununknown"; break;
   }
   return os;
@@ -70,6 +83,7 @@ std::ostream& operator<<(std::ostream &os, const LEntityType &t)
     case Osc:     os << "OSC"; break;
     case Ost:     os << "OST"; break;
     case Mds:     os << "MDS"; break;
+    case Agg:     os << "AGG"; break;
     default:      os << "Unknown"; break;
   }
   return os;
@@ -81,10 +95,132 @@ std::ostream& operator<<(std::ostream &os, const ActiveRequest &r)
   return os;
 }
 
+LnetBufPool::LnetBufPool()
+  : _lock(new std::mutex())
+{
+}
+
+LnetBufPool::~LnetBufPool()
+{
+  for (int c = 0; c < NUM_CLASSES; c++) {
+    for (auto buf : this->_free[c]) {
+      free(buf);
+    }
+  }
+  delete this->_lock;
+}
+
+LnetBufPool *LnetBufPool::instance()
+{
+  static LnetBufPool pool;
+  return &pool;
+}
+
+// Each buffer starts with the index of its class, -1 if it has none; the
+// caller gets the memory past it
+static const size_t BUF_PREFIX = alignof(max_align_t);
+
+void *LnetBufPool::alloc(size_t size)
+{
+  int c = 0;
+  size_t classSize = MIN_CLASS;
+  while (c < NUM_CLASSES && classSize < size) {
+    c++;
+    classSize *= 4;
+  }
+  void *buf = NULL;
+  if (c == NUM_CLASSES) {
+    c = -1;
+    buf = malloc(BUF_PREFIX + size);
+  } else {
+    std::lock_guard<std::mutex> lk(*this->_lock);
+    if (!this->_free[c].empty()) {
+      buf = this->_free[c].back();
+      this->_free[c].pop_back();
+    }
+  }
+  if (!buf) {
+    buf = malloc(BUF_PREFIX + classSize);
+  }
+  *(int*)buf = c;
+  return (char*)buf + BUF_PREFIX;
+}
+
+void LnetBufPool::release(void *ptr)
+{
+  if (!ptr) return;
+  void *buf = (char*)ptr - BUF_PREFIX;
+  int c = *(int*)buf;
+  if (c >= 0) {
+    std::lock_guard<std::mutex> lk(*this->_lock);
+    if (this->_free[c].size() < MAX_FREE_PER_CLASS) {
+      this->_free[c].push_back(buf);
+      return;
+    }
+  }
+  free(buf);
+}
+
+LnetPipePool::LnetPipePool()
+  : _lock(new std::mutex())
+{
+}
+
+LnetPipePool::~LnetPipePool()
+{
+  for (auto p : this->_free) {
+    ::close(p.rfd);
+    ::close(p.wfd);
+  }
+  delete this->_lock;
+}
+
+LnetPipePool *LnetPipePool::instance()
+{
+  static LnetPipePool pool;
+  return &pool;
+}
+
+// A new pipe is grown to PIPE_SIZE if the system allows it; callers cope
+// with pipes that fill up early
+bool LnetPipePool::alloc(PipeChunk_t *p)
+{
+  {
+    std::lock_guard<std::mutex> lk(*this->_lock);
+    if (!this->_free.empty()) {
+      *p = this->_free.back();
+      this->_free.pop_back();
+      return true;
+    }
+  }
+  int fds[2];
+  if (::pipe2(fds, O_CLOEXEC | O_NONBLOCK) < 0) {
+    perror("pipe2");
+    return false;
+  }
+  ::fcntl(fds[1], F_SETPIPE_SZ, PIPE_SIZE);
+  *p = {fds[0], fds[1], 0};
+  return true;
+}
+
+void LnetPipePool::release(PipeChunk_t p)
+{
+  if (p.len == 0) {
+    std::lock_guard<std::mutex> lk(*this->_lock);
+    if (this->_free.size() < MAX_FREE) {
+      this->_free.push_back(p);
+      return;
+    }
+  }
+  ::close(p.rfd);
+  ::close(p.wfd);
+}
+
 LnetMsg::LnetMsg()
 {
   this->t = Unknown;
-  this->src = NULL;
+  this->reqId = 0;
+  this->bulkLen = 0;
   this->extraData = false;
   this->len = 0;
   this->data = NULL;
@@ -103,7 +239,7 @@ LnetMsg::LnetMsg(MsgType t, size_t size)
 {
   this->extraData = true;
   this->len = size;
-  this->data = malloc(size);
+  this->allocData();
 }
 
 LnetMsg::LnetMsg(MsgType t, FsRequestType f, size_t size)
@@ -114,41 +250,434 @@ LnetMsg::LnetMsg(MsgType t, FsRequestType f, size_t size)
 
 LnetMsg::~LnetMsg()
 {
-  if (extraData && data) {
-    free(data);
+  this->freeData();
+}
+
+// Get room for len bytes of payload, in the msg itself if they fit
+void LnetMsg::allocData()
+{
+  this->data = this->len <= LNET_INLINE_SIZE ? this->_inline
+                                             : LnetBufPool::instance()->alloc(this->len);
+}
+
+void LnetMsg::freeData()
+{
+  if (this->extraData && this->data && this->data != this->_inline) {
+    LnetBufPool::instance()->release(this->data);
   }
 }
 
 void LnetMsg::clear()
 {
   this->t = Unknown;
-  this->src = NULL;
+  this->reqId = 0;
+  this->bulkLen = 0;
   this->extraData = false;
   this->len = 0;
   this->data = NULL;
 }
 
+// Shallow copy: a pooled payload is shared with msg, so the copy must be
+// clear()ed before it goes. The payload the msg held is released first.
 void LnetMsg::copy(const LnetMsg *msg)
 {
+  if (msg == this) return;
+  this->freeData();
   this->off = msg->off;
   this->t = msg->t;
   this->f = msg->f;
   this->extraData = msg->extraData;
-  this->src = msg->src;
+  this->reqId = msg->reqId;
+  this->bulkLen = msg->bulkLen;
   this->_i = msg->_i;
   this->len = msg->len;
   this->data = msg->data;
+  // An inline payload goes with the msg; a pooled one is shared
+  if (msg->data == msg->_inline) {
+    memcpy(this->_inline, msg->_inline, this->len);
+    this->data = this->_inline;
+  }
 }
 
 void LnetMsg::deepcopy(const LnetMsg *msg)
 {
   this->copy(msg);
-  if (this->extraData) {
-    this->data = malloc(this->len);
+  if (this->extraData && this->data != this->_inline) {
+    this->allocData();
     memcpy(this->data, msg->data, this->len);
   }
 }
 
+void LnetMsg::toHdr(LnetHdr_t *hdr) const
+{
+  bool payload = this->extraData && this->len > 0 && this->data;
+  hdr->version = LNET_VERSION;
+  hdr->t = this->t;
+  hdr->f = this->f;
+  hdr->flags = this->extraData ? LNET_EXTRA_DATA : 0;
+  hdr->appId = this->_i.id;
+  hdr->reqId = this->reqId;
+  hdr->len = payload ? this->len : 0;
+  hdr->bulkLen = 0;
+}
+
+// Returns false if the header is of another protocol version
+bool LnetMsg::fromHdr(const LnetHdr_t *hdr)
+{
+  if (hdr->version != LNET_VERSION) return false;
+  this->t = (MsgType)hdr->t;
+  this->f = (FsRequestType)hdr->f;
+  this->extraData = hdr->flags & LNET_EXTRA_DATA;
+  this->_i = {0};
+  this->_i.id = hdr->appId;
+  this->reqId = hdr->reqId;
+  this->bulkLen = hdr->bulkLen;
+  this->len = hdr->len;
+  this->data = NULL;
+  this->off = 0;
+  return true;
+}
+
+ssize_t writeMsg(LSocket *sock, const LnetMsg *msg, const void *bulk, size_t bulkLen)
+{
+  LnetHdr_t hdr;
+  msg->toHdr(&hdr);
+  hdr.bulkLen = bulk ? bulkLen : 0;
+  struct iovec iov[3];
+  int iovcnt = 0;
+  iov[iovcnt++] = {&hdr, sizeof(hdr)};
+  if (hdr.len > 0) {
+    iov[iovcnt++] = {msg->data, hdr.len};
+  }
+  if (hdr.bulkLen > 0) {
+    iov[iovcnt++] = {const_cast<void*>(bulk), hdr.bulkLen};
+  }
+  return sock->writevAll(iov, iovcnt);
+}
+
+// Like writeMsg() with len bytes of raw data from the file fd at offset,
+// sent by the kernel from the page cache. If the file cannot be sent that
+// way, it goes through a buffer. The header announces len bytes, so if the
+// file got shorter meanwhile or cannot be read, the peer cannot be told:
+// the socket is shut down and -1 returned.
+ssize_t writeMsgFile(LSocket *sock, const LnetMsg *msg, int fd, off_t offset, size_t len)
+{
+  LnetHdr_t hdr;
+  msg->toHdr(&hdr);
+  hdr.bulkLen = len;
+  struct iovec iov[2];
+  int iovcnt = 0;
+  iov[iovcnt++] = {&hdr, sizeof(hdr)};
+  if (hdr.len > 0) {
+    iov[iovcnt++] = {msg->data, hdr.len};
+  }
+  ssize_t head = sizeof(hdr) + hdr.len;
+  ssize_t rc = sock->writevAll(iov, iovcnt, len > 0 ? MSG_MORE : 0);
+  if (rc < head || len == 0) return rc;
+
+  ssize_t sent = sock->sendfileAll(fd, offset, len);
+  if (sent < 0 && (errno == EINVAL || errno == ENOSYS)) {
+    sent = 0;
+  }
+  std::vector<char> buf;
+  while (sent >= 0 && (size_t)sent < len) {
+    buf.resize(std::min(len - sent, FILE_CHUNK));
+    ssize_t n = ::pread(fd, buf.data(), buf.size(), offset + sent);
+    if (n == 0) {
+      errno = EIO; // Got shorter
+    }
+    if (n <= 0 || sock->writeAll(buf.data(), n) < n) break;
+    sent += n;
+  }
+  if (sent < 0 || (size_t)sent < len) {
+    int err = errno;
+    ::shutdown(sock->sockfd(), SHUT_RDWR);
+    errno = err;
+    return -1;
+  }
+  return head + sent;
+}
+
+ssize_t readHdr(LSocket *sock, LnetMsg *msg)
+{
+  LnetHdr_t hdr;
+  ssize_t totalData = sock->readAll(&hdr, sizeof(hdr));
+  if (totalData < (ssize_t)sizeof(hdr)) return totalData;
+  if (!msg->fromHdr(&hdr)) {
+    // The rest of the stream cannot be framed
+    std::cerr << "Msg of protocol version " << (int)hdr.version
+              << " received, expected " << (int)LNET_VERSION << std::endl;
+    return -1;
+  }
+  if (hdr.len > MAX_MSG_LEN) {
+    std::cerr << "Msg of " << hdr.len << " bytes received" << std::endl;
+    return -1;
+  }
+  return totalData;
+}
+
+// Raw data beyond bulkCap is read and dropped, to keep the stream framed
+ssize_t readBody(LSocket *sock, LnetMsg *msg, void *bulk, size_t bulkCap)
+{
+  struct iovec iov[2];
+  int iovcnt = 0;
+  if (msg->extraData && msg->len > 0) {
+    msg->allocData();
+    iov[iovcnt++] = {msg->data, msg->len};
+  }
+  size_t bulkLen = bulk ? std::min(msg->bulkLen, bulkCap) : 0;
+  if (bulkLen > 0) {
+    iov[iovcnt++] = {bulk, bulkLen};
+  }
+  ssize_t totalData = iovcnt > 0 ? sock->readvAll(iov, iovcnt) : 0;
+  if (totalData < 0) return totalData;
+  if (bulk) {
+    char discard[4096];
+    for (size_t left = msg->bulkLen - bulkLen; left > 0; ) {
+      ssize_t rc = sock->readAll(discard, std::min(left, sizeof(discard)));
+      if (rc <= 0) return -1;
+      left -= rc;
+    }
+  }
+  return totalData;
+}
+
+ssize_t readMsg(LSocket *sock, LnetMsg *msg)
+{
+  ssize_t totalData = readHdr(sock, msg);
+  if (totalData < (ssize_t)sizeof(LnetHdr_t)) return totalData;
+  ssize_t body = readBody(sock, msg);
+  return body < 0 ? body : totalData + body;
+}
+
+LnetMsg *newOstBatch(MsgType t, const std::vector<OstMsg_t> &msgs)
+{
+  size_t n = msgs.size();
+  size_t len = sizeof(n);
+  for (auto m : msgs) {
+    len += sizeof(m.first) + sizeof(m.second->len) + m.second->len;
+  }
+  LnetMsg *batch = new LnetMsg(t, len);
+  batch->pack(&n);
+  for (auto m : msgs) {
+    BufType buf = {m.second->len, m.second->data};
+    batch->pack(&m.first, &buf);
+  }
+  return batch;
+}
+
+void unpackOstBatch(const LnetMsg *batch, MsgType t, std::vector<OstMsg_t> &msgs)
+{
+  size_t n = 0;
+  size_t offset = 0;
+  batch->extractData(&n, offset);
+  for (size_t i = 0; i < n; i++) {
+    int id = -1;
+    size_t len = 0;
+    batch->unpack(offset, &id, &len);
+    if (offset + len > batch->len) break;
+    LnetMsg *msg = new LnetMsg(t, len);
+    memcpy(msg->data, (char*)batch->data + offset, len);
+    offset += len;
+    msgs.push_back(OstMsg_t(id, msg));
+  }
+}
+
+void TimerResp_t::unpack(const LnetMsg *msg)
+{
+  size_t count = 0;
+  size_t napps = 0;
+  size_t offset = 0;
+  msg->extractData(&this->seq, offset);
+  msg->extractData(&this->base, offset);
+  msg->extractData(&count, offset);
+  this->delta.clear();
+  for (size_t i = 0; i < count; i++) {
+    int id;
+    FsRequestType t;
+    int n;
+    msg->unpack(offset, &id, &t, &n);
+    this->delta.push_back(std::make_tuple(id, t, n));
+  }
+  msg->extractData(&napps, offset);
+  this->apps.assign(napps, AppInfo());
+  for (size_t i = 0; i < napps; i++) {
+    msg->extractData(&this->apps[i], offset);
+  }
+}
+
+// Build the TimerResp of epoch seq for the requests active now, based on
+// the set sent for epoch ack. Sets older than ack are never needed again.
+LnetMsg *ReqSetHistory::respond(size_t seq, size_t ack, const std::vector<ActiveRequest> &reqs)
+{
+  ReqCounts_t counts;
+  std::map<int, AppInfo> infos;
+  for (auto r : reqs) {
+    counts[ReqKey_t(r._info.id, r._t)]++;
+    infos[r._info.id] = r._info;
+  }
+
+  this->_sets.erase(this->_sets.begin(), this->_sets.lower_bound(ack));
+  auto sent = this->_sets.find(ack);
+  size_t base = sent == std::end(this->_sets) ? 0 : ack;
+  const ReqCounts_t empty;
+  const ReqCounts_t &old = base ? sent->second : empty;
+
+  std::vector<ReqDelta_t> delta;
+  for (auto c : counts) {
+    auto o = old.find(c.first);
+    int n = c.second - (o == std::end(old) ? 0 : o->second);
+    if (n != 0) {
+      delta.push_back(std::make_tuple(c.first.first, c.first.second, n));
+    }
+  }
+  for (auto o : old) {
+    if (!counts.count(o.first)) {
+      delta.push_back(std::make_tuple(o.first.first, o.first.second, -o.second));
+    }
+  }
+  std::vector<AppInfo> apps;
+  for (auto i : infos) {
+    auto o = old.lower_bound(ReqKey_t(i.first, (FsRequestType)0));
+    if (o == std::end(old) || o->first.first != i.first) {
+      apps.push_back(i.second);
+    }
+  }
+  std::cerr << "OST: Responding to MDS timer request with " << reqs.size()
+            << " pending reqs, " << delta.size() << " changes since epoch " << base << std::endl;
+
+  size_t count = delta.size();
+  size_t napps = apps.size();
+  LnetMsg *msg = new LnetMsg(TimerResp, sizeof(seq) + sizeof(base) + sizeof(count) +
+                                        count * (sizeof(int) + sizeof(FsRequestType) + sizeof(int)) +
+                                        sizeof(napps) + napps * sizeof(AppInfo));
+  msg->marshall(&seq, &base, &count);
+  for (auto d : delta) {
+    msg->marshall(&std::get<0>(d), &std::get<1>(d), &std::get<2>(d));
+  }
+  msg->marshall(&napps);
+  for (auto &i : apps) {
+    msg->marshall(&i);
+  }
+
+  this->_sets[seq] = std::move(counts);
+  if (this->_sets.size() > MAX_SETS) {
+    this->_sets.erase(this->_sets.begin());
+  }
+  return msg;
+}
+
+// Build an Allocs msg: the kind, the base and new versions of the table,
+// the (app, share) entries to set and the apps to remove
+static LnetMsg *newAllocsMsg(AllocsKind kind, size_t base, size_t version,
+                             const AppAllocs_t &set, const std::vector<int> &removed)
+{
+  size_t sz = set.size();
+  size_t rsz = removed.size();
+  LnetMsg *msg = new LnetMsg(Allocs, sizeof(kind) + sizeof(base) + sizeof(version) + sizeof(sz) +
+                                     (sizeof(int) + sizeof(double)) * sz + sizeof(rsz) + sizeof(int) * rsz);
+  msg->pack(&kind, &base, &version, &sz);
+  for (auto a : set) {
+    msg->pack(&std::get<0>(a), &std::get<1>(a));
+  }
+  msg->pack(&rsz);
+  for (auto &id : removed) {
+    msg->pack(&id);
+  }
+  return msg;
+}
+
+// Move the table to newRates. Returns the msg that takes the OST there:
+// the full table for a table never sent, else the entries that changed.
+// Returns NULL if nothing changed.
+LnetMsg *AllocTable_t::update(const std::map<int, double> &newRates)
+{
+  AllocsKind kind = this->version == 0 ? AllocsFull : AllocsDelta;
+  AppAllocs_t set;
+  std::vector<int> removed;
+  for (auto r : newRates) {
+    auto old = this->rates.find(r.first);
+    if (kind == AllocsFull || old == std::end(this->rates) || old->second != r.second) {
+      set.push_back(std::make_tuple(r.first, r.second));
+    }
+  }
+  for (auto r : this->rates) {
+    if (!newRates.count(r.first)) {
+      removed.push_back(r.first);
+    }
+  }
+  if (kind == AllocsDelta && set.empty() && removed.empty()) {
+    return NULL;
+  }
+
+  LnetMsg *msg = newAllocsMsg(kind, this->version, this->version + 1, set, removed);
+  this->version++;
+  this->rates = newRates;
+  return msg;
+}
+
+// The whole table at its current version, for an OST that missed one
+LnetMsg *AllocTable_t::resync() const
+{
+  AppAllocs_t set;
+  for (auto r : this->rates) {
+    set.push_back(std::make_tuple(r.first, r.second));
+  }
+  return newAllocsMsg(AllocsFull, 0, this->version, set, std::vector<int>());
+}
+
+// Apply an Allocs msg. The apps whose share is new or changed are added
+// to changed. Returns false, leaving the table as it is, if the msg is a
+// delta on a version other than the one held.
+bool AllocTable_t::apply(const LnetMsg *msg, std::map<int, double> *changed)
+{
+  AllocsKind kind;
+  size_t base = 0;
+  size_t newVersion = 0;
+  size_t count = 0;
+  size_t offset = 0;
+  msg->extractData(&kind, offset);
+  msg->extractData(&base, offset);
+  msg->extractData(&newVersion, offset);
+  if (kind == AllocsDelta && base != this->version) {
+    std::cerr << "Allocs v" << newVersion << " based on v" << base
+              << ", have v" << this->version << std::endl;
+    return false;
+  }
+
+  std::map<int, double> set;
+  msg->extractData(&count, offset);
+  for (size_t i = 0; i < count; i++) {
+    int id;
+    double r;
+    msg->extractData(&id, offset);
+    msg->extractData(&r, offset);
+    set[id] = r;
+  }
+  size_t removed = 0;
+  msg->extractData(&removed, offset);
+  for (size_t i = 0; i < removed; i++) {
+    int id;
+    msg->extractData(&id, offset);
+    this->rates.erase(id);
+  }
+  if (kind == AllocsFull) {
+    // Drop the apps that are not in the new table
+    for (auto r = this->rates.begin(); r != this->rates.end(); ) {
+      r = set.count(r->first) ? std::next(r) : this->rates.erase(r);
+    }
+  }
+
+  for (auto a : set) {
+    auto old = this->rates.find(a.first);
+    if (old != std::end(this->rates) && old->second == a.second) continue;
+    this->rates[a.first] = a.second;
+    (*changed)[a.first] = a.second;
+  }
+  this->version = newVersion;
+  return true;
+}
+
 std::ostream& operator<<(std::ostream &os, const LnetMsg &m)
 {
   if (m.t == FsRequest) {
@@ -183,25 +712,14 @@ bool LnetClient::connectToRemoteServer(const LSockAddr &addr, int port)
   return this->_sockToRemoteServer->connect(addr, port);
 }
 
-ssize_t LnetClient::sendMsgToRemote(const LnetMsg *msg) const
+ssize_t LnetClient::sendMsgToRemote(const LnetMsg *msg, const void *bulk, size_t bulkLen) const
 {
-  ssize_t totalData = 0;
-  totalData += this->_sockToRemoteServer->writeAll(msg, sizeof(*msg));
-  if (msg->extraData && msg->len > 0 && msg->data) {
-    totalData += this->_sockToRemoteServer->writeAll(msg->data, msg->len);
-  }
-  return totalData;
+  return writeMsg(this->_sockToRemoteServer, msg, bulk, bulkLen);
 }
 
 ssize_t LnetClient::recvMsgFromRemote(LnetMsg *msg)
 {
-  ssize_t totalData = 0;
-  totalData += this->_sockToRemoteServer->readAll(msg, sizeof(*msg));
-  if (msg->extraData && msg->len > 0) {
-    msg->data = malloc(msg->len);
-    totalData += this->_sockToRemoteServer->readAll(msg->data, msg->len);
-  }
-  return totalData;
+  return readMsg(this->_sockToRemoteServer, msg);
 }
 
 ssize_t LnetClient::sendRawDataToRemote(const void* buf, size_t len)
@@ -217,4 +735,137 @@ ssize_t LnetClient::recvRawDataFromRemote(void* buf, size_t len)
 LSocket *LnetClient::getSocket()
 {
   return this->_sockToRemoteServer;
-}
\ No newline at end of file
+}
+
+RpcChannel::RpcChannel(LnetClient *conn, size_t depth)
+  : _conn(conn),
+    _depth(std::max(depth, (size_t)1)),
+    _sendLock(new std::mutex()),
+    _lock(new std::mutex()),
+    _slotFree(new std::condition_variable()),
+    _nextId(0),
+    _closed(false)
+{
+  this->_recvThread = new std::thread( [=] { this->recvLoop(); });
+}
+
+RpcChannel::~RpcChannel()
+{
+  // Unblock the receiver; it fails the calls still in flight
+  ::shutdown(this->_conn->getSocket()->sockfd(), SHUT_RDWR);
+  this->_recvThread->join();
+  delete this->_recvThread;
+  delete this->_sendLock;
+  delete this->_lock;
+  delete this->_slotFree;
+}
+
+// Send a request and return without waiting for the response. Blocks
+// while the channel has depth requests in flight. The future gives the
+// size of the response, or -1 if the request or the connection failed.
+std::future<ssize_t> RpcChannel::callAsync(const LnetMsg *req, LnetMsg *res,
+                                           const void *out, size_t outLen,
+                                           void *in, size_t inLen)
+{
+  Call_t *c = new Call_t();
+  c->res = res;
+  c->in = in;
+  c->inLen = inLen;
+  std::future<ssize_t> f = c->done.get_future();
+
+  uint64_t id = 0;
+  {
+    std::unique_lock<std::mutex> lk(*this->_lock);
+    this->_slotFree->wait(lk, [=]{ return this->_closed || this->_calls.size() < this->_depth; });
+    if (this->_closed) {
+      c->done.set_value(-1);
+      delete c;
+      return f;
+    }
+    id = ++this->_nextId;
+    this->_calls[id] = c;
+  }
+
+  LnetMsg tagged;
+  tagged.copy(req);
+  tagged.reqId = id;
+  ssize_t sent = -1;
+  {
+    std::lock_guard<std::mutex> lk(*this->_sendLock);
+    sent = this->_conn->sendMsgToRemote(&tagged, out, out ? outLen : 0);
+  }
+  tagged.clear(); // The data belongs to req
+  if (sent < (ssize_t)sizeof(LnetHdr_t)) {
+    this->failCall(id);
+  }
+  return f;
+}
+
+ssize_t RpcChannel::call(const LnetMsg *req, LnetMsg *res,
+                         const void *out, size_t outLen,
+                         void *in, size_t inLen)
+{
+  return this->callAsync(req, res, out, outLen, in, inLen).get();
+}
+
+void RpcChannel::failCall(uint64_t id)
+{
+  std::lock_guard<std::mutex> lk(*this->_lock);
+  auto c = this->_calls.find(id);
+  if (c == std::end(this->_calls)) return;
+  c->second->done.set_value(-1);
+  delete c->second;
+  this->_calls.erase(c);
+  this->_slotFree->notify_one();
+}
+
+// Body of the receiver thread
+void RpcChannel::recvLoop()
+{
+  while (true) {
+    LnetMsg msg(Unknown);
+    LSocket *sock = this->_conn->getSocket();
+    ssize_t n = readHdr(sock, &msg);
+    if (n < (ssize_t)sizeof(LnetHdr_t)) break;
+
+    Call_t *c = NULL;
+    {
+      std::lock_guard<std::mutex> lk(*this->_lock);
+      auto it = this->_calls.find(msg.reqId);
+      if (it != std::end(this->_calls)) {
+        c = it->second;
+        this->_calls.erase(it);
+      }
+    }
+    // The raw data of a Read goes straight to the caller's buffer
+    char discard;
+    ssize_t body = c && c->in ? readBody(sock, &msg, c->in, c->inLen)
+                              : readBody(sock, &msg, &discard, 0);
+    if (body < 0) {
+      if (c) {
+        c->done.set_value(-1);
+        delete c;
+      }
+      break;
+    }
+    n += body;
+    if (!c) {
+      std::cerr << "Response " << msg << " to unknown request " << msg.reqId << std::endl;
+      continue;
+    }
+    c->res->copy(&msg);
+    msg.clear(); // The data now belongs to the caller's response
+    c->done.set_value(n);
+    delete c;
+    this->_slotFree->notify_one();
+  }
+
+  std::lock_guard<std::mutex> lk(*this->_lock);
+  this->_closed = true;
+  for (auto c : this->_calls) {
+    c.second->done.set_value(-1);
+    delete c.second;
+  }
+  this->_calls.clear();
+  this->_slotFree->notify_all();
+}
@@ -4,7 +4,15 @@
 #include <vector>
 #include <tuple>
 #include <map>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <future>
+#include <memory>
+#include <cstdlib>
 #include <cstring>
+#include <cstdint>
 #ifdef __linux__
 # include <sys/epoll.h>
 #else // ifdef __linux__
@@ -15,6 +23,14 @@
 #include "lsocket.h"
 
 const int MAX_EVENTS = 10000;
+const size_t DEFAULT_EVENT_LOOPS = 1;  // event loop threads of a server
+const size_t MAX_OUT_QUEUE = 64;       // msgs queued to a peer before senders block
+const int OUT_QUEUE_TIMEOUT_MS = 5000; // longest a sender off the event loops blocks
+const size_t IN_BUF_SIZE = 16384;      // initial input buffer of a connection
+const size_t MAX_MSG_LEN = 16 << 20;   // payload of a msg; a peer sending more is dropped
+const size_t MAX_BULK_LEN = 1 << 30;   // raw data following a msg, likewise
+const size_t BULK_CHUNK = 1 << 20;     // raw data a worker takes off a connection at a time
+const int BULK_TIMEOUT_MS = 30000;     // longest a peer may stall in the middle of raw data
 
 enum FsRequestType
 {
@@ -65,9 +81,24 @@ enum MsgType
   FsRequest,
   FsResponse,
   Data,
+  OstChange,
+  AllocsResync,
+  AddAgg,
+  AggOsts,
+  AggTimer,
+  AggTimerResp,
+  AggAllocs,
 };
 std::ostream& operator<<(std::ostream &os, const MsgType &t);
 
+// An Allocs msg either replaces the whole allocation table of the OST or
+// patches the version it is based on
+enum AllocsKind
+{
+  AllocsFull,
+  AllocsDelta,
+};
+
 struct BufType
 {
   size_t sz;
@@ -85,16 +116,90 @@ using AppAlloc_t = std::tuple<int , double >;
 using AppAllocs_t = std::vector<AppAlloc_t>;
 using MapOstToAppAllocs_t = std::vector<AppAllocs_t>;
 
+const uint8_t LNET_VERSION = 2;
+const uint8_t LNET_EXTRA_DATA = 0x1; // A payload of len bytes follows
+
+// Wire header of a LnetMsg, followed by len bytes of payload and bulkLen
+// bytes of raw data (the data of a Read or Write). Only the id of the app
+// goes with each msg; the OST learns its name from the payload of the Open.
+struct __attribute__((packed)) LnetHdr_t
+{
+  uint8_t version;
+  uint8_t t;       // MsgType
+  uint8_t f;       // FsRequestType
+  uint8_t flags;
+  int32_t appId;
+  uint64_t reqId;
+  uint64_t len;
+  uint64_t bulkLen;
+};
+static_assert(sizeof(LnetHdr_t) == 32, "LnetHdr_t is the wire format; bump LNET_VERSION to change it");
+
+// Payloads of up to this size are stored in the msg itself
+const size_t LNET_INLINE_SIZE = 256;
+
+// Size-class pool of payload buffers, shared by all the connections of the
+// process. Released buffers are kept for reuse, up to a few per class;
+// buffers above the largest class go straight to malloc().
+class LnetBufPool
+{
+  private:
+    static const int NUM_CLASSES = 5;
+    static const size_t MIN_CLASS = 1024;    // each class is 4 times the last
+    static const size_t MAX_FREE_PER_CLASS = 32;
+    std::mutex *_lock;
+    std::vector<void*> _free[NUM_CLASSES];
+
+    LnetBufPool();
+
+  public:
+    ~LnetBufPool();
+    static LnetBufPool *instance();
+    void *alloc(size_t size);
+    void release(void *buf);
+};
+
+// Raw data moved from a socket into a pipe, without a copy to user space
+struct PipeChunk_t
+{
+  int rfd;
+  int wfd;
+  size_t len; // bytes in the pipe
+};
+
+// Pipes for moving raw data with splice(), shared by all the connections
+// of the process. A released pipe is kept for reuse if it was drained.
+class LnetPipePool
+{
+  private:
+    static const int PIPE_SIZE = 1024 * 1024;
+    static const size_t MAX_FREE = 32;
+    std::mutex *_lock;
+    std::vector<PipeChunk_t> _free;
+
+    LnetPipePool();
+
+  public:
+    ~LnetPipePool();
+    static LnetPipePool *instance();
+    bool alloc(PipeChunk_t *);
+    void release(PipeChunk_t );
+};
+
 struct LnetMsg
 {
   private:
     size_t off;
+    char _inline[LNET_INLINE_SIZE];
+
+    void freeData();
 
   public:
     MsgType t;
     FsRequestType f;
     bool extraData;
-    LnetEntity *src;
+    uint64_t reqId; // FsRequest id, echoed back in its FsResponse
+    size_t bulkLen; // raw data following the msg on the wire
     AppInfo _i;
     size_t len;
     void *data;
@@ -103,10 +208,15 @@ struct LnetMsg
     LnetMsg(MsgType );
     LnetMsg(MsgType , size_t );
     LnetMsg(MsgType , FsRequestType , size_t );
+    LnetMsg(const LnetMsg &) = delete; // use copy() or deepcopy()
+    LnetMsg &operator=(const LnetMsg &) = delete;
     ~LnetMsg();
     void clear();
     void copy(const LnetMsg *);
+    void allocData();
     void deepcopy(const LnetMsg *);
+    void toHdr(LnetHdr_t *) const;
+    bool fromHdr(const LnetHdr_t *);
     template<typename T>
     LnetMsg &operator+=(const T* buf)
     {
@@ -191,12 +301,25 @@ struct LnetMsg
 };
 std::ostream& operator<<(std::ostream &os, const LnetMsg &m);
 
+// Write a msg with its payload and raw data in one writev(). Read a msg in
+// two steps: the header, then the payload with the raw data read straight
+// into bulk; bulk is left on the socket when NULL. readMsg() does both.
+// Return the number of bytes written or read, which is less than
+// sizeof(LnetHdr_t) on failure.
+ssize_t writeMsg(LSocket *sock, const LnetMsg *msg,
+                 const void *bulk = NULL, size_t bulkLen = 0);
+ssize_t writeMsgFile(LSocket *sock, const LnetMsg *msg, int fd, off_t offset, size_t len);
+ssize_t readHdr(LSocket *sock, LnetMsg *msg);
+ssize_t readBody(LSocket *sock, LnetMsg *msg, void *bulk = NULL, size_t bulkCap = 0);
+ssize_t readMsg(LSocket *sock, LnetMsg *msg);
+
 enum LEntityType
 {
   Invalid = -1,
   Mds,
   Ost,
   Osc,
+  Agg,
 };
 std::ostream& operator<<(std::ostream &os, const LEntityType &t);
 
@@ -237,27 +360,22 @@ struct LnetEntity
     }
   }
 
-  ssize_t sendMsgToRemote(const LnetMsg *msg) const
+  ssize_t sendMsgToRemote(const LnetMsg *msg, const void *bulk = NULL, size_t bulkLen = 0) const
   {
     if (!msg || !this->sock || !this->sock->isValid()) return -1;
-    ssize_t totalData = 0;
-    totalData += this->sock->writeAll(msg, sizeof(*msg));
-    if (msg->extraData && msg->len > 0 && msg->data) {
-      totalData += this->sock->writeAll(msg->data, msg->len);
-    }
-    return totalData;
+    return writeMsg(this->sock, msg, bulk, bulkLen);
+  }
+
+  ssize_t sendFileToRemote(const LnetMsg *msg, int fd, off_t offset, size_t len) const
+  {
+    if (!msg || !this->sock || !this->sock->isValid()) return -1;
+    return writeMsgFile(this->sock, msg, fd, offset, len);
   }
 
   ssize_t recvMsgFromRemote(LnetMsg *msg) const
   {
     if (!msg || !this->sock || !this->sock->isValid()) return -1;
-    ssize_t totalData = 0;
-    totalData += this->sock->readAll(msg, sizeof(*msg));
-    if (msg->extraData && msg->len > 0) {
-      msg->data = malloc(msg->len);
-      totalData += this->sock->readAll(msg->data, msg->len);
-    }
-    return totalData;
+    return readMsg(this->sock, msg);
   }
 
   ssize_t recvDataFromRemote(void *buf, size_t len) const
@@ -337,6 +455,21 @@ struct OstInfo: public MdsClient
   }
 };
 
+// An aggregator: relays the timer and allocation msgs between its parent
+// (the MDS or another aggregator) and a subtree of OSTs
+struct AggInfo: public MdsClient
+{
+  AggInfo()
+   : MdsClient(Agg)
+  {
+  }
+
+  AggInfo(const AggInfo *ptr)
+   : MdsClient(ptr)
+  {
+  }
+};
+
 struct ActiveRequest
 {
   struct AppInfo _info;
@@ -344,6 +477,120 @@ struct ActiveRequest
 };
 std::ostream& operator<<(std::ostream &os, const ActiveRequest &r);
 
+// Number of active requests of each (app id, request type). Timer
+// responses carry the difference between two of these.
+using ReqKey_t = std::pair<int, FsRequestType>;
+using ReqCounts_t = std::map<ReqKey_t, int>;
+using ReqDelta_t = std::tuple<int, FsRequestType, int>; // app id, type, count change
+
+// Payload of a TimerResp: the epoch, the epoch its request set is based on
+// (0 for the empty set), the count changes since that base and the infos
+// of the apps new to it
+struct TimerResp_t
+{
+  size_t seq;
+  size_t base;
+  std::vector<ReqDelta_t> delta;
+  std::vector<AppInfo> apps;
+
+  void unpack(const LnetMsg *msg);
+};
+
+// Request sets an OST sent in its recent timer responses, by epoch. A
+// response only carries the change since the set the MDS acknowledged,
+// or the whole set if that one is no longer kept.
+class ReqSetHistory
+{
+  private:
+    static const size_t MAX_SETS = 16;
+    std::map<size_t, ReqCounts_t> _sets;
+
+  public:
+    LnetMsg *respond(size_t seq, size_t ack, const std::vector<ActiveRequest> &reqs);
+};
+
+// Msg addressed to, or coming from, one OST behind an aggregator. The
+// AggTimer, AggTimerResp and AggAllocs msgs carry a batch of these: the
+// number of msgs, then each OST id with the payload of its Timer,
+// TimerResp or Allocs msg.
+using OstMsg_t = std::pair<int, LnetMsg*>;
+LnetMsg *newOstBatch(MsgType t, const std::vector<OstMsg_t> &msgs);
+void unpackOstBatch(const LnetMsg *batch, MsgType t, std::vector<OstMsg_t> &msgs);
+
+// Allocation table of an OST: the share of each app, at a version. The
+// MDS keeps the table last sent to each OST and sends it only the entries
+// that changed; the OST applies the Allocs msgs in order.
+struct AllocTable_t
+{
+  size_t version;
+  std::map<int, double> rates; // app id -> share of the OST bandwidth
+
+  AllocTable_t() : version(0) {}
+  LnetMsg *update(const std::map<int, double> &newRates);
+  LnetMsg *resync() const;
+  bool apply(const LnetMsg *msg, std::map<int, double> *changed);
+};
+
+struct InBuf_t;
+
+// One event loop of a server and the peers it watches
+struct Shard_t
+{
+  int epollFd;
+  int stopFd;      // eventfd, readable once the loop is to return
+  int wakeFd;      // eventfd, readable once peers are resumed
+  struct epoll_event events[MAX_EVENTS];
+  std::thread::id loopThread;
+  // Peers to read again, see Epoll::resumeBulk(); guarded by Epoll::_inLock
+  std::vector<std::pair<const LnetEntity*, std::weak_ptr<InBuf_t>>> resumed;
+};
+
+// Msgs not yet written to a peer, in send order. Each buf holds the
+// LnetHdr_t of a msg followed by its payload.
+struct OutQueue_t
+{
+  std::deque<BufType> bufs;
+  size_t off;      // bytes of the first buf already written
+  bool armed;      // EPOLLOUT is enabled for the peer
+  Shard_t *shard;  // event loop watching the peer
+
+  OutQueue_t(Shard_t *shard)
+  {
+    this->off = 0;
+    this->armed = false;
+    this->shard = shard;
+  }
+};
+
+// Bytes read from a peer and not yet handled. The event loop reads as
+// much as the socket has, and hands each complete msg to the server; the
+// raw data following a msg goes to whoever calls recvBulk() for it.
+struct InBuf_t
+{
+  char *buf;
+  size_t cap;
+  size_t start;    // unhandled bytes are [start, end)
+  size_t end;
+  size_t bulkLeft; // raw data of the last msg not read yet
+  bool held;       // the raw data is taken off the event loop
+  Shard_t *shard;  // event loop watching the peer
+
+  InBuf_t(Shard_t *shard)
+  {
+    this->buf = (char*)malloc(IN_BUF_SIZE);
+    this->cap = IN_BUF_SIZE;
+    this->start = 0;
+    this->end = 0;
+    this->bulkLeft = 0;
+    this->held = false;
+    this->shard = shard;
+  }
+  ~InBuf_t()
+  {
+    free(this->buf);
+  }
+};
+
 // class Epoll
 // class LnetServer: public Epoll
 // class LnetClient
@@ -354,22 +601,59 @@ std::ostream& operator<<(std::ostream &os, const ActiveRequest &r);
 class Epoll
 {
   protected:
-    struct epoll_event _events[MAX_EVENTS];
-    int _epollFd;
+    // Each peer is watched by one shard, picked round-robin, so that the
+    // msgs of a peer are handled in order while the shards run in parallel.
+    // Handlers thus run on several threads at once when there are more
+    // than one, from $GIFT_EVENT_LOOPS.
+    std::vector<Shard_t*> _shards;
+    size_t _nextShard;
+
+    // Outbound queue of each peer, guarded by _outLock
+    std::mutex *_outLock;
+    std::condition_variable *_outDrained;
+    std::map<const LnetEntity*, OutQueue_t*> _outQueues;
+
+    // Input buffer of each peer, guarded by _inLock. Only the event loop
+    // reads into it, and only a msg handler, or the thread it holds the
+    // peer for, takes the raw data out of it. A peer may be removed from
+    // any thread while its handler runs, so the buffer is shared: it goes
+    // when the last user drops it.
+    std::mutex *_inLock;
+    std::map<const LnetEntity*, std::shared_ptr<InBuf_t>> _inBufs;
 
     virtual void addClient(const LnetEntity *);
     virtual void addRemoteServer(const LnetEntity *);
     virtual void removeClient(const LnetEntity *);
+    void watch(const LnetEntity *);
+    bool onLoopThread() const;
+    ssize_t queueMsgToRemote(const LnetEntity *, const LnetMsg *) const;
+    void onWritable(const LnetEntity *);
+    void flushOutQueue(const LnetEntity *, OutQueue_t *) const;
+    void setWritableEvent(const LnetEntity *, OutQueue_t *, bool ) const;
+    bool onReadable(const LnetEntity *);
+    bool handleMsgs(const LnetEntity *);
+    void onResumed(Shard_t *);
+    std::shared_ptr<InBuf_t> getInBuf(const LnetEntity *, bool *held = NULL) const;
 
     virtual void onConnect() = 0;
     virtual void onDisconnect(const LnetEntity *) = 0;
-    virtual void onClientRequest(const LnetEntity *) = 0;
-    virtual void onRemoteServerRequest(const LnetEntity *) = 0;
+    // Called on the event loop for each complete msg from a peer. A msg
+    // with raw data is followed by it on the connection; what the handler
+    // does not take with recvBulk() or spliceBulk() before returning is
+    // dropped, unless it holds the peer with holdBulk() for another thread
+    // to take the data.
+    virtual void onClientRequest(const LnetEntity *, LnetMsg *) = 0;
+    virtual void onRemoteServerRequest(const LnetEntity *, LnetMsg *) = 0;
 
   public:
     Epoll();
     virtual ~Epoll();
     virtual void eventLoop() = 0;
+    size_t bulkBuffered(const LnetEntity *) const;
+    ssize_t recvBulk(const LnetEntity *, void *buf, size_t len) const;
+    void holdBulk(const LnetEntity *);
+    void resumeBulk(const LnetEntity *);
+    ssize_t spliceBulk(const LnetEntity *, PipeChunk_t *, size_t len) const;
 };
 
 class LnetServer: public Epoll
@@ -379,13 +663,16 @@ class LnetServer: public Epoll
 
     virtual void onConnect() = 0;
     virtual void onDisconnect(const LnetEntity *) = 0;
-    virtual void onClientRequest(const LnetEntity *) = 0;
-    virtual void onRemoteServerRequest(const LnetEntity *) = 0;
+    virtual void onClientRequest(const LnetEntity *, LnetMsg *) = 0;
+    virtual void onRemoteServerRequest(const LnetEntity *, LnetMsg *) = 0;
+    std::vector<std::thread> _shardThreads; // shards but the first
+    void runShard(Shard_t *);
 
   public:
     LnetServer(int port);
     virtual ~LnetServer();
     virtual void eventLoop();
+    void stopEventLoop();
 };
 
 class LnetClient
@@ -397,11 +684,52 @@ class LnetClient
     LnetClient(const LSockAddr &, int );
     virtual ~LnetClient();
     virtual bool connectToRemoteServer(const LSockAddr &, int );
-    virtual ssize_t sendMsgToRemote(const LnetMsg *) const;
+    virtual ssize_t sendMsgToRemote(const LnetMsg *, const void *bulk = NULL,
+                                    size_t bulkLen = 0) const;
     virtual ssize_t recvMsgFromRemote(LnetMsg *);
     virtual ssize_t sendRawDataToRemote(const void*, size_t );
     virtual ssize_t recvRawDataFromRemote(void*, size_t );
     LSocket *getSocket();
 };
 
+// Client end of a connection carrying tagged requests. Any number of
+// threads can have requests in flight on it, up to its depth; a receiver
+// thread completes the future of each request when the response with its
+// id comes back. Raw data can follow a request, and a response; the latter
+// is read into the buffer given with the request.
+class RpcChannel
+{
+  private:
+    struct Call_t
+    {
+      std::promise<ssize_t> done;
+      LnetMsg *res;
+      void *in;     // buffer for the data following the response
+      size_t inLen;
+    };
+
+    LnetClient *_conn;
+    size_t _depth;
+    std::mutex *_sendLock;
+    std::mutex *_lock;
+    std::condition_variable *_slotFree;
+    std::map<uint64_t, Call_t*> _calls; // in flight, guarded by _lock
+    uint64_t _nextId;
+    bool _closed;
+    std::thread *_recvThread;
+
+    void recvLoop();
+    void failCall(uint64_t id);
+
+  public:
+    RpcChannel(LnetClient *, size_t depth);
+    ~RpcChannel();
+    std::future<ssize_t> callAsync(const LnetMsg *req, LnetMsg *res,
+                                   const void *out = NULL, size_t outLen = 0,
+                                   void *in = NULL, size_t inLen = 0);
+    ssize_t call(const LnetMsg *req, LnetMsg *res,
+                 const void *out = NULL, size_t outLen = 0,
+                 void *in = NULL, size_t inLen = 0);
+};
+
 #endif // ifndef _LNET_H_
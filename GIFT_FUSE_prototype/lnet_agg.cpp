@@ -0,0 +1,355 @@
+#include <algorithm>
+#include <cassert>
+#include <iostream>
+
+#include "lnet.h"
+#include "agg.h"
+
+LnetAgg::LnetAgg(const LSockAddr &addr, int port, const AggInfo *info, int deadlineMs)
+  : LnetServer(info->listenport),
+    _info(info),
+    _deadline(deadlineMs),
+    _lock(new std::mutex()),
+    _epochReady(new std::condition_variable()),
+    _seq(0),
+    _epochOpen(false),
+    _stop(false)
+{
+  this->_toParent = new LnetClient(addr, port);
+  this->_parentInfo = new MdsInfo();
+  this->_parentInfo->id = 0;
+  this->_parentInfo->listenport = port;
+  this->_parentInfo->sock = this->_toParent->getSocket();
+  this->_deadlineThread = new std::thread( [=] { this->deadlineLoop(); });
+}
+
+LnetAgg::~LnetAgg()
+{
+  // No handler may run on the members freed below
+  this->stopEventLoop();
+  {
+    std::lock_guard<std::mutex> lk(*this->_lock);
+    this->_stop = true;
+  }
+  this->_epochReady->notify_all();
+  this->_deadlineThread->join();
+  delete this->_deadlineThread;
+  for (auto r : this->_resps) {
+    delete r.second;
+  }
+  this->_children.clear();
+  delete this->_lock;
+  delete this->_epochReady;
+}
+
+bool LnetAgg::pubAggInfoToParent()
+{
+  LnetMsg msg(AddAgg, sizeof(*this->_info));
+  memcpy(msg.data, this->_info, sizeof(*this->_info));
+  if (this->_toParent->sendMsgToRemote(&msg) < 0) return false;
+  this->addRemoteServer(this->_parentInfo);
+  return true;
+}
+
+void LnetAgg::onConnect()
+{
+  struct sockaddr_storage remoteAddr;
+  socklen_t remoteLen = sizeof(remoteAddr);
+  LSocket remote = this->_sock->accept(&remoteAddr, &remoteLen);
+
+  LnetMsg msg(Unknown);
+  if (!remote.isValid()) {
+    remote.close();
+    return;
+  }
+  readMsg(&remote, &msg);
+  switch (msg.t) {
+    case AddOst:
+      this->addChild(remote, new OstInfo((OstInfo*)msg.data));
+      break;
+    case AddAgg:
+      this->addChild(remote, new AggInfo((AggInfo*)msg.data));
+      break;
+    default:
+      std::cerr << "Unknown msg received from client: " << msg.t << std::endl;
+      break;
+  }
+}
+
+void LnetAgg::addChild(const LSocket &remote, LnetEntity *i)
+{
+  i->sock = new LClientSocket(remote.sockfd());
+  {
+    std::lock_guard<std::mutex> lk(*this->_lock);
+    this->_children.push_back(i);
+    if (i->type == Ost) {
+      this->_route[i->id] = i;
+      this->sendOstsToParent();
+    }
+  }
+  std::cerr << *i << " connected" << std::endl;
+  this->addClient(i);
+}
+
+void LnetAgg::onDisconnect(const LnetEntity *remote)
+{
+  if (remote == this->_parentInfo) {
+    this->removeClient(remote);
+    std::cerr << *remote << " disconnected" << std::endl;
+    return;
+  }
+  std::lock_guard<std::mutex> lk(*this->_lock);
+  auto child = std::find(this->_children.begin(), this->_children.end(), remote);
+  if (child == std::end(this->_children)) return;
+  this->removeClient(remote);
+  std::cerr << *remote << " disconnected" << std::endl;
+
+  for (auto r = this->_route.begin(); r != this->_route.end(); ) {
+    r = r->second == remote ? this->_route.erase(r) : std::next(r);
+  }
+  this->_children.erase(child);
+  this->sendOstsToParent();
+  if (this->_epochOpen && this->_waiting.erase(remote) && this->_waiting.empty()) {
+    this->closeEpoch();
+  }
+}
+
+void LnetAgg::onClientRequest(const LnetEntity *remote, LnetMsg *msg)
+{
+  if (!remote || !remote->sock || !remote->sock->isValid()) return;
+  if (remote == this->_parentInfo) {
+    return this->onRemoteServerRequest(remote, msg);
+  }
+  std::cerr << "received msg " << *msg << " from " << *remote << std::endl;
+  switch (msg->t) {
+    case TimerResp:
+    case AggTimerResp:
+      this->addTimerResponse(remote, msg);
+      break;
+    case AggOsts:
+      this->setChildOsts(remote, msg);
+      break;
+    case AllocsResync:
+      this->relayAllocsResync(remote, msg);
+      break;
+    default:
+      std::cerr << "Unhandled msg type " << msg->t << std::endl;
+      break;
+  }
+}
+
+void LnetAgg::onRemoteServerRequest(const LnetEntity *remote, LnetMsg *msg)
+{
+  if (!remote || !remote->sock || !remote->sock->isValid()) return;
+  std::cerr << "received msg " << *msg << " from parent " << *remote << std::endl;
+  switch (msg->t) {
+    case AggTimer:
+      this->relayTimer(msg);
+      break;
+    case AggAllocs:
+      this->relayAllocs(msg);
+      break;
+    default:
+      std::cerr << "Unhandled msg type " << msg->t << std::endl;
+      break;
+  }
+}
+
+// A child aggregator reports the OSTs below it. Called on the event loop.
+void LnetAgg::setChildOsts(const LnetEntity *remote, const LnetMsg *msg)
+{
+  size_t n = 0;
+  size_t offset = 0;
+  msg->extractData(&n, offset);
+  std::lock_guard<std::mutex> lk(*this->_lock);
+  for (auto r = this->_route.begin(); r != this->_route.end(); ) {
+    r = r->second == remote ? this->_route.erase(r) : std::next(r);
+  }
+  for (size_t i = 0; i < n; i++) {
+    int id = -1;
+    msg->extractData(&id, offset);
+    this->_route[id] = remote;
+  }
+  this->sendOstsToParent();
+}
+
+// Report all the OSTs below to the parent. Called with _lock held.
+void LnetAgg::sendOstsToParent()
+{
+  size_t n = this->_route.size();
+  LnetMsg msg(AggOsts, sizeof(n) + n * sizeof(int));
+  msg.pack(&n);
+  for (auto r : this->_route) {
+    msg.pack(&r.first);
+  }
+  this->_toParent->sendMsgToRemote(&msg);
+}
+
+// Send the Timer of each OST down to the child relaying to it: as is to an
+// OST, batched to an aggregator. The epoch closes when all the children
+// have answered or at the deadline.
+void LnetAgg::relayTimer(const LnetMsg *msg)
+{
+  std::vector<OstMsg_t> timers;
+  unpackOstBatch(msg, Timer, timers);
+  size_t seq = 0;
+  if (!timers.empty()) {
+    timers[0].second->unmarshall(&seq);
+  }
+
+  std::lock_guard<std::mutex> lk(*this->_lock);
+  // The parent has moved on from an epoch still open here
+  for (auto r : this->_resps) {
+    delete r.second;
+  }
+  this->_resps.clear();
+  this->_waiting.clear();
+
+  std::map<const LnetEntity*, std::vector<OstMsg_t>> batches;
+  for (auto t : timers) {
+    auto r = this->_route.find(t.first);
+    if (r != std::end(this->_route)) {
+      batches[r->second].push_back(t);
+    }
+  }
+  for (auto b : batches) {
+    ssize_t sent = -1;
+    if (b.first->type == Ost) {
+      sent = this->queueMsgToRemote(b.first, b.second[0].second);
+    } else {
+      LnetMsg *batch = newOstBatch(AggTimer, b.second);
+      sent = this->queueMsgToRemote(b.first, batch);
+      delete batch;
+    }
+    // A child without the Timer will not answer; the parent reuses the
+    // last requests of its OSTs
+    if (sent >= 0) {
+      this->_waiting.insert(b.first);
+    }
+  }
+  for (auto t : timers) {
+    delete t.second;
+  }
+
+  this->_seq = seq;
+  this->_epochOpen = true;
+  this->_epochEnd = std::chrono::steady_clock::now() + this->_deadline;
+  if (this->_waiting.empty()) {
+    this->closeEpoch();
+  }
+  this->_epochReady->notify_one();
+}
+
+void LnetAgg::addTimerResponse(const LnetEntity *remote, const LnetMsg *msg)
+{
+  std::vector<OstMsg_t> resps;
+  if (msg->t == AggTimerResp) {
+    unpackOstBatch(msg, TimerResp, resps);
+  } else {
+    LnetMsg *resp = new LnetMsg(TimerResp, msg->len);
+    memcpy(resp->data, msg->data, msg->len);
+    resps.push_back(OstMsg_t(remote->id, resp));
+  }
+
+  std::lock_guard<std::mutex> lk(*this->_lock);
+  for (auto r : resps) {
+    size_t seq = 0;
+    r.second->unmarshall(&seq);
+    if (this->_epochOpen && seq == this->_seq && this->_waiting.count(remote)) {
+      this->_resps.push_back(r);
+    } else {
+      delete r.second;
+    }
+  }
+  if (this->_epochOpen && this->_waiting.erase(remote) && this->_waiting.empty()) {
+    this->closeEpoch();
+    this->_epochReady->notify_one();
+  }
+}
+
+// Send the merged timer responses of the epoch up. Called with _lock held.
+void LnetAgg::closeEpoch()
+{
+  LnetMsg *batch = newOstBatch(AggTimerResp, this->_resps);
+  this->_toParent->sendMsgToRemote(batch);
+  delete batch;
+  for (auto r : this->_resps) {
+    delete r.second;
+  }
+  this->_resps.clear();
+  this->_waiting.clear();
+  this->_epochOpen = false;
+}
+
+// Body of the deadline thread: forward what has been collected when the
+// children are late, so that the parent is not held back by one subtree
+void LnetAgg::deadlineLoop()
+{
+  std::unique_lock<std::mutex> lk(*this->_lock);
+  while (true) {
+    this->_epochReady->wait(lk, [=]{ return this->_stop || this->_epochOpen; });
+    if (this->_stop) return;
+    size_t seq = this->_seq;
+    if (!this->_epochReady->wait_until(lk, this->_epochEnd, [=]{
+          return this->_stop || !this->_epochOpen || this->_seq != seq; })) {
+      std::cerr << "Epoch " << seq << " deadline passed with " << this->_waiting.size()
+                << " children late" << std::endl;
+      this->closeEpoch();
+    }
+  }
+}
+
+// Send the Allocs of each OST down to the child relaying to it
+void LnetAgg::relayAllocs(const LnetMsg *msg)
+{
+  std::vector<OstMsg_t> allocs;
+  unpackOstBatch(msg, Allocs, allocs);
+
+  std::map<const LnetEntity*, std::vector<OstMsg_t>> batches;
+  {
+    std::lock_guard<std::mutex> lk(*this->_lock);
+    for (auto a : allocs) {
+      auto r = this->_route.find(a.first);
+      if (r != std::end(this->_route)) {
+        batches[r->second].push_back(a);
+      }
+    }
+  }
+  for (auto b : batches) {
+    ssize_t sent = -1;
+    if (b.first->type == Ost) {
+      sent = this->queueMsgToRemote(b.first, b.second[0].second);
+    } else {
+      LnetMsg *batch = newOstBatch(AggAllocs, b.second);
+      sent = this->queueMsgToRemote(b.first, batch);
+      delete batch;
+    }
+    // The OSTs missed this version: have the parent send their full tables
+    if (sent < 0) {
+      for (auto a : b.second) {
+        this->requestAllocsResync(a.first);
+      }
+    }
+  }
+  for (auto a : allocs) {
+    delete a.second;
+  }
+}
+
+// Ask the parent to resend the allocation table of an OST below
+void LnetAgg::relayAllocsResync(const LnetEntity *remote, const LnetMsg *msg)
+{
+  int id = remote->id;
+  if (remote->type == Agg) {
+    msg->unmarshall(&id);
+  }
+  this->requestAllocsResync(id);
+}
+
+void LnetAgg::requestAllocsResync(int id)
+{
+  LnetMsg resync(AllocsResync, sizeof(id));
+  resync.pack(&id);
+  std::lock_guard<std::mutex> lk(*this->_lock);
+  this->_toParent->sendMsgToRemote(&resync);
+}
@@ -1,35 +1,139 @@
 #include <algorithm>
 #include <cassert>
+#include <cerrno>
 #include <iostream>
 #include <vector>
 #include <set>
+#include <thread>
 
 #include "lnet.h"
 #include "mds.h"
-#include "ClpSimplex.hpp"
 
 static std::vector<AppCoup_t> coupDatabase;
 static std::vector<AppData_t> rdmpDatabase;
 static std::vector<double> effectiveSysBw;
 
-LnetMds::LnetMds(int port, std::mutex *m, std::condition_variable *cv, bool *b)
+const size_t ALLOC_CACHE_SIZE = 64;
+
+LnetMds::LnetMds(int port, std::mutex *m, std::condition_variable *cv, size_t *solved,
+                 Policy_t policy)
   : LnetServer(port),
     _m(m),
     _waitForAllOsts(cv),
-    _dataIsReady(b)
+    _solvedEpoch(solved),
+    _epochLock(new std::mutex()),
+    _epoch(0),
+    _epochOpen(false),
+    _epochChanged(false),
+    _ostSendLock(new std::mutex()),
+    _allocLock(new std::mutex()),
+    _allocReady(new std::condition_variable()),
+    _allocStop(false),
+    _policy(policy),
+    _allocCache(new AllocCache(ALLOC_CACHE_SIZE)),
+    _allocTableLock(new std::mutex()),
+    _changeLock(new std::mutex()),
+    _changeReady(new std::condition_variable()),
+    _changePending(false),
+    _pendingReqs(new PendingReqs())
 {
+#ifdef USE_CLP
+  this->_giftLp = new SplitAllocLp(std::thread::hardware_concurrency());
+  this->_mbwLp = new SplitAllocLp(std::thread::hardware_concurrency());
+#else
+  this->_giftLp = NULL;
+  this->_mbwLp = NULL;
+#endif
+  this->_allocThread = new std::thread( [=] { this->allocLoop(); });
 }
 
 LnetMds::~LnetMds()
 {
+  // No handler may run on the members freed below
+  this->stopEventLoop();
+  {
+    std::lock_guard<std::mutex> lk(*this->_allocLock);
+    this->_allocStop = true;
+  }
+  this->_allocReady->notify_one();
+  this->_allocThread->join();
+  delete this->_allocThread;
+  delete this->_allocCache;
+  delete this->_allocTableLock;
+
   this->_oscs.clear();
   this->_osts.clear();
+  this->_aggs.clear();
   this->_dirToOst.clear();
   this->_ostReqs.clear();
+#ifdef USE_CLP
+  delete this->_giftLp;
+  delete this->_mbwLp;
+#endif
+  delete this->_epochLock;
+  delete this->_ostSendLock;
+  delete this->_allocLock;
+  delete this->_allocReady;
+  delete this->_changeLock;
+  delete this->_changeReady;
+  delete this->_pendingReqs;
+}
+
+PendingReqs::PendingReqs()
+  : _lock(new std::mutex()),
+    _nextId(0)
+{
+}
+
+PendingReqs::~PendingReqs()
+{
+  delete this->_lock;
+}
+
+// Returns the id the request is relayed with
+uint64_t PendingReqs::add(const LnetEntity *origin, uint64_t origId, const LnetEntity *target)
+{
+  std::lock_guard<std::mutex> lk(*this->_lock);
+  uint64_t id = ++this->_nextId;
+  this->_reqs[id] = {origin, origId, target};
+  return id;
+}
+
+bool PendingReqs::take(uint64_t id, Req_t &req)
+{
+  std::lock_guard<std::mutex> lk(*this->_lock);
+  auto r = this->_reqs.find(id);
+  if (r == std::end(this->_reqs)) return false;
+  req = r->second;
+  this->_reqs.erase(r);
+  return true;
+}
+
+// The OSC is gone: responses to its requests are dropped
+void PendingReqs::dropOrigin(const LnetEntity *origin)
+{
+  std::lock_guard<std::mutex> lk(*this->_lock);
+  for (auto r = this->_reqs.begin(); r != this->_reqs.end(); ) {
+    r = r->second.origin == origin ? this->_reqs.erase(r) : std::next(r);
+  }
+}
+
+void PendingReqs::takeForTarget(const LnetEntity *target, std::vector<Req_t> &reqs)
+{
+  std::lock_guard<std::mutex> lk(*this->_lock);
+  for (auto r = this->_reqs.begin(); r != this->_reqs.end(); ) {
+    if (r->second.target == target) {
+      reqs.push_back(r->second);
+      r = this->_reqs.erase(r);
+    } else {
+      r++;
+    }
+  }
 }
 
 const OstInfo *LnetMds::getOstFromPath(const std::string *path) const
 {
+  std::lock_guard<std::mutex> lk(*this->_ostSendLock);
   for (auto v: this->_dirToOst) {
     if (strstr(path->c_str(), v.first.c_str())) {
       return v.second;
@@ -49,11 +153,7 @@ void LnetMds::onConnect()
     remote.close();
     return;
   }
-  remote >> msg;
-  if (msg.extraData && msg.len > 0) {
-    msg.data = malloc(msg.len);
-    remote.readAll(msg.data, msg.len);
-  }
+  readMsg(&remote, &msg);
   switch (msg.t) {
     case AddOsc:
       this->addOsc(remote, (OscInfo*)msg.data);
@@ -61,6 +161,9 @@ void LnetMds::onConnect()
     case AddOst:
       this->addOst(remote, (OstInfo*)msg.data);
       break;
+    case AddAgg:
+      this->addAgg(remote, (AggInfo*)msg.data);
+      break;
     default:
       std::cerr << "Unknown msg received from client: " << msg.t << std::endl;
       break;
@@ -72,7 +175,10 @@ void LnetMds::addOsc(const LSocket &remote, const OscInfo *info)
   LClientSocket *sock = new LClientSocket(remote.sockfd());
   OscInfo *i = new OscInfo(info);
   i->sock = sock;
-  this->_oscs.push_back(i);
+  {
+    std::lock_guard<std::mutex> lk(*this->_ostSendLock);
+    this->_oscs.push_back(i);
+  }
   std::cerr << "OSC " << *i << " connected" << std::endl;
   this->addClient(i);
 }
@@ -82,54 +188,133 @@ void LnetMds::addOst(const LSocket &remote, const OstInfo *info)
   LClientSocket *sock = new LClientSocket(remote.sockfd());
   OstInfo *i = new OstInfo(info);
   i->sock = sock;
-  this->_osts.push_back(i);
+  // Register the OST before it can be sent to from other threads
+  this->addClient(i);
+  {
+    std::lock_guard<std::mutex> lk(*this->_ostSendLock);
+    this->_osts.push_back(i);
+    this->_dirToOst[i->name] = i;
+  }
   std::cerr << *i << " connected" << std::endl;
-  this->_dirToOst[i->name] = i;
+  this->requestEpoch();
+}
+
+void LnetMds::addAgg(const LSocket &remote, const AggInfo *info)
+{
+  LClientSocket *sock = new LClientSocket(remote.sockfd());
+  AggInfo *i = new AggInfo(info);
+  i->sock = sock;
   this->addClient(i);
+  {
+    std::lock_guard<std::mutex> lk(*this->_ostSendLock);
+    this->_aggs.push_back(i);
+  }
+  std::cerr << *i << " connected" << std::endl;
+}
+
+// An aggregator sends the ids of all the OSTs below it whenever they
+// change. Their timer and allocation msgs then go through it.
+void LnetMds::setAggOsts(const LnetEntity *remote, const LnetMsg *msg)
+{
+  size_t n = 0;
+  size_t offset = 0;
+  msg->extractData(&n, offset);
+  std::lock_guard<std::mutex> lk(*this->_ostSendLock);
+  for (auto a = this->_ostAgg.begin(); a != this->_ostAgg.end(); ) {
+    a = a->second == remote ? this->_ostAgg.erase(a) : std::next(a);
+  }
+  for (size_t i = 0; i < n; i++) {
+    int id = -1;
+    msg->extractData(&id, offset);
+    this->_ostAgg[id] = remote;
+  }
+  std::cerr << *remote << " relays to " << n << " OSTs" << std::endl;
 }
 
 void LnetMds::onDisconnect(const LnetEntity *remote)
 {
+  std::unique_lock<std::mutex> peersLk(*this->_ostSendLock);
+  auto agg = std::find(this->_aggs.begin(), this->_aggs.end(), remote);
+  if (agg != std::end(this->_aggs)) {
+    // Its OSTs are sent to directly again
+    for (auto a = this->_ostAgg.begin(); a != this->_ostAgg.end(); ) {
+      a = a->second == remote ? this->_ostAgg.erase(a) : std::next(a);
+    }
+    this->_aggs.erase(agg);
+    peersLk.unlock();
+    this->removeClient(remote);
+    std::cerr << *remote << " disconnected" << std::endl;
+    return;
+  }
   auto osc = std::find(this->_oscs.begin(), this->_oscs.end(), remote);
   if (osc != std::end(this->_oscs)) {
-    this->removeClient(remote);
     this->_oscs.erase(osc);
+    peersLk.unlock();
+    this->removeClient(remote);
+    this->_pendingReqs->dropOrigin(remote);
     std::cerr << *remote << " disconnected" << std::endl;
     return;
   }
   auto ost = std::find(this->_osts.begin(), this->_osts.end(), remote);
-  if (ost != std::end(this->_osts)) {
+  bool isOst = ost != std::end(this->_osts);
+  int ostId = isOst ? (*ost)->id : -1;
+  if (isOst) {
+    // No sender finds the OST once its queue is torn down
+    this->_osts.erase(ost);
+  }
+  peersLk.unlock();
+  if (isOst) {
     this->removeClient(remote);
     std::cerr << *remote << " disconnected" << std::endl;
-    this->_osts.erase(ost);
+    {
+      std::lock_guard<std::mutex> lk(*this->_epochLock);
+      this->_ostReqs.erase(remote);
+      this->_epochResps.erase(remote);
+    }
+    {
+      // A reconnecting OST starts from an empty table
+      std::lock_guard<std::mutex> lk(*this->_allocTableLock);
+      this->_allocTables.erase(ostId);
+    }
+    this->failPendingReqs(remote);
+    this->requestEpoch();
     return;
   }
 }
 
-void LnetMds::onClientRequest(const LnetEntity *remote)
+void LnetMds::onClientRequest(const LnetEntity *remote, LnetMsg *msg)
 {
   if (!remote || !remote->sock || !remote->sock->isValid()) return;
-  LnetMsg msg(Unknown);
-  remote->recvMsgFromRemote(&msg);
-  std::cerr << "received msg " << msg << " from " << *remote << std::endl;
-  switch (msg.t) {
+  std::cerr << "received msg " << *msg << " from " << *remote << std::endl;
+  switch (msg->t) {
     case GetOstInfo:
       this->sendOstsInfo(remote);
       break;
     case FsRequest:
-      memcpy(&msg.src, &remote, sizeof(remote));
-      this->handleFsRequest(remote, &msg);
+      this->handleFsRequest(remote, msg);
       break;
     case FsResponse:
-      assert (msg.extraData);
-      msg.src->sendMsgToRemote(&msg);
+      assert (msg->extraData);
+      this->relayFsResponse(msg);
       break;
     case TimerResp:
-      assert (msg.extraData);
-      this->addToTimerResponse(remote, &msg);
+      assert (msg->extraData);
+      this->addToTimerResponse(remote, msg);
+      break;
+    case OstChange:
+      this->requestEpoch();
+      break;
+    case AllocsResync:
+      this->resyncAllocs(remote, msg);
+      break;
+    case AggOsts:
+      this->setAggOsts(remote, msg);
+      break;
+    case AggTimerResp:
+      this->addToAggTimerResponse(remote, msg);
       break;
     default:
-      std::cerr << "Unhandled msg " << msg << std::endl;
+      std::cerr << "Unhandled msg " << *msg << std::endl;
       break;
   }
 }
@@ -138,98 +323,400 @@ void LnetMds::computeBwAllocations(Policy_t policy,
                                    const std::vector<std::vector<int>> &reqs,
                                    MapOstToAppAllocs_t &allocs)
 {
-  // Assert that all the OSTs are covered
-  const size_t NUM_OSTS = this->_osts.size();
-  assert (reqs.size() == NUM_OSTS);
+  // GIFT and TMF keep per-app state across epochs, the other policies only
+  // depend on the request sets and are memoized
+  const bool cacheable = policy != GIFT && policy != TMF;
+  if (cacheable && this->_allocCache->lookup(policy, reqs, allocs)) {
+    return;
+  }
+  auto start = std::chrono::steady_clock::now();
+
+  // Intern the app ids and build the incidence once for the epoch
+  ReqIncidence_t m;
+  m.build(reqs);
 
   switch (policy) {
     case POFS:
-      computeBwAllocationsPOFS(NUM_OSTS, reqs, allocs);
+      computeBwAllocationsPOFS(m, allocs);
       break;
     case BSIP:
-      computeBwAllocationsBSIP(NUM_OSTS, reqs, allocs);
+      computeBwAllocationsBSIP(m, allocs);
       break;
 	  case TSA:
-      computeBwAllocationsTSA(NUM_OSTS, reqs, allocs);
+      computeBwAllocationsTSA(m, allocs);
       break;
 	  case ESA:
-      computeBwAllocationsESA(NUM_OSTS, reqs, allocs);
+      computeBwAllocationsESA(m, allocs);
       break;
 	  case TMF:
-      computeBwAllocationsTMF(NUM_OSTS, reqs, allocs);
+      computeBwAllocationsTMF(m, allocs);
       break;
 	  case RND:
-      computeBwAllocationsRND(NUM_OSTS, reqs, allocs);
+      computeBwAllocationsRND(m, allocs);
       break;
 	  case MBW:
-      computeBwAllocationsMBW(NUM_OSTS, reqs, allocs);
+      computeBwAllocationsMBW(m, allocs);
       break;
     case GIFT:
-      computeBwAllocationsGIFT(NUM_OSTS, reqs, allocs);
+      computeBwAllocationsGIFT(m, allocs);
+      break;
+    case MMF:
+      computeBwAllocationsMMF(m, allocs);
       break;
   }
 
+  if (cacheable) {
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    this->_allocCache->insert(allocs, elapsed.count());
+  }
+}
+
+// Apply a timer response on top of the set at its base. A response based
+// on a set not held here cannot be applied: the set is dropped and false
+// is returned, so that the OST sends its full set next epoch.
+bool OstReqs_t::apply(const TimerResp_t &resp)
+{
+  if (resp.base != 0 && resp.base != this->seq) {
+    this->seq = 0;
+    this->counts.clear();
+    this->apps.clear();
+    return false;
+  }
+  if (resp.base == 0) {
+    this->counts.clear();
+    this->apps.clear();
+  }
+  for (auto &i : resp.apps) {
+    this->apps[i.id] = i;
+  }
+  for (auto &d : resp.delta) {
+    int &n = this->counts[ReqKey_t(std::get<0>(d), std::get<1>(d))];
+    n += std::get<2>(d);
+    if (n <= 0) {
+      this->counts.erase(ReqKey_t(std::get<0>(d), std::get<1>(d)));
+    }
+  }
+  for (auto a = this->apps.begin(); a != this->apps.end(); ) {
+    auto c = this->counts.lower_bound(ReqKey_t(a->first, (FsRequestType)0));
+    bool active = c != std::end(this->counts) && c->first.first == a->first;
+    a = active ? std::next(a) : this->apps.erase(a);
+  }
+  this->seq = resp.seq;
+  return true;
 }
 
+// An OST whose response cannot be applied still counts as answered, with
+// no requests this epoch, so that the epoch does not wait for it until
+// the deadline
 void LnetMds::addToTimerResponse(const LnetEntity *remote, const LnetMsg *msg)
 {
-  size_t count = 0;
-  size_t offset = 0;
-  msg->extractData(&count, offset);
-  assert(count >= 0);
-  std::vector<ActiveRequest> reqs;
-  for (size_t i = 0; i < count; i++) {
-    ActiveRequest r;
-    msg->extractData(&r, offset);
-    reqs.push_back(r);
-  }
-  this->_ostReqs[remote] = reqs;
-  if (this->_ostReqs.size() == this->_osts.size()) {
-    std::vector<std::vector<int>> out;
-    MapOstToAppAllocs_t allocs;
+  TimerResp_t resp;
+  resp.unpack(msg);
+
+  std::lock_guard<std::mutex> lk(*this->_epochLock);
+  if (!this->_epochOpen || resp.seq != this->_epoch) {
+    std::cerr << "Discarding late timer response for epoch " << resp.seq
+              << " from " << *remote << std::endl;
+    return;
+  }
+  OstReqs_t &reqs = this->_ostReqs[remote];
+  size_t have = reqs.seq;
+  if (!reqs.apply(resp)) {
+    std::cerr << "Timer response of " << *remote << " based on epoch " << resp.base
+              << ", have " << have << "; dropping its requests this epoch" << std::endl;
+  }
+
+  size_t nosts = 0;
+  {
+    std::lock_guard<std::mutex> lk(*this->_ostSendLock);
+    nosts = this->_osts.size();
+  }
+  this->_epochResps.insert(remote);
+  if (this->_epochResps.size() == nosts) {
     std::cerr << "Received timer responses from all OSTs" << std::endl;
-    for (auto s : this->_ostReqs) {
-      std::cerr << "OST: " << s.first->name << std::endl;
-      std::vector<int> apps;
-      for (auto r : s.second) {
-        std::cerr << "\t" << r << std::endl;
-        apps.push_back(r._info.id);
+    this->queueEpoch();
+  }
+}
+
+// An aggregator merges the timer responses of the OSTs below it
+void LnetMds::addToAggTimerResponse(const LnetEntity *remote, const LnetMsg *msg)
+{
+  std::vector<OstMsg_t> resps;
+  unpackOstBatch(msg, TimerResp, resps);
+  for (auto r : resps) {
+    const OstInfo *ost = NULL;
+    {
+      std::lock_guard<std::mutex> lk(*this->_ostSendLock);
+      auto s = std::find_if(this->_osts.begin(), this->_osts.end(),
+                            [&r](const OstInfo *i) { return i->id == r.first; });
+      if (s != std::end(this->_osts)) {
+        ost = *s;
+      }
+    }
+    if (ost) {
+      this->addToTimerResponse(ost, r.second);
+    }
+    delete r.second;
+  }
+}
+
+// Send a Timer for a new epoch to every OST, with the epoch of the last
+// response applied from it. Responses are collected until all the OSTs
+// have answered or closeEpoch() is called at the deadline. Returns the
+// epoch, or 0 if no Timer could be sent.
+size_t LnetMds::startEpoch()
+{
+  {
+    // Notifications received from now on are not covered by this epoch
+    std::lock_guard<std::mutex> lk(*this->_changeLock);
+    this->_changePending = false;
+  }
+
+  std::vector<OstInfo*> osts;
+  {
+    std::lock_guard<std::mutex> lk(*this->_ostSendLock);
+    osts = this->_osts;
+  }
+  if (osts.size() <= 0) return 0;
+
+  size_t seq = 0;
+  std::vector<size_t> acks;
+  {
+    std::lock_guard<std::mutex> lk(*this->_epochLock);
+    seq = ++this->_epoch;
+    this->_epochOpen = true;
+    this->_epochResps.clear();
+    for (auto s : osts) {
+      auto reqs = this->_ostReqs.find(s);
+      acks.push_back(reqs == std::end(this->_ostReqs) ? 0 : reqs->second.seq);
+    }
+  }
+
+  std::cerr << "Sending timer msg to all OSTs" << std::endl;
+  std::vector<OstMsg_t> msgs;
+  for (size_t i = 0; i < osts.size(); i++) {
+    LnetMsg *msg = new LnetMsg(Timer, sizeof(seq) + sizeof(acks[i]));
+    msg->pack(&seq, &acks[i]);
+    msgs.push_back(OstMsg_t(osts[i]->id, msg));
+  }
+  std::set<int> failed;
+  this->sendToOsts(msgs, AggTimer, &failed);
+  for (auto m : msgs) {
+    delete m.second;
+  }
+  if (failed.size() == osts.size()) {
+    std::lock_guard<std::mutex> lk(*this->_epochLock);
+    this->_epochOpen = false;
+    return 0;
+  }
+  if (!failed.empty()) {
+    // An OST without a Timer keeps its last request set this epoch, rather
+    // than holding the epoch open until the deadline
+    std::lock_guard<std::mutex> lk(*this->_epochLock);
+    if (this->_epochOpen && this->_epoch == seq) {
+      for (auto s : osts) {
+        if (failed.count(s->id)) {
+          this->_epochResps.insert(s);
+        }
+      }
+      if (this->_epochResps.size() == osts.size()) {
+        this->queueEpoch();
       }
-      out.push_back(apps);
     }
-    this->computeBwAllocations(GIFT, out, allocs);
-    this->bcastAllocsToOsts(allocs);
-    this->_ostReqs.clear();
+  }
+  return seq;
+}
+
+// Close the epoch at its deadline. OSTs that have not answered are
+// allocated for the request set they reported last.
+void LnetMds::closeEpoch()
+{
+  std::lock_guard<std::mutex> lk(*this->_epochLock);
+  if (this->_epochOpen) {
+    std::cerr << "Epoch " << this->_epoch << " deadline passed with "
+              << this->_epochResps.size() << " timer responses" << std::endl;
+    this->queueEpoch();
+  }
+}
+
+// Hand the open epoch to the allocator thread. Called with _epochLock held.
+void LnetMds::queueEpoch()
+{
+  std::vector<OstInfo*> osts;
+  {
+    std::lock_guard<std::mutex> lk(*this->_ostSendLock);
+    osts = this->_osts;
+  }
+  std::sort(osts.begin(), osts.end(), [](const OstInfo *a, const OstInfo *b) {
+    return a->id < b->id;
+  });
+
+  Epoch_t epoch;
+  epoch.seq = this->_epoch;
+  for (auto s : osts) {
+    const OstReqs_t *reqs = NULL;
+    if (this->_ostReqs.count(s)) {
+      reqs = &this->_ostReqs[s];
+    }
+    if (this->_epochResps.count(s)) {
+      std::cerr << "OST: " << s->name << std::endl;
+    } else if (reqs) {
+      std::cerr << "OST: " << s->name << " (no response, reusing last requests)" << std::endl;
+    } else {
+      std::cerr << "OST: " << s->name << " (no response)" << std::endl;
+    }
+    std::vector<int> apps;
+    if (reqs) {
+      for (auto r : reqs->counts) {
+        std::cerr << "\tAppId: " << r.first.first << "; ReqType: " << r.first.second
+                  << " x" << r.second << std::endl;
+        apps.insert(apps.end(), r.second, r.first.first);
+      }
+    }
+    epoch.ostIds.push_back(s->id);
+    epoch.reqs.push_back(apps);
+  }
+  this->_epochResps.clear();
+  this->_epochOpen = false;
+
+  // Compare the request sets, ignoring their order, with the previous epoch
+  Epoch_t sorted = epoch;
+  for (auto &r : sorted.reqs) {
+    std::sort(r.begin(), r.end());
+  }
+  this->_epochChanged = sorted.ostIds != this->_prevEpoch.ostIds ||
+                        sorted.reqs != this->_prevEpoch.reqs;
+  this->_prevEpoch = std::move(sorted);
+
+  {
+    std::lock_guard<std::mutex> lk(*this->_allocLock);
+    this->_allocQueue.push_back(std::move(epoch));
+  }
+  this->_allocReady->notify_one();
+}
+
+// Called on an OstChange, or when an OST joins or leaves: wake up the timer
+// so that it starts an epoch early
+void LnetMds::requestEpoch()
+{
+  {
+    std::lock_guard<std::mutex> lk(*this->_changeLock);
+    this->_changePending = true;
+  }
+  this->_changeReady->notify_one();
+}
+
+// Wait until an epoch is requested or the given time is reached. Returns
+// true if an epoch was requested.
+bool LnetMds::waitForOstChange(const std::chrono::steady_clock::time_point &until)
+{
+  std::unique_lock<std::mutex> lk(*this->_changeLock);
+  return this->_changeReady->wait_until(lk, until, [=]{ return this->_changePending; });
+}
+
+// Whether the request sets of the last epoch differ from the one before
+bool LnetMds::lastEpochChanged() const
+{
+  std::lock_guard<std::mutex> lk(*this->_epochLock);
+  return this->_epochChanged;
+}
+
+// Body of the allocator thread: solves the epochs queued by the event loop
+// in arrival order and sends the allocations to the OSTs
+void LnetMds::allocLoop()
+{
+  while (true) {
+    Epoch_t epoch;
+    {
+      std::unique_lock<std::mutex> lk(*this->_allocLock);
+      this->_allocReady->wait(lk, [=]{ return this->_allocStop || !this->_allocQueue.empty(); });
+      if (this->_allocStop) {
+        return;
+      }
+      epoch = std::move(this->_allocQueue.front());
+      this->_allocQueue.pop_front();
+    }
+
+    MapOstToAppAllocs_t allocs;
+    this->computeBwAllocations(this->_policy, epoch.reqs, allocs);
+    this->bcastAllocsToOsts(epoch.ostIds, allocs);
     {
       std::lock_guard<std::mutex> lk(*this->_m);
-      *this->_dataIsReady = true;
+      *this->_solvedEpoch = epoch.seq;
     }
     this->_waitForAllOsts->notify_one();
   }
 }
 
-void LnetMds::bcastAllocsToOsts(const MapOstToAppAllocs_t &allocs)
+// Send each OST only the entries of its allocation table that changed
+// since the version it holds. A new OST, or one that asked for a resync,
+// gets the full table.
+void LnetMds::bcastAllocsToOsts(const std::vector<int> &ostIds,
+                                const MapOstToAppAllocs_t &allocs)
 {
+  std::lock_guard<std::mutex> lk(*this->_allocTableLock);
+  std::vector<OstMsg_t> msgs;
   size_t idx = 0;
   for (auto a : allocs) {
-    std::cerr << "OST Allocs: " << idx << std::endl;
-    size_t sz = a.size();
-    LnetMsg msg(Allocs, sizeof (sz) + (sizeof(int) + sizeof(double)) * sz);
-    msg.pack(&sz);
-    std::cerr << "\t Allocs: ";
+    int ostId = ostIds[idx++];
+    std::map<int, double> rates;
     for (auto i : a) {
-      AppAlloc_t d = i;
-      std::cerr << std::get<0>(d) << " -> " << std::get<1>(d) << "; ";
-      msg.pack(&std::get<0>(d));
-      msg.pack(&std::get<1>(d));
+      rates[std::get<0>(i)] = std::get<1>(i);
+    }
+
+    AllocTable_t &table = this->_allocTables[ostId];
+    LnetMsg *msg = table.update(rates);
+    if (!msg) continue;
+
+    std::cerr << "OST Allocs: " << ostId << " v" << table.version << std::endl;
+    std::cerr << "\t Allocs: ";
+    for (auto r : rates) {
+      std::cerr << r.first << " -> " << r.second << "; ";
     }
     std::cerr << std::endl;
-    this->sendMsgToOst(&msg, idx);
-    idx++;
+    msgs.push_back(OstMsg_t(ostId, msg));
+  }
+  std::set<int> failed;
+  this->sendToOsts(msgs, AggAllocs, &failed);
+  for (auto m : msgs) {
+    delete m.second;
+  }
+  // The OST would miss this version: start it over with the full table
+  for (auto id : failed) {
+    this->_allocTables.erase(id);
   }
 }
 
-void LnetMds::onRemoteServerRequest(const LnetEntity *remote)
+// The OST missed a version: send it the whole table it should hold. An
+// aggregator relays the request with the id of the OST.
+void LnetMds::resyncAllocs(const LnetEntity *remote, const LnetMsg *msg)
+{
+  int ostId = -1;
+  if (remote->type == Agg) {
+    msg->unmarshall(&ostId);
+  } else {
+    std::lock_guard<std::mutex> lk(*this->_ostSendLock);
+    auto ost = std::find(this->_osts.begin(), this->_osts.end(), remote);
+    if (ost == std::end(this->_osts)) return;
+    ostId = (*ost)->id;
+  }
+
+  std::lock_guard<std::mutex> lk(*this->_allocTableLock);
+  auto table = this->_allocTables.find(ostId);
+  if (table == std::end(this->_allocTables)) return;
+  std::cerr << "Resyncing allocations of OST " << ostId << " at v"
+            << table->second.version << std::endl;
+  std::vector<OstMsg_t> msgs;
+  msgs.push_back(OstMsg_t(ostId, table->second.resync()));
+  std::set<int> failed;
+  if (!this->sendToOsts(msgs, AggAllocs, &failed)) {
+    // Sent in full with the next allocations instead
+    this->_allocTables.erase(table);
+  }
+  delete msgs[0].second;
+}
+
+void LnetMds::onRemoteServerRequest(const LnetEntity *remote, LnetMsg *msg)
 {
   if (!remote || !remote->sock || !remote->sock->isValid()) return;
 }
@@ -237,13 +724,18 @@ void LnetMds::onRemoteServerRequest(const LnetEntity *remote)
 void LnetMds::sendOstsInfo(const LnetEntity *remote)
 {
   if (!remote || !remote->sock || !remote->sock->isValid()) return;
-  int count = this->_osts.size();
+  std::vector<OstInfo*> osts;
+  {
+    std::lock_guard<std::mutex> lk(*this->_ostSendLock);
+    osts = this->_osts;
+  }
+  int count = osts.size();
   LnetMsg msg(OstList, count * sizeof(OstInfo) + sizeof(int));
   msg.marshall(&count);
-  for (auto s: this->_osts) {
+  for (auto s: osts) {
     msg.marshall(s);
   }
-  remote->sendMsgToRemote(&msg);
+  this->queueMsgToRemote(remote, &msg);
 }
 
 void LnetMds::handleFsRequest(const LnetEntity *remote, const LnetMsg *msg)
@@ -332,11 +824,87 @@ void LnetMds::handleFsRequest(const LnetEntity *remote, const LnetMsg *msg)
   }
 }
 
+// Send the response of an OST back to the OSC the request came from, with
+// the id that OSC gave the request
+void LnetMds::relayFsResponse(LnetMsg *msg)
+{
+  PendingReqs::Req_t req;
+  if (!this->_pendingReqs->take(msg->reqId, req)) {
+    std::cerr << "No pending request " << msg->reqId << " for " << *msg << std::endl;
+    return;
+  }
+  msg->reqId = req.origId;
+  this->queueMsgToRemote(req.origin, msg);
+}
+
+// The OST is gone: fail the requests it has not answered
+void LnetMds::failPendingReqs(const LnetEntity *ost)
+{
+  std::vector<PendingReqs::Req_t> reqs;
+  this->_pendingReqs->takeForTarget(ost, reqs);
+  for (auto r : reqs) {
+    int ret = -1, myerror = EIO;
+    LnetMsg res(FsResponse, sizeof(ret) + sizeof(myerror));
+    res.reqId = r.origId;
+    res.marshall(&ret, &myerror);
+    this->queueMsgToRemote(r.origin, &res);
+  }
+}
+
+// Queue a msg to an OST. Returns without waiting for the OST to read it.
+// The msg is queued under _ostSendLock, so the OST cannot be torn down by
+// onDisconnect() in between.
 ssize_t LnetMds::sendMsgToOst(const LnetMsg *msg, int id) const
 {
-  auto s = std::find_if(_osts.begin(), _osts.end(), [&id](const OstInfo &i) { return i.id == id; } );
+  std::lock_guard<std::mutex> lk(*this->_ostSendLock);
+  auto s = std::find_if(_osts.begin(), _osts.end(), [&id](const OstInfo *i) { return i->id == id; } );
   if (s == std::end(_osts) || !(*s)->sock || !(*s)->sock->isValid()) return -1;
-  return (*s)->sendMsgToRemote(msg);
+  return this->queueMsgToRemote(*s, msg);
+}
+
+ssize_t LnetMds::sendMsgToAgg(const LnetMsg *msg, const LnetEntity *agg) const
+{
+  std::lock_guard<std::mutex> lk(*this->_ostSendLock);
+  auto s = std::find(_aggs.begin(), _aggs.end(), agg);
+  if (s == std::end(_aggs) || !(*s)->sock || !(*s)->sock->isValid()) return -1;
+  return this->queueMsgToRemote(agg, msg);
+}
+
+// Send each msg to its OST: directly, or in one batch msg per aggregator
+// for the OSTs behind one. Returns false if any send failed, with the ids
+// of the OSTs whose msg was not sent in failed.
+bool LnetMds::sendToOsts(const std::vector<OstMsg_t> &msgs, MsgType batch,
+                         std::set<int> *failed)
+{
+  std::map<const LnetEntity*, std::vector<OstMsg_t>> batches;
+  std::vector<OstMsg_t> direct;
+  {
+    std::lock_guard<std::mutex> lk(*this->_ostSendLock);
+    for (auto m : msgs) {
+      auto a = this->_ostAgg.find(m.first);
+      if (a != std::end(this->_ostAgg)) {
+        batches[a->second].push_back(m);
+      } else {
+        direct.push_back(m);
+      }
+    }
+  }
+
+  for (auto m : direct) {
+    if (this->sendMsgToOst(m.second, m.first) < (ssize_t)sizeof(LnetHdr_t)) {
+      failed->insert(m.first);
+    }
+  }
+  for (auto b : batches) {
+    LnetMsg *msg = newOstBatch(batch, b.second);
+    if (this->sendMsgToAgg(msg, b.first) < (ssize_t)sizeof(LnetHdr_t)) {
+      for (auto m : b.second) {
+        failed->insert(m.first);
+      }
+    }
+    delete msg;
+  }
+  return failed->empty();
 }
 
 ssize_t LnetMds::recvMsgFromOst(LnetMsg *msg, int id) const
@@ -348,10 +916,15 @@ ssize_t LnetMds::recvMsgFromOst(LnetMsg *msg, int id) const
 
 bool LnetMds::bcastMsgToOsts(const LnetMsg *msg)
 {
-  if (this->_osts.size() <= 0) return false;
+  std::vector<OstInfo*> osts;
+  {
+    std::lock_guard<std::mutex> lk(*this->_ostSendLock);
+    osts = this->_osts;
+  }
+  if (osts.size() <= 0) return false;
   std::cerr << "Broadcasting timer msg to all OSTs" << std::endl;
-  for (auto s: this->_osts) {
-    if (this->sendMsgToOst(msg, s->id) < (ssize_t)sizeof(*msg)) {
+  for (auto s: osts) {
+    if (this->sendMsgToOst(msg, s->id) < (ssize_t)sizeof(LnetHdr_t)) {
       return false;
     }
   }
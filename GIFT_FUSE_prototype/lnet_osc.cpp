@@ -4,8 +4,10 @@
 #include "lnet.h"
 #include "osc.h"
 
-LnetOsc::LnetOsc(const LSockAddr &addr, int port, const OscInfo *info)
- : _info(info)
+LnetOsc::LnetOsc(const LSockAddr &addr, int port, const OscInfo *info, size_t rpcDepth)
+ : _info(info),
+   _mdsRpc(NULL),
+   _rpcDepth(rpcDepth)
 {
   this->_toMds = new LnetClient(addr, port);
 }
@@ -13,6 +15,7 @@ LnetOsc::LnetOsc(const LSockAddr &addr, int port, const OscInfo *info)
 LnetOsc::~LnetOsc()
 {
   this->_info = NULL;
+  delete this->_mdsRpc;
   delete this->_toMds;
   this->_toOsts.clear();
 }
@@ -22,7 +25,7 @@ bool LnetOsc::pubOscInfoToMds() const
   if (!this->_info) return false;
   LnetMsg msg(AddOsc, sizeof(*this->_info));
   msg.marshall(this->_info);
-  if (this->_toMds->sendMsgToRemote(&msg) < (ssize_t)sizeof(msg)) return false;
+  if (this->_toMds->sendMsgToRemote(&msg) < (ssize_t)sizeof(LnetHdr_t)) return false;
   return true;
 }
 
@@ -54,6 +57,8 @@ bool LnetOsc::connectToOsts(std::vector<OstInfo*> &osts)
     inf->sock = n->getSocket();
     osts.push_back(inf);
   }
+  // From here on, the MDS only answers FsRequests, in any order
+  this->_mdsRpc = new RpcChannel(this->_toMds, this->_rpcDepth);
   return true;
 }
 
@@ -75,4 +80,10 @@ ssize_t LnetOsc::sendMsgToMds(const LnetMsg *msg)
 ssize_t LnetOsc::recvMsgFromMds(LnetMsg *msg)
 {
   return this->_toMds->recvMsgFromRemote(msg);
+}
+
+ssize_t LnetOsc::callMds(const LnetMsg *msg, LnetMsg *res)
+{
+  if (!this->_mdsRpc) return -1;
+  return this->_mdsRpc->call(msg, res);
 }
\ No newline at end of file
@@ -8,7 +8,8 @@
 
 LnetOst::LnetOst(const LSockAddr &addr, int port, const OstInfo *info, DatanetOst *dnet)
   : LnetServer(info->listenport),
-    _info(info)
+    _info(info),
+    _lock(new std::mutex())
 {
   this->_toMds = new LnetClient(addr, port);
   this->_mdsInfo = new MdsInfo();
@@ -16,12 +17,18 @@ LnetOst::LnetOst(const LSockAddr &addr, int port, const OstInfo *info, DatanetOs
   this->_mdsInfo->listenport = port;
   this->_mdsInfo->sock = this->_toMds->getSocket();
   this->_dnet = dnet;
+  this->_changeNotified = false;
+  this->_toAgg = NULL;
+  this->_aggInfo = NULL;
 }
 
 LnetOst::~LnetOst()
 {
+  // No handler may run on the members freed below
+  this->stopEventLoop();
   delete this->_info;
   this->_oscs.clear();
+  delete this->_lock;
 }
 
 bool LnetOst::pubOstInfoToMds()
@@ -34,6 +41,22 @@ bool LnetOst::pubOstInfoToMds()
   return true;
 }
 
+// Register with an aggregator, which then relays the timer and allocation
+// msgs of the MDS. File system requests still come from the MDS directly.
+bool LnetOst::pubOstInfoToAgg(const LSockAddr &addr, int port)
+{
+  this->_toAgg = new LnetClient(addr, port);
+  this->_aggInfo = new MdsInfo();
+  this->_aggInfo->type = Agg;
+  this->_aggInfo->listenport = port;
+  this->_aggInfo->sock = this->_toAgg->getSocket();
+  LnetMsg msg(AddOst, sizeof(*this->_info));
+  memcpy(msg.data, this->_info, sizeof(*this->_info));
+  if (this->_toAgg->sendMsgToRemote(&msg) < 0) return false;
+  this->addRemoteServer(this->_aggInfo);
+  return true;
+}
+
 ssize_t LnetOst::sendMsgToMds(const LnetMsg *msg)
 {
   return this->_toMds->sendMsgToRemote(msg);
@@ -55,11 +78,7 @@ void LnetOst::onConnect()
     remote.close();
     return;
   }
-  remote >> msg;
-  if (msg.extraData && msg.len > 0) {
-    msg.data = malloc(msg.len);
-    remote.readAll(msg.data, msg.len);
-  }
+  readMsg(&remote, &msg);
   switch (msg.t) {
     case AddOsc:
       this->addOsc(remote, (OscInfo*)msg.data);
@@ -73,48 +92,49 @@ void LnetOst::onConnect()
 
 void LnetOst::onDisconnect(const LnetEntity *remote)
 {
-  auto osc = std::find(this->_oscs.begin(), this->_oscs.end(), remote);
-  if (osc != std::end(this->_oscs)) {
-    this->removeClient(remote);
-    std::cerr << (*remote) << " disconnected" << std::endl;
+  {
+    std::lock_guard<std::mutex> lk(*this->_lock);
+    auto osc = std::find(this->_oscs.begin(), this->_oscs.end(), remote);
+    if (osc == std::end(this->_oscs)) return;
     this->_oscs.erase(osc);
   }
+  this->removeClient(remote);
+  std::cerr << (*remote) << " disconnected" << std::endl;
 }
 
-void LnetOst::onClientRequest(const LnetEntity *remote)
+void LnetOst::onClientRequest(const LnetEntity *remote, LnetMsg *msg)
 {
   if (!remote || !remote->sock || !remote->sock->isValid()) return;
-  if (remote->type == Mds) {
-    return this->onRemoteServerRequest(remote);
+  if (remote->type == Mds || remote->type == Agg) {
+    return this->onRemoteServerRequest(remote, msg);
   }
-  LnetMsg msg(Unknown);
-  remote->recvMsgFromRemote(&msg);
-  std::cerr << "received msg " << msg << " from client " << *remote << std::endl;
-  switch (msg.t) {
+  std::cerr << "received msg " << *msg << " from client " << *remote << std::endl;
+  switch (msg->t) {
     default:
-      std::cerr << "Unhandled msg type " << msg.t << std::endl;
+      std::cerr << "Unhandled msg type " << msg->t << std::endl;
       break;
   }
 }
 
-void LnetOst::onRemoteServerRequest(const LnetEntity *remote)
+void LnetOst::onRemoteServerRequest(const LnetEntity *remote, LnetMsg *msg)
 {
   if (!remote || !remote->sock || !remote->sock->isValid()) return;
-  LnetMsg msg(Unknown);
-  remote->recvMsgFromRemote(&msg);
-  std::cerr << "received msg " << msg << " from mds " << *remote << std::endl;
-  switch (msg.t) {
+  std::cerr << "received msg " << *msg << " from mds " << *remote << std::endl;
+  switch (msg->t) {
     case Timer:
-      this->respondToMdsTimer(remote);
+      this->respondToMdsTimer(remote, msg);
       break;
     case Allocs:
-      this->_dnet->setAllocations(remote, &msg);
+      if (!this->_dnet->setAllocations(remote, msg)) {
+        LnetMsg resync(AllocsResync);
+        remote->sendMsgToRemote(&resync);
+      }
       break;
     case FsRequest:
-      this->handleFsRequest(remote, &msg);
+      this->handleFsRequest(remote, msg);
       break;
     default:
-      std::cerr << "Unhandled msg type " << msg.t << std::endl;
+      std::cerr << "Unhandled msg type " << msg->t << std::endl;
       break;
   }
 }
@@ -124,26 +144,51 @@ void LnetOst::addOsc(const LSocket &remote, const OscInfo *info)
   LClientSocket *sock = new LClientSocket(remote.sockfd());
   OscInfo *i = new OscInfo(info);
   i->sock = sock;
-  this->_oscs.push_back(i);
+  {
+    std::lock_guard<std::mutex> lk(*this->_lock);
+    this->_oscs.push_back(i);
+  }
   std::cerr << *i << " connected" << std::endl;
   this->addClient(i);
 }
 
-void LnetOst::respondToMdsTimer(const LnetEntity *remote)
+// Respond with the change of the request set since the epoch the MDS last
+// applied, and the infos of the apps that are new since then. If that set
+// is no longer kept, the whole set is sent, based on the empty set (0).
+void LnetOst::respondToMdsTimer(const LnetEntity *remote, const LnetMsg *timer)
 {
   if (!remote || !remote->sock || !remote->sock->isValid()) return;
 
+  // Echo the epoch so that the MDS can discard a late response
+  size_t seq = 0;
+  size_t ack = 0;
+  timer->unmarshall(&seq, &ack);
+
+  // The Timer may come from the MDS and from an aggregator, on two shards
+  std::lock_guard<std::mutex> lk(*this->_lock);
+
+  // This response carries the current request set, so any later change
+  // needs a new notification
+  this->_changeNotified = false;
+
   std::vector<ActiveRequest> reqs;
   this->_dnet->getActiveRequests(reqs);
-  auto sz = reqs.size();
-  std::cerr << "OST: Responding to MDS timer request with " << sz << " pending reqs." << std::endl;
+  LnetMsg *msg = this->_sentReqs.respond(seq, ack, reqs);
+  remote->sendMsgToRemote(msg);
+  delete msg;
+}
 
-  LnetMsg msg(TimerResp, sizeof(sz) + sz * sizeof(ActiveRequest));
-  msg.marshall(&sz); // First, send the length of vector
-  for (auto i : reqs) {
-    msg.marshall(&i);
+// Ask the MDS for an early epoch when an app starts or stops doing I/O
+// here. At most one notification is outstanding until the next Timer.
+void LnetOst::notifyMdsOfChange(const LnetEntity *remote)
+{
+  std::lock_guard<std::mutex> lk(*this->_lock);
+  if (!this->_dnet->takeActiveAppsChange() || this->_changeNotified) return;
+  if (!remote || !remote->sock || !remote->sock->isValid()) return;
+  LnetMsg msg(OstChange);
+  if (remote->sendMsgToRemote(&msg) > 0) {
+    this->_changeNotified = true;
   }
-  remote->sendMsgToRemote(&msg);
 }
 
 void LnetOst::handleFsRequest(const LnetEntity *remote, const LnetMsg *msg)
@@ -193,6 +238,7 @@ void LnetOst::handleFsRequest(const LnetEntity *remote, const LnetMsg *msg)
       break;
     case Open:
       OstOps::ost_open(this, remote, msg);
+      this->notifyMdsOfChange(remote);
       break;
     case Statfs:
       OstOps::ost_statfs(this, remote, msg);
@@ -202,6 +248,7 @@ void LnetOst::handleFsRequest(const LnetEntity *remote, const LnetMsg *msg)
       break;
     case Release:
       OstOps::ost_release(this, remote, msg);
+      this->notifyMdsOfChange(remote);
       break;
     case Fsync:
       OstOps::ost_fsync(this, remote, msg);
@@ -1,8 +1,11 @@
 #include <cassert>
 #include <cstring>
+#include <fcntl.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <unistd.h>
 
 #include "lsocket.h"
@@ -139,6 +142,9 @@ LSocket::connect(const struct  sockaddr *addr,
       nanosleep(&ts, NULL);
     }
   }
+  if (ret == 0) {
+    enableNoDelay();
+  }
   return ret == 0;
 }
 
@@ -172,11 +178,13 @@ LSocket
 LSocket::accept(struct sockaddr_storage *remoteAddr,
                        socklen_t *remoteLen)
 {
-  if (remoteAddr == NULL || remoteLen == NULL) {
-    return LSocket(::accept(_sockfd, NULL, NULL));
-  } else {
-    return LSocket(::accept(_sockfd, (sockaddr *)remoteAddr, remoteLen));
+  LSocket remote(remoteAddr == NULL || remoteLen == NULL
+                 ? ::accept(_sockfd, NULL, NULL)
+                 : ::accept(_sockfd, (sockaddr *)remoteAddr, remoteLen));
+  if (remote.isValid()) {
+    remote.enableNoDelay();
   }
+  return remote;
 }
 
 void
@@ -189,6 +197,24 @@ LSocket::enablePortReuse()
   }
 }
 
+// Send small msgs right away instead of waiting for the ACK of the
+// previous ones. Fails harmlessly on non-TCP sockets.
+void
+LSocket::enableNoDelay()
+{
+  int one = 1;
+  ::setsockopt(_sockfd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+}
+
+// The *All() calls keep blocking on a non-blocking socket: they wait in
+// poll() for the socket to be ready
+bool
+LSocket::setNonBlocking()
+{
+  int flags = ::fcntl(_sockfd, F_GETFL, 0);
+  return flags != -1 && ::fcntl(_sockfd, F_SETFL, flags | O_NONBLOCK) != -1;
+}
+
 bool
 LSocket::close()
 {
@@ -224,6 +250,24 @@ LSocket::writeAll(const void *buf, size_t len)
   return ::writeAll(_sockfd, buf, len);
 }
 
+ssize_t
+LSocket::readvAll(struct iovec *iov, int iovcnt)
+{
+  return ::readvAll(_sockfd, iov, iovcnt);
+}
+
+ssize_t
+LSocket::writevAll(struct iovec *iov, int iovcnt, int flags)
+{
+  return ::writevAll(_sockfd, iov, iovcnt, flags);
+}
+
+ssize_t
+LSocket::sendfileAll(int fd, off_t offset, size_t len)
+{
+  return ::sendfileAll(_sockfd, fd, offset, len);
+}
+
 bool
 LSocket::isValid() const
 {
@@ -72,9 +72,14 @@ class LSocket
     ssize_t write(const void *buf, size_t len);
     ssize_t readAll(void *buf, size_t len);
     ssize_t writeAll(const void *buf, size_t len);
+    ssize_t readvAll(struct iovec *iov, int iovcnt);
+    ssize_t writevAll(struct iovec *iov, int iovcnt, int flags = 0);
+    ssize_t sendfileAll(int fd, off_t offset, size_t len);
     bool isValid() const;
 
     void enablePortReuse();
+    void enableNoDelay();
+    bool setNonBlocking();
 
     template<typename T>
     LSocket&operator<<(const T &t)
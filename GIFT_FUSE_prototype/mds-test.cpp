@@ -0,0 +1,289 @@
+#define CATCH_CONFIG_MAIN
+
+#include <cstdio>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "catch.hpp"
+
+#include "mds.h"
+
+using namespace std;
+
+TEST_CASE("Test water-filling allocation", "[alloc]")
+{
+  // OST 0: apps 1, 2; OST 1: apps 2, 3, 4
+  vector<vector<int>> reqs = {{1, 2}, {2, 3, 4}};
+  ReqIncidence_t m;
+  m.build(reqs);
+  vector<double> lb(m.numApps(), 0.0), ub(m.numApps(), 1.0);
+  vector<double> obj(m.numApps());
+  for (int a = 0; a < m.numApps(); a++) {
+    obj[a] = -m.appReqs[a];
+  }
+  vector<double> x(m.numApps());
+
+  SECTION("Test max-min fairness on a shared OST", "[waterfill]")
+  {
+    REQUIRE(waterFill(m, lb.data(), ub.data(), x.data()));
+    CHECK(x[m.index.at(2)] == Approx(1.0 / 3));
+    CHECK(x[m.index.at(3)] == Approx(1.0 / 3));
+    CHECK(x[m.index.at(4)] == Approx(1.0 / 3));
+    // App 1 takes what app 2 leaves on OST 0
+    CHECK(x[m.index.at(1)] == Approx(2.0 / 3));
+  }
+
+  SECTION("Test upper bounds", "[waterfill]")
+  {
+    ub[m.index.at(3)] = 0.1;
+    REQUIRE(waterFill(m, lb.data(), ub.data(), x.data()));
+    CHECK(x[m.index.at(3)] == Approx(0.1));
+    CHECK(x[m.index.at(2)] == Approx(0.45));
+    CHECK(x[m.index.at(4)] == Approx(0.45));
+    CHECK(x[m.index.at(1)] == Approx(0.55));
+  }
+
+  SECTION("Test feasible bounds skip the LP", "[waterfill]")
+  {
+    CHECK(maxUtilRates(m, lb.data(), ub.data(), obj.data(), NULL, x.data()) == x.data());
+  }
+
+  SECTION("Test infeasible lower bounds fall back to the LP", "[waterfill]")
+  {
+    lb[m.index.at(1)] = 0.6;
+    lb[m.index.at(2)] = 0.6;
+    CHECK_FALSE(waterFill(m, lb.data(), ub.data(), x.data()));
+#ifdef USE_CLP
+    SplitAllocLp lp(2);
+    const double *rates = maxUtilRates(m, lb.data(), ub.data(), obj.data(), &lp, x.data());
+    CHECK(rates != x.data());
+    CHECK(rates == lp.solve(m, lb.data(), ub.data(), obj.data()));
+#else
+    // Without the LP, the lower bounds are dropped rather than broken
+    const double *rates = maxUtilRates(m, lb.data(), ub.data(), obj.data(), NULL, x.data());
+    REQUIRE(rates == x.data());
+    CHECK(x[m.index.at(1)] == Approx(2.0 / 3));
+    CHECK(x[m.index.at(2)] == Approx(1.0 / 3));
+#endif
+  }
+}
+
+TEST_CASE("Test request incidence split", "[alloc]")
+{
+  // OSTs 0 and 3 share app 2, OSTs 2 and 4 share app 3, OST 1 is idle
+  vector<vector<int>> reqs = {{1, 2}, {}, {3}, {2}, {3, 4, 4}};
+  ReqIncidence_t m;
+  m.build(reqs);
+  vector<ReqIncidence_t> parts;
+  vector<vector<int>> partOsts;
+  m.split(parts, partOsts);
+
+  REQUIRE(parts.size() == 2);
+  CHECK(partOsts == vector<vector<int>>({{0, 3}, {2, 4}}));
+  CHECK(parts[0].apps == vector<int>({1, 2}));
+  CHECK(parts[1].apps == vector<int>({3, 4}));
+  CHECK(parts[1].numOsts == 2);
+  CHECK(parts[1].numReqs(1) == 3);
+  CHECK(parts[1].appReqs[parts[1].index.at(4)] == 2);
+}
+
+TEST_CASE("Test allocation cache", "[alloc]")
+{
+  AllocCache cache(2);
+  vector<vector<int>> a = {{1, 2}}, b = {{3}}, c = {{4}};
+  MapOstToAppAllocs_t allocs;
+  auto solved = [](int app) {
+    return MapOstToAppAllocs_t(1, AppAllocs_t(1, make_tuple(app, 1.0)));
+  };
+
+  REQUIRE_FALSE(cache.lookup(MBW, a, allocs));
+  cache.insert(solved(1), 0.0);
+  REQUIRE_FALSE(cache.lookup(MBW, b, allocs));
+  cache.insert(solved(3), 0.0);
+
+  SECTION("Test hits ignore the order of requests", "[cache]")
+  {
+    REQUIRE(cache.lookup(MBW, {{2, 1}}, allocs));
+    CHECK(allocs == solved(1));
+    CHECK_FALSE(cache.lookup(POFS, a, allocs));
+  }
+
+  SECTION("Test the least recently used entry is evicted", "[cache]")
+  {
+    REQUIRE(cache.lookup(MBW, a, allocs));
+    REQUIRE_FALSE(cache.lookup(MBW, c, allocs));
+    cache.insert(solved(4), 0.0);
+    CHECK(cache.lookup(MBW, a, allocs));
+    CHECK(cache.lookup(MBW, c, allocs));
+    CHECK_FALSE(cache.lookup(MBW, b, allocs));
+  }
+}
+
+TEST_CASE("Test msg copy", "[msg]")
+{
+  LnetMsg dst(Unknown, 4 * LNET_INLINE_SIZE);
+  void *pooled = dst.data;
+  LnetMsg src(Unknown, sizeof(int));
+  int v = 42;
+  src.pack(&v);
+
+  // The pooled payload of dst goes back to the pool, not astray
+  dst.copy(&src);
+  CHECK(dst.data != pooled);
+  CHECK(*(int*)dst.data == 42);
+  void *buf = LnetBufPool::instance()->alloc(4 * LNET_INLINE_SIZE);
+  CHECK(buf == pooled);
+  LnetBufPool::instance()->release(buf);
+
+  dst.copy(&dst);
+  CHECK(*(int*)dst.data == 42);
+}
+
+TEST_CASE("Test allocation table sync", "[allocs]")
+{
+  AllocTable_t mds, ost;
+  map<int, double> changed;
+  auto sendAndApply = [&](const map<int, double> &rates) {
+    LnetMsg *msg = mds.update(rates);
+    bool applied = msg && ost.apply(msg, &changed);
+    delete msg;
+    return applied;
+  };
+
+  REQUIRE(sendAndApply({{1, 0.5}, {2, 0.5}}));
+  CHECK(changed == map<int, double>({{1, 0.5}, {2, 0.5}}));
+  CHECK(ost.rates == mds.rates);
+  CHECK(ost.version == 1);
+
+  SECTION("Test deltas", "[allocs]")
+  {
+    vector<map<int, double>> epochs = {
+      {{1, 0.5}, {2, 0.25}, {3, 0.25}},
+      {{2, 0.25}, {3, 0.75}},
+      {{4, 1.0}},
+      {},
+      {{1, 0.2}, {4, 0.8}},
+    };
+    for (auto &rates : epochs) {
+      changed.clear();
+      REQUIRE(sendAndApply(rates));
+      CHECK(ost.rates == rates);
+      CHECK(ost.version == mds.version);
+    }
+    CHECK(changed == map<int, double>({{1, 0.2}, {4, 0.8}}));
+  }
+
+  SECTION("Test an unchanged table sends nothing", "[allocs]")
+  {
+    LnetMsg *msg = mds.update({{1, 0.5}, {2, 0.5}});
+    CHECK(msg == NULL);
+    CHECK(mds.version == 1);
+  }
+
+  SECTION("Test a missed delta needs a resync", "[allocs]")
+  {
+    delete mds.update({{1, 0.75}, {2, 0.25}}); // lost on the way
+    LnetMsg *msg = mds.update({{2, 0.25}, {3, 0.75}});
+    CHECK_FALSE(ost.apply(msg, &changed));
+    delete msg;
+    CHECK(ost.version == 1);
+    CHECK(ost.rates == map<int, double>({{1, 0.5}, {2, 0.5}}));
+
+    changed.clear();
+    msg = mds.resync();
+    REQUIRE(ost.apply(msg, &changed));
+    delete msg;
+    CHECK(ost.rates == mds.rates);
+    CHECK(ost.version == mds.version);
+    CHECK(changed == map<int, double>({{2, 0.25}, {3, 0.75}}));
+
+    REQUIRE(sendAndApply({{3, 1.0}}));
+    CHECK(ost.rates == mds.rates);
+  }
+}
+
+TEST_CASE("Test request set sync", "[timer]")
+{
+  ReqSetHistory ost;
+  OstReqs_t mds;
+  auto req = [](int id, FsRequestType t) {
+    ActiveRequest r;
+    r._info.id = id;
+    snprintf(r._info.name, sizeof(r._info.name), "app%d", id);
+    r._t = t;
+    return r;
+  };
+  auto countsOf = [](const vector<ActiveRequest> &reqs) {
+    ReqCounts_t counts;
+    for (auto r : reqs) {
+      counts[ReqKey_t(r._info.id, r._t)]++;
+    }
+    return counts;
+  };
+  auto respond = [&](size_t seq, size_t ack, const vector<ActiveRequest> &reqs) {
+    LnetMsg *msg = ost.respond(seq, ack, reqs);
+    TimerResp_t resp;
+    resp.unpack(msg);
+    delete msg;
+    return resp;
+  };
+
+  vector<ActiveRequest> reqs = {req(1, Read), req(1, Read), req(2, Write)};
+  TimerResp_t resp = respond(1, mds.seq, reqs);
+  CHECK(resp.base == 0);
+  REQUIRE(mds.apply(resp));
+  CHECK(mds.counts == countsOf(reqs));
+  CHECK(mds.apps.size() == 2);
+  CHECK(string(mds.apps.at(2).name) == "app2");
+
+  SECTION("Test deltas", "[timer]")
+  {
+    vector<vector<ActiveRequest>> epochs = {
+      {req(1, Read), req(2, Write), req(3, Read)},
+      {req(3, Read), req(3, Write)},
+      {},
+      {req(1, Write)},
+    };
+    size_t seq = 1;
+    for (auto &r : epochs) {
+      resp = respond(++seq, mds.seq, r);
+      CHECK(resp.base == seq - 1);
+      REQUIRE(mds.apply(resp));
+      CHECK(mds.counts == countsOf(r));
+      CHECK(mds.seq == seq);
+    }
+    CHECK(resp.delta.size() == 1);
+    CHECK(mds.apps.size() == 1);
+    CHECK(mds.apps.count(1));
+  }
+
+  SECTION("Test a lost response", "[timer]")
+  {
+    respond(2, mds.seq, {req(2, Write)}); // never reaches the MDS
+    reqs = {req(2, Write), req(4, Read)};
+    resp = respond(3, mds.seq, reqs);
+    CHECK(resp.base == 1);
+    REQUIRE(mds.apply(resp));
+    CHECK(mds.counts == countsOf(reqs));
+  }
+
+  SECTION("Test a response on an unknown base", "[timer]")
+  {
+    respond(2, mds.seq, {req(2, Write)});
+    resp = respond(3, 2, {req(3, Read)});
+    CHECK(resp.base == 2);
+    CHECK_FALSE(mds.apply(resp));
+    CHECK(mds.seq == 0);
+    CHECK(mds.counts.empty());
+    CHECK(mds.apps.empty());
+
+    // The next Timer acknowledges no set, so the OST sends all of it
+    reqs = {req(3, Read), req(5, Write)};
+    resp = respond(4, mds.seq, reqs);
+    CHECK(resp.base == 0);
+    REQUIRE(mds.apply(resp));
+    CHECK(mds.counts == countsOf(reqs));
+    CHECK(mds.apps.size() == 2);
+  }
+}
@@ -1,3 +1,7 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
 #include <thread>
 #include <unistd.h>
@@ -5,14 +9,34 @@
 #include "mds.h"
 
 const int DEFAULT_PORT = 7779;
-const int DEFAULT_TIMER = 10;
+const int DEFAULT_TIMER = 10;      // Epoch period while the request sets change
+const int MAX_TIMER = 80;          // Longest period once they stop changing
+const int MIN_EPOCH_INTERVAL = 1;  // Shortest time between two epochs
+const int DEFAULT_DEADLINE = 2;
+
+// Allocation policy named by $GIFT_ALLOC_POLICY, GIFT by default
+static Policy_t getPolicyFromEnv()
+{
+  static const std::pair<const char *, Policy_t> policies[] = {
+    {"POFS", POFS}, {"BSIP", BSIP}, {"TSA", TSA}, {"ESA", ESA}, {"TMF", TMF},
+    {"RND", RND}, {"MBW", MBW}, {"GIFT", GIFT}, {"MMF", MMF},
+  };
+  const char *name = getenv("GIFT_ALLOC_POLICY");
+  if (!name) return GIFT;
+  for (auto p : policies) {
+    if (strcmp(name, p.first) == 0) return p.second;
+  }
+  std::cerr << "Unknown allocation policy " << name << ", using GIFT" << std::endl;
+  return GIFT;
+}
 
 MDS::MDS(int port)
 {
   this->m = new std::mutex();
   this->waitForAllOsts = new std::condition_variable();
-  this->dataIsReady = false;
-  this->_mdsNet = new LnetMds(port, this->m, this->waitForAllOsts, &this->dataIsReady);
+  this->solvedEpoch = 0;
+  this->_mdsNet = new LnetMds(port, this->m, this->waitForAllOsts, &this->solvedEpoch,
+                              getPolicyFromEnv());
 }
 
 MDS::~MDS()
@@ -21,7 +45,6 @@ MDS::~MDS()
   delete this->_mdsNet;
   delete this->m;
   delete this->waitForAllOsts;
-  this->dataIsReady = false;
 }
 
 void MDS::eventLoop()
@@ -35,16 +58,36 @@ void MDS::eventLoop()
 
 void MDS::startTimer()
 {
+  using Clock = std::chrono::steady_clock;
+  std::chrono::seconds period(DEFAULT_TIMER);
+  Clock::time_point lastEpoch = Clock::now();
   while (true) {
-    ::sleep(DEFAULT_TIMER);
-    LnetMsg msg(Timer);
-    if (this->_mdsNet->bcastMsgToOsts(&msg)) {
-      // The timer msg has been broadcasted to all the OSTs. Now, refrain
-      // from restarting the timer and sending another set of timer msgs
-      // until all the OSTs have responded in this phase and have been
-      // responded to.
+    // Sleep for the period, or until an OST reports that an app started or
+    // stopped doing I/O. Notifications that arrive close together are
+    // coalesced into one epoch by the minimum interval.
+    if (this->_mdsNet->waitForOstChange(lastEpoch + period)) {
+      std::this_thread::sleep_until(lastEpoch + std::chrono::seconds(MIN_EPOCH_INTERVAL));
+    }
+    lastEpoch = Clock::now();
+    size_t seq = this->_mdsNet->startEpoch();
+    if (seq > 0) {
+      // The timer msg has been broadcasted to all the OSTs. Wait until all
+      // of them have responded and have been responded to, but no longer
+      // than the deadline: a slow OST must not hold back the others. The
+      // solve of an earlier epoch that closed at its deadline may still
+      // finish meanwhile, so only this epoch's counts.
       std::unique_lock<std::mutex> lk(*this->m);
-      this->waitForAllOsts->wait(lk, [=]{ return this->dataIsReady; });
+      if (!this->waitForAllOsts->wait_for(lk, std::chrono::seconds(DEFAULT_DEADLINE),
+                                          [=]{ return this->solvedEpoch >= seq; })) {
+        lk.unlock();
+        this->_mdsNet->closeEpoch();
+      }
+    }
+    // Back off while nothing changes: idle periods need no new solves
+    if (this->_mdsNet->lastEpochChanged()) {
+      period = std::chrono::seconds(DEFAULT_TIMER);
+    } else {
+      period = std::min(period * 2, std::chrono::seconds(MAX_TIMER));
     }
   }
 }
@@ -2,8 +2,15 @@
 #define _MDS_H_
 
 #include <vector>
+#include <deque>
+#include <functional>
+#include <list>
+#include <set>
+#include <chrono>
 #include <mutex>
+#include <thread>
 #include <tuple>
+#include <unordered_map>
 #include <condition_variable>
 
 #include "lnet.h"
@@ -16,7 +23,8 @@ enum Policy_t {
   TMF,
   RND,
   MBW,
-  GIFT
+  GIFT,
+  MMF
 };
 
 using Coupon_t = std::tuple<double, int>;
@@ -35,65 +43,252 @@ using AppAlloc_t          = std::tuple<int , double>;
 using AppAllocs_t         = std::vector<AppAlloc_t>;
 using MapOstToAppAllocs_t = std::vector<AppAllocs_t>;
 
+// Sparse app <-> OST incidence of one epoch's requests, built once per
+// epoch and shared by all the policies. App ids are interned into dense
+// indices [0, numApps()) in ascending id order. The per-OST request lists
+// are kept in arrival order (reqStart/reqApp), and the distinct (OST, app)
+// cells with their request counts are kept both OST-major and app-major.
+struct ReqIncidence_t {
+  size_t numOsts;
+  std::vector<int> apps;                     // dense index -> app id
+  std::unordered_map<int, int> index;        // app id -> dense index
+  std::vector<int> reqStart, reqApp;         // per-OST requests
+  std::vector<int> ostStart, ostApp, ostCnt; // OST-major cells
+  std::vector<int> appStart, appOst, appCnt; // app-major cells
+  std::vector<int> appReqs;                  // total requests of each app
+
+  void build(const std::vector<std::vector<int>> &reqs);
+  void split(std::vector<ReqIncidence_t> &parts,
+             std::vector<std::vector<int>> &partOsts) const;
+  int numApps() const { return (int)apps.size(); }
+  int numReqs(size_t ost) const { return reqStart[ost + 1] - reqStart[ost]; }
+};
+
+#ifdef USE_CLP
+class ClpSimplex;
+
+// Allocation LP kept across timer epochs (GIFT, MBW). Rows are OSTs, with
+// row capacities of 1, and columns are apps. Each epoch only the rows,
+// columns and coefficients that changed are patched in place, and the
+// solve warm-starts from the previous basis.
+class AllocLp
+{
+  private:
+    ClpSimplex *_model;
+    std::vector<int> _colApp;                                // column -> app id
+    std::unordered_map<int, int> _appCol;                    // app id -> column
+    std::vector<std::vector<std::pair<int, int>>> _colCells; // column -> (OST, count)
+    std::vector<double> _val;                                // dense app index -> value
+
+    void load(const ReqIncidence_t &, const double *, const double *, const double *);
+    bool update(const ReqIncidence_t &, const double *, const double *, const double *);
+
+  public:
+    AllocLp();
+    ~AllocLp();
+    const double *solve(const ReqIncidence_t &, const double *collb,
+                        const double *colub, const double *obj);
+    double getObjValue() const;
+};
+
+// Allocation LP split into the connected components of the app/OST graph.
+// Components share no rows or columns, so each keeps its own AllocLp, keyed
+// by its lowest OST, and the components are solved on a pool of threads
+// that lives as long as the LP. The thread calling solve() also takes
+// components from the queue.
+class SplitAllocLp
+{
+  private:
+    std::map<int, AllocLp*> _parts;
+    std::vector<double> _val;
+    double _objValue;
+    std::vector<std::thread> _workers;
+    std::mutex *_lock;
+    std::condition_variable *_workReady;
+    std::condition_variable *_workDone;
+    std::deque<size_t> _queue;                // components left to solve
+    std::function<void(size_t )> _solvePart; // solves one component
+    size_t _pending;                          // components not solved yet
+    bool _stop;
+
+    bool solveNext(std::unique_lock<std::mutex> &);
+    void workerLoop();
+
+  public:
+    SplitAllocLp(unsigned numThreads);
+    ~SplitAllocLp();
+    const double *solve(const ReqIncidence_t &, const double *collb,
+                        const double *colub, const double *obj);
+    double getObjValue() const;
+};
+#else
+class SplitAllocLp;
+#endif // ifdef USE_CLP
+
+bool waterFill(const ReqIncidence_t &, const double *lb, const double *ub, double *x);
+const double *maxUtilRates(const ReqIncidence_t &, const double *lb, const double *ub,
+                           const double *obj, SplitAllocLp *lp, double *x);
+
+// LRU cache of the allocations of the stateless policies, keyed by the
+// policy and the request set of every OST with each OST's apps sorted.
+// A lookup() that misses keeps the key for the insert() that follows the
+// solve, along with the utilization samples the solve records, so that a
+// later hit can replay them.
+class AllocCache
+{
+  private:
+    struct Entry_t {
+      size_t hash;
+      Policy_t policy;
+      std::vector<std::vector<int>> reqs;
+      MapOstToAppAllocs_t allocs;
+      std::vector<double> util;
+      double solveTime;
+    };
+    size_t _capacity;
+    std::list<Entry_t> _lru; // most recently used first
+    std::unordered_multimap<size_t, std::list<Entry_t>::iterator> _index;
+    Entry_t _miss;
+    size_t _missUtil;
+    size_t _hits;
+    size_t _misses;
+    double _savedTime;
+
+  public:
+    AllocCache(size_t capacity);
+    bool lookup(Policy_t, const std::vector<std::vector<int>> &, MapOstToAppAllocs_t &);
+    void insert(const MapOstToAppAllocs_t &, double solveTime);
+    void printStats() const;
+};
+
+// Metadata requests relayed to an OST and not answered yet. The OST echoes
+// the id the MDS gave the request, which maps back to the OSC that sent
+// it and the id that OSC gave it, so an OSC can have many in flight.
+class PendingReqs
+{
+  public:
+    struct Req_t {
+      const LnetEntity *origin; // OSC the response goes back to
+      uint64_t origId;          // id given by the OSC
+      const LnetEntity *target; // OST the request was relayed to
+    };
+
+  private:
+    std::mutex *_lock;
+    uint64_t _nextId;
+    std::map<uint64_t, Req_t> _reqs;
+
+  public:
+    PendingReqs();
+    ~PendingReqs();
+    uint64_t add(const LnetEntity *origin, uint64_t origId, const LnetEntity *target);
+    bool take(uint64_t id, Req_t &req);
+    void dropOrigin(const LnetEntity *origin);
+    void takeForTarget(const LnetEntity *target, std::vector<Req_t> &reqs);
+};
+
+// Request set of an OST, kept up to date from its incremental timer
+// responses
+struct OstReqs_t {
+  size_t seq;                  // epoch of the last response applied
+  ReqCounts_t counts;
+  std::map<int, AppInfo> apps; // app id -> info, for the apps in counts
+
+  OstReqs_t() : seq(0) {}
+  bool apply(const TimerResp_t &resp);
+};
+
+// One timer epoch: the request set of each OST, in the order of ostIds
+struct Epoch_t {
+  size_t seq;
+  std::vector<int> ostIds;
+  std::vector<std::vector<int>> reqs;
+};
+
 class LnetMds: public LnetServer
 {
   private:
     std::vector<OscInfo*> _oscs;
     std::vector<OstInfo*> _osts;
     std::map<std::string, OstInfo*> _dirToOst;
-    std::map<const LnetEntity* , std::vector<ActiveRequest>> _ostReqs;
+    std::vector<AggInfo*> _aggs;
+    std::map<int, const LnetEntity*> _ostAgg; // OST id -> aggregator relaying to it
+    std::map<const LnetEntity* , OstReqs_t> _ostReqs;
+    std::set<const LnetEntity*> _epochResps; // OSTs that answered this epoch
     std::mutex *_m;
     std::condition_variable *_waitForAllOsts;
-    bool *_dataIsReady;
+    size_t *_solvedEpoch; // last epoch whose allocations were sent
+    std::mutex *_epochLock;
+    size_t _epoch;
+    bool _epochOpen;
+    bool _epochChanged;
+    Epoch_t _prevEpoch;
+    std::mutex *_ostSendLock; // guards the peers, _dirToOst and _ostAgg
+    std::mutex *_allocLock;
+    std::condition_variable *_allocReady;
+    std::deque<Epoch_t> _allocQueue;
+    bool _allocStop;
+    std::thread *_allocThread;
+    Policy_t _policy;
+    AllocCache *_allocCache;
+    std::mutex *_allocTableLock;
+    std::map<int, AllocTable_t> _allocTables; // OST id -> table last sent
+    std::mutex *_changeLock;
+    std::condition_variable *_changeReady;
+    bool _changePending;
+    PendingReqs *_pendingReqs;
+    SplitAllocLp *_giftLp; // NULL without USE_CLP
+    SplitAllocLp *_mbwLp;
 
     void addOsc(const LSocket &remote, const OscInfo *info);
     void addOst(const LSocket &remote, const OstInfo *info);
+    void addAgg(const LSocket &remote, const AggInfo *info);
+    void setAggOsts(const LnetEntity *remote, const LnetMsg *msg);
+    void addToAggTimerResponse(const LnetEntity *remote, const LnetMsg *msg);
+    ssize_t sendMsgToAgg(const LnetMsg *msg, const LnetEntity *agg) const;
+    bool sendToOsts(const std::vector<OstMsg_t> &msgs, MsgType batch, std::set<int> *failed);
     void sendOstsInfo(const LnetEntity *remote);
     void handleFsRequest(const LnetEntity *remote, const LnetMsg *msg);
+    void relayFsResponse(LnetMsg *msg);
+    void failPendingReqs(const LnetEntity *ost);
     const OstInfo *getOstFromPath(const std::string *path) const;
     void addToTimerResponse(const LnetEntity *remote, const LnetMsg *msg);
     void computeBwAllocations(Policy_t , const std::vector<std::vector<int>> &,
                               MapOstToAppAllocs_t &);
-    void bcastAllocsToOsts(const MapOstToAppAllocs_t &);
-
-    void computeBwAllocationsGIFT(const size_t ,
-                                  const std::vector<std::vector<int>> &,
-                                  MapOstToAppAllocs_t &);
-    void computeBwAllocationsBSIP(const size_t ,
-                                  const std::vector<std::vector<int>> &,
-                                  MapOstToAppAllocs_t &);
-    void computeBwAllocationsPOFS(const size_t ,
-                                  const std::vector<std::vector<int>> &,
-                                  MapOstToAppAllocs_t &);
-    void computeBwAllocationsTSA(const size_t ,
-                                 const std::vector<std::vector<int>> &,
-                                 MapOstToAppAllocs_t &);
-    void computeBwAllocationsESA(const size_t ,
-                                 const std::vector<std::vector<int>> &,
-                                 MapOstToAppAllocs_t &);
-    void computeBwAllocationsTMF(const size_t ,
-                                 const std::vector<std::vector<int>> &,
-                                 MapOstToAppAllocs_t &);
-    void computeBwAllocationsRND(const size_t ,
-                                 const std::vector<std::vector<int>> &,
-                                 MapOstToAppAllocs_t &);
-    void computeBwAllocationsMBW(const size_t ,
-                                 const std::vector<std::vector<int>> &,
-                                 MapOstToAppAllocs_t &);
+    void bcastAllocsToOsts(const std::vector<int> &, const MapOstToAppAllocs_t &);
+    void resyncAllocs(const LnetEntity *remote, const LnetMsg *msg);
+    void queueEpoch();
+    void allocLoop();
+    void requestEpoch();
+
+    void computeBwAllocationsGIFT(const ReqIncidence_t &, MapOstToAppAllocs_t &);
+    void computeBwAllocationsBSIP(const ReqIncidence_t &, MapOstToAppAllocs_t &);
+    void computeBwAllocationsPOFS(const ReqIncidence_t &, MapOstToAppAllocs_t &);
+    void computeBwAllocationsTSA(const ReqIncidence_t &, MapOstToAppAllocs_t &);
+    void computeBwAllocationsESA(const ReqIncidence_t &, MapOstToAppAllocs_t &);
+    void computeBwAllocationsTMF(const ReqIncidence_t &, MapOstToAppAllocs_t &);
+    void computeBwAllocationsRND(const ReqIncidence_t &, MapOstToAppAllocs_t &);
+    void computeBwAllocationsMBW(const ReqIncidence_t &, MapOstToAppAllocs_t &);
+    void computeBwAllocationsMMF(const ReqIncidence_t &, MapOstToAppAllocs_t &);
     double getEffectiveSysBw();
 
   protected:
     virtual void onConnect();
     virtual void onDisconnect(const LnetEntity *);
-    virtual void onClientRequest(const LnetEntity *);
-    virtual void onRemoteServerRequest(const LnetEntity *);
+    virtual void onClientRequest(const LnetEntity *, LnetMsg *);
+    virtual void onRemoteServerRequest(const LnetEntity *, LnetMsg *);
 
   public:
-    LnetMds(int port, std::mutex *m, std::condition_variable *cv, bool *b);
+    LnetMds(int port, std::mutex *m, std::condition_variable *cv, size_t *solved,
+            Policy_t policy = GIFT);
     ~LnetMds();
     ssize_t sendMsgToOst(const LnetMsg *msg, int id) const;
     ssize_t recvMsgFromOst(LnetMsg *msg, int id) const;
     bool bcastMsgToOsts(const LnetMsg *msg);
+    size_t startEpoch();
+    void closeEpoch();
+    bool waitForOstChange(const std::chrono::steady_clock::time_point &);
+    bool lastEpochChanged() const;
     void printStats();
   
   friend class MdsOps;
@@ -140,7 +335,7 @@ class MDS
     LnetMds *_mdsNet;
     std::mutex *m;
     std::condition_variable *waitForAllOsts;
-    bool dataIsReady;
+    size_t solvedEpoch;
 
   public:
     // constructor(s)
@@ -19,13 +19,29 @@ void MdsOps::mds_commonepilog(const LnetMds *lmds, const LnetEntity *remote, con
 {
   const OstInfo *s = lmds->getOstFromPath(&dname);
   if (s) {
-    lmds->sendMsgToOst(msg, s->id);
+    // Relay under an id of the MDS; the response is matched back with it
+    uint64_t id = lmds->_pendingReqs->add(remote, msg->reqId, s);
+    LnetMsg fwd;
+    fwd.copy(msg);
+    fwd.reqId = id;
+    ssize_t sent = lmds->sendMsgToOst(&fwd, s->id);
+    fwd.clear(); // The data belongs to msg
+    PendingReqs::Req_t req;
+    if (sent < 0 && lmds->_pendingReqs->take(id, req)) {
+      std::cerr << "mds: [ERROR]: Could not relay request to OST: " << *s << std::endl;
+      int ret = -1, myerror = EIO;
+      LnetMsg res(FsResponse, sizeof(ret) + sizeof(myerror));
+      res.reqId = msg->reqId;
+      res.marshall(&ret, &myerror);
+      lmds->queueMsgToRemote(remote, &res);
+    }
   } else {
     std::cerr << "mds: [ERROR]: No OST corresponding to path: " << dname << std::endl;
     int ret = -1, myerror = -ENOENT;
     LnetMsg res(FsResponse);
+    res.reqId = msg->reqId;
     res.marshall(&ret, &myerror);
-    remote->sendMsgToRemote(&res);
+    lmds->queueMsgToRemote(remote, &res);
   }
 }
 
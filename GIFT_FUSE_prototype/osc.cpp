@@ -2,6 +2,7 @@
 #include "params.h"
 
 #include <cassert>
+#include <cstdlib>
 #include <cstring>
 #include <fuse.h>
 #include <iostream>
@@ -19,14 +20,30 @@
 
 using namespace std;
 
+const size_t DEFAULT_RPC_DEPTH = 32;
+
+// Requests each connection can have in flight, from GIFT_RPC_DEPTH
+static size_t getRpcDepthFromEnv()
+{
+  const char *depth = getenv("GIFT_RPC_DEPTH");
+  if (!depth) return DEFAULT_RPC_DEPTH;
+  int d = atoi(depth);
+  if (d <= 0) {
+    cerr << "Invalid RPC depth " << depth << ", using " << DEFAULT_RPC_DEPTH << endl;
+    return DEFAULT_RPC_DEPTH;
+  }
+  return d;
+}
+
 OSC::OSC(const LSockAddr &addr, int port, int id, const char *name)
 {
   this->_info = new OscInfo();
   this->_info->id = id;
   strncpy(this->_info->name, name, sizeof(this->_info->name));
   ::gethostname(this->_info->hostname, sizeof(this->_info->hostname));
-  this->_oscNet = new LnetOsc(addr, port, this->_info);
-  this->_dataNet = new DatanetOsc(this->_info);
+  size_t rpcDepth = getRpcDepthFromEnv();
+  this->_oscNet = new LnetOsc(addr, port, this->_info, rpcDepth);
+  this->_dataNet = new DatanetOsc(this->_info, rpcDepth);
   this->_mdsConnected = this->_oscNet->pubOscInfoToMds();
 }
 
@@ -104,6 +121,17 @@ ssize_t OSC::recvDatanetMsgFromOst(LnetMsg *msg, int id)
   return this->_dataNet->recvMsgFromOst(id, msg);
 }
 
+ssize_t OSC::callMds(const LnetMsg *msg, LnetMsg *res)
+{
+  return this->_oscNet->callMds(msg, res);
+}
+
+ssize_t OSC::callOst(int id, const LnetMsg *msg, LnetMsg *res,
+                     const void *out, size_t outLen, void *in, size_t inLen)
+{
+  return this->_dataNet->callOst(id, msg, res, out, outLen, in, inLen);
+}
+
 const OstInfo*
 OSC::getOstFromPath(const char *path) const
 {
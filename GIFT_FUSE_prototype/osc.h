@@ -13,10 +13,12 @@ class LnetOsc
   private:
     const OscInfo *_info;
     LnetClient *_toMds;
+    RpcChannel *_mdsRpc;
+    size_t _rpcDepth;
     std::vector<LnetClient*> _toOsts;
 
   public:
-    LnetOsc(const LSockAddr &, int , const OscInfo *);
+    LnetOsc(const LSockAddr &, int , const OscInfo *, size_t rpcDepth);
     ~LnetOsc();
     bool pubOscInfoToMds() const;
     bool pubOscInfoToOst(const LnetClient *) const;
@@ -25,6 +27,7 @@ class LnetOsc
     ssize_t recvMsgFromOst(LnetMsg *, int );
     ssize_t sendMsgToMds(const LnetMsg *);
     ssize_t recvMsgFromMds(LnetMsg *);
+    ssize_t callMds(const LnetMsg *, LnetMsg *);
 };
 
 class OSC
@@ -57,6 +60,9 @@ class OSC
     ssize_t recvMsgFromOst(LnetMsg *msg, int id);
     ssize_t sendDatanetMsgToOst(const LnetMsg *msg, int id);
     ssize_t recvDatanetMsgFromOst(LnetMsg *msg, int id);
+    ssize_t callMds(const LnetMsg *msg, LnetMsg *res);
+    ssize_t callOst(int id, const LnetMsg *msg, LnetMsg *res,
+                    const void *out, size_t outLen, void *in, size_t inLen);
     const OstInfo *getOstFromPath(const char *path) const;
     const std::vector<OstInfo*>& getOsts() { return this->_osts; }
     void insertFdToApp(int , AppInfo );
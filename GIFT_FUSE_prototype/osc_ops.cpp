@@ -161,11 +161,9 @@ lemu_getattr(const char *path, struct stat *statbuf)
   LnetMsg msg(FsRequest, Getattr, strlen(fpath) + 1);
   msg.marshall(fpath);
   LnetMsg res(Unknown);
-  if (LEMU_DATA->osc->sendMsgToMds(&msg)) {
-    if (LEMU_DATA->osc->recvMsgFromMds(&res)) {
-      assert(res.t == FsResponse);
-      res.unmarshall(&retstat, &errno, statbuf);
-    }
+  if (LEMU_DATA->osc->callMds(&msg, &res) > 0) {
+    assert(res.t == FsResponse);
+    res.unmarshall(&retstat, &errno, statbuf);
   }
 
   retstat = log_syscall("lstat", retstat, 0);
@@ -202,11 +200,9 @@ lemu_readlink(const char *path, char *link, size_t size)
   LnetMsg res(Unknown);
   BufType mybuf = {.sz = size, .databuf = link};
   auto ret = 0;
-  if (LEMU_DATA->osc->sendMsgToMds(&msg)) {
-    if (LEMU_DATA->osc->recvMsgFromMds(&res)) {
-      assert(res.t == FsResponse);
-      res.unmarshall(&ret, &errno, &mybuf);
-    }
+  if (LEMU_DATA->osc->callMds(&msg, &res) > 0) {
+    assert(res.t == FsResponse);
+    res.unmarshall(&ret, &errno, &mybuf);
   }
 
   retstat = log_syscall("readlink", ret, 0);
@@ -239,11 +235,9 @@ lemu_mknod(const char *path, mode_t mode, dev_t dev)
   msg.marshall(&mode, &dev, fpath);
   LnetMsg res(Unknown);
   auto ret = 0;
-  if (LEMU_DATA->osc->sendMsgToMds(&msg)) {
-    if (LEMU_DATA->osc->recvMsgFromMds(&res)) {
-      assert(res.t == FsResponse);
-      res.unmarshall(&ret, &errno);
-    }
+  if (LEMU_DATA->osc->callMds(&msg, &res) > 0) {
+    assert(res.t == FsResponse);
+    res.unmarshall(&ret, &errno);
   }
 
   retstat = log_syscall("mknod", ret, 0);
@@ -265,11 +259,9 @@ lemu_mkdir(const char *path, mode_t mode)
   msg.marshall(&mode, fpath);
   LnetMsg res(Unknown);
   auto ret = 0;
-  if (LEMU_DATA->osc->sendMsgToMds(&msg)) {
-    if (LEMU_DATA->osc->recvMsgFromMds(&res)) {
-      assert(res.t == FsResponse);
-      res.unmarshall(&ret, &errno);
-    }
+  if (LEMU_DATA->osc->callMds(&msg, &res) > 0) {
+    assert(res.t == FsResponse);
+    res.unmarshall(&ret, &errno);
   }
 
   return log_syscall("mkdir", ret, 0); // mkdir(fpath, mode), 0);
@@ -289,11 +281,9 @@ lemu_unlink(const char *path)
   msg.marshall(fpath);
   LnetMsg res(Unknown);
   auto ret = 0;
-  if (LEMU_DATA->osc->sendMsgToMds(&msg)) {
-    if (LEMU_DATA->osc->recvMsgFromMds(&res)) {
-      assert(res.t == FsResponse);
-      res.unmarshall(&ret, &errno);
-    }
+  if (LEMU_DATA->osc->callMds(&msg, &res) > 0) {
+    assert(res.t == FsResponse);
+    res.unmarshall(&ret, &errno);
   }
 
   return log_syscall("unlink", ret, 0);
@@ -313,11 +303,9 @@ lemu_rmdir(const char *path)
   msg.marshall(fpath);
   LnetMsg res(Unknown);
   auto ret = 0;
-  if (LEMU_DATA->osc->sendMsgToMds(&msg)) {
-    if (LEMU_DATA->osc->recvMsgFromMds(&res)) {
-      assert(res.t == FsResponse);
-      res.unmarshall(&ret, &errno);
-    }
+  if (LEMU_DATA->osc->callMds(&msg, &res) > 0) {
+    assert(res.t == FsResponse);
+    res.unmarshall(&ret, &errno);
   }
 
   return log_syscall("rmdir", ret, 0);
@@ -346,11 +334,9 @@ lemu_symlink(const char *path, const char *link)
   msg.marshall(&fname, &lname);
   LnetMsg res(Unknown);
   auto ret = 0;
-  if (LEMU_DATA->osc->sendMsgToMds(&msg)) {
-    if (LEMU_DATA->osc->recvMsgFromMds(&res)) {
-      assert(res.t == FsResponse);
-      res.unmarshall(&ret, &errno);
-    }
+  if (LEMU_DATA->osc->callMds(&msg, &res) > 0) {
+    assert(res.t == FsResponse);
+    res.unmarshall(&ret, &errno);
   }
 
   return log_syscall("symlink", ret, 0);
@@ -378,11 +364,9 @@ lemu_rename(const char *path, const char *newpath)
   msg.marshall(&fname, &lname);
   LnetMsg res(Unknown);
   auto ret = 0;
-  if (LEMU_DATA->osc->sendMsgToMds(&msg)) {
-    if (LEMU_DATA->osc->recvMsgFromMds(&res)) {
-      assert(res.t == FsResponse);
-      res.unmarshall(&ret, &errno);
-    }
+  if (LEMU_DATA->osc->callMds(&msg, &res) > 0) {
+    assert(res.t == FsResponse);
+    res.unmarshall(&ret, &errno);
   }
 
   return log_syscall("rename", ret, 0);
@@ -408,11 +392,9 @@ lemu_link(const char *path, const char *newpath)
   msg.marshall(&fname, &lname);
   LnetMsg res(Unknown);
   auto ret = 0;
-  if (LEMU_DATA->osc->sendMsgToMds(&msg)) {
-    if (LEMU_DATA->osc->recvMsgFromMds(&res)) {
-      assert(res.t == FsResponse);
-      res.unmarshall(&ret, &errno);
-    }
+  if (LEMU_DATA->osc->callMds(&msg, &res) > 0) {
+    assert(res.t == FsResponse);
+    res.unmarshall(&ret, &errno);
   }
 
   return log_syscall("link", ret, 0);
@@ -432,11 +414,9 @@ lemu_chmod(const char *path, mode_t mode)
   msg.marshall(&mode, fpath);
   LnetMsg res(Unknown);
   auto ret = 0;
-  if (LEMU_DATA->osc->sendMsgToMds(&msg)) {
-    if (LEMU_DATA->osc->recvMsgFromMds(&res)) {
-      assert(res.t == FsResponse);
-      res.unmarshall(&ret, &errno);
-    }
+  if (LEMU_DATA->osc->callMds(&msg, &res) > 0) {
+    assert(res.t == FsResponse);
+    res.unmarshall(&ret, &errno);
   }
 
   return log_syscall("chmod", ret, 0);
@@ -457,11 +437,9 @@ lemu_chown(const char *path, uid_t uid, gid_t gid)
   msg.marshall(&uid, &gid, fpath);
   LnetMsg res(Unknown);
   auto ret = 0;
-  if (LEMU_DATA->osc->sendMsgToMds(&msg)) {
-    if (LEMU_DATA->osc->recvMsgFromMds(&res)) {
-      assert(res.t == FsResponse);
-      res.unmarshall(&ret, &errno);
-    }
+  if (LEMU_DATA->osc->callMds(&msg, &res) > 0) {
+    assert(res.t == FsResponse);
+    res.unmarshall(&ret, &errno);
   }
 
   return log_syscall("chown", ret, 0);
@@ -481,11 +459,9 @@ lemu_truncate(const char *path, off_t newsize)
   msg.marshall(&newsize, fpath);
   LnetMsg res(Unknown);
   auto ret = 0;
-  if (LEMU_DATA->osc->sendMsgToMds(&msg)) {
-    if (LEMU_DATA->osc->recvMsgFromMds(&res)) {
-      assert(res.t == FsResponse);
-      res.unmarshall(&ret, &errno);
-    }
+  if (LEMU_DATA->osc->callMds(&msg, &res) > 0) {
+    assert(res.t == FsResponse);
+    res.unmarshall(&ret, &errno);
   }
 
   return log_syscall("truncate", ret, 0);
@@ -506,11 +482,9 @@ lemu_utime(const char *path, struct utimbuf *ubuf)
   msg.marshall(fpath);
   LnetMsg res(Unknown);
   auto ret = 0;
-  if (LEMU_DATA->osc->sendMsgToMds(&msg)) {
-    if (LEMU_DATA->osc->recvMsgFromMds(&res)) {
-      assert(res.t == FsResponse);
-      res.unmarshall(&ret, &errno, ubuf);
-    }
+  if (LEMU_DATA->osc->callMds(&msg, &res) > 0) {
+    assert(res.t == FsResponse);
+    res.unmarshall(&ret, &errno, ubuf);
   }
 
   return log_syscall("utime", ret, 0);
@@ -554,20 +528,20 @@ getenvByPid(const char *env, char *val, size_t len, pid_t pid)
 }
 
 void
-setAppInfo(LnetMsg *msg)
+setAppInfo(AppInfo *i)
 {
   fuse_context *ctx = fuse_get_context();
   if (ctx) {
     char val[60] = {0};
     char *ptr = getenvByPid("APP_ID", val, sizeof val, ctx->pid);
     if (ptr) {
-      msg->_i.id = atoi(ptr);
+      i->id = atoi(ptr);
     }
     ptr = getenvByPid("APP_NAME", val, sizeof val, ctx->pid);
     if (ptr) {
-      strncpy(msg->_i.name, ptr, sizeof msg->_i.name);
+      strncpy(i->name, ptr, sizeof i->name);
     }
-    msg->_i.name[59] = 0;
+    i->name[59] = 0;
   }
 }
 
@@ -593,16 +567,18 @@ lemu_open(const char *path, struct fuse_file_info *fi)
   lemu_fullpath(fpath, path);
 
   mode_t mode = 0;
-  LnetMsg msg(FsRequest, Open, sizeof(mode) + sizeof(fi->flags) + strlen(fpath) + 1);
-  setAppInfo(&msg);
-  msg.marshall(&fi->flags, &mode, fpath);
+  AppInfo app = {0};
+  setAppInfo(&app);
+  // Msgs only carry the app id; the OST takes the name from the Open
+  LnetMsg msg(FsRequest, Open, sizeof(mode) + sizeof(fi->flags) + strlen(fpath) + 1 +
+                               strlen(app.name) + 1);
+  msg._i = app;
+  msg.marshall(&fi->flags, &mode, fpath, app.name);
   LnetMsg res(Unknown);
   auto ret = 0;
-  if (LEMU_DATA->osc->sendMsgToMds(&msg)) {
-    if (LEMU_DATA->osc->recvMsgFromMds(&res)) {
-      assert(res.t == FsResponse);
-      res.unmarshall(&ret, &errno);
-    }
+  if (LEMU_DATA->osc->callMds(&msg, &res) > 0) {
+    assert(res.t == FsResponse);
+    res.unmarshall(&ret, &errno);
   }
 
   // if the open call succeeds, my retstat is the file descriptor,
@@ -650,19 +626,13 @@ lemu_read(const char *path, char *buf, size_t size, off_t offset, struct fuse_fi
   LnetMsg msg(FsRequest, Read, strlen(fpath) + 1 + sizeof(size) + sizeof(offset) + sizeof(fi->fh));
   LEMU_DATA->osc->getAppForFd(fi->fh, &msg._i);
   msg.marshall(&size, &offset, &fi->fh, fpath);
-  auto ret = -1;
+  ssize_t ret = -1;
   LnetMsg res(Unknown);
   const OstInfo *ost = LEMU_DATA->osc->getOstFromPath(fpath);
-  if (LEMU_DATA->osc->sendDatanetMsgToOst(&msg, ost->id) > 0) {
-    if (LEMU_DATA->osc->recvDatanetMsgFromOst(&res, ost->id) > 0) {
-      assert(res.t == FsResponse);
-      res.unmarshall(&ret, &errno);
-      if (ret > 0) {
-        LEMU_DATA->osc->recvDataFromOst(ost->id, buf, ret);
-      } else if (ret == 0) {
-        ret = 0;
-      }
-    }
+  // The data read follows the response into buf
+  if (LEMU_DATA->osc->callOst(ost->id, &msg, &res, NULL, 0, buf, size) > 0) {
+    assert(res.t == FsResponse);
+    res.unmarshall(&ret, &errno);
   }
   return log_syscall("pread", ret, 0);
 }
@@ -694,12 +664,9 @@ lemu_write(const char *path, const char *buf, size_t size, off_t offset,
   auto ret = -1;
   LnetMsg res(Unknown);
   const OstInfo *ost = LEMU_DATA->osc->getOstFromPath(fpath);
-  if (LEMU_DATA->osc->sendDatanetMsgToOst(&msg, ost->id)) {
-    LEMU_DATA->osc->sendDataToOst(ost->id, buf, size);
-    if (LEMU_DATA->osc->recvDatanetMsgFromOst(&res, ost->id)) {
-      assert(res.t == FsResponse);
-      res.unmarshall(&ret, &errno);
-    }
+  if (LEMU_DATA->osc->callOst(ost->id, &msg, &res, buf, size, NULL, 0) > 0) {
+    assert(res.t == FsResponse);
+    res.unmarshall(&ret, &errno);
   }
 
   return log_syscall("pwrite", ret, 0);
@@ -727,11 +694,9 @@ lemu_statfs(const char *path, struct statvfs *statv)
   msg.marshall(fpath);
   auto ret = 0;
   LnetMsg res(Unknown);
-  if (LEMU_DATA->osc->sendMsgToMds(&msg)) {
-    if (LEMU_DATA->osc->recvMsgFromMds(&res)) {
-      assert(res.t == FsResponse);
-      res.unmarshall(&ret, &errno, statv);
-    }
+  if (LEMU_DATA->osc->callMds(&msg, &res) > 0) {
+    assert(res.t == FsResponse);
+    res.unmarshall(&ret, &errno, statv);
   }
   retstat = log_syscall("statvfs", ret, 0);
 
@@ -775,11 +740,9 @@ lemu_flush(const char *path, struct fuse_file_info *fi)
   msg.marshall(&fi->fh, fpath);
   auto ret = 0;
   LnetMsg res(Unknown);
-  if (LEMU_DATA->osc->sendMsgToMds(&msg)) {
-    if (LEMU_DATA->osc->recvMsgFromMds(&res)) {
-      assert(res.t == FsResponse);
-      res.unmarshall(&ret, &errno);
-    }
+  if (LEMU_DATA->osc->callMds(&msg, &res) > 0) {
+    assert(res.t == FsResponse);
+    res.unmarshall(&ret, &errno);
   }
 
   log_fi(fi);
@@ -817,11 +780,9 @@ lemu_release(const char *path, struct fuse_file_info *fi)
   msg.marshall(&fi->fh, fpath);
   auto ret = 0;
   LnetMsg res(Unknown);
-  if (LEMU_DATA->osc->sendMsgToMds(&msg)) {
-    if (LEMU_DATA->osc->recvMsgFromMds(&res)) {
-      assert(res.t == FsResponse);
-      res.unmarshall(&ret, &errno);
-    }
+  if (LEMU_DATA->osc->callMds(&msg, &res) > 0) {
+    assert(res.t == FsResponse);
+    res.unmarshall(&ret, &errno);
   }
   LEMU_DATA->osc->cleanFdMap(fi->fh);
   return log_syscall("close", ret, 0);
@@ -847,11 +808,9 @@ lemu_fsync(const char *path, int datasync, struct fuse_file_info *fi)
   msg.marshall(&fi->fh, &datasync, fpath);
   auto ret = 0;
   LnetMsg res(Unknown);
-  if (LEMU_DATA->osc->sendMsgToMds(&msg)) {
-    if (LEMU_DATA->osc->recvMsgFromMds(&res)) {
-      assert(res.t == FsResponse);
-      res.unmarshall(&ret, &errno);
-    }
+  if (LEMU_DATA->osc->callMds(&msg, &res) > 0) {
+    assert(res.t == FsResponse);
+    res.unmarshall(&ret, &errno);
   }
 
   return log_syscall("fsync", ret, 0);
@@ -889,11 +848,9 @@ lemu_setxattr(const char *path, const char *name, const char *value, size_t size
   msg.marshall(&size, &flags, &fname, &lname, &vname);
   LnetMsg res(Unknown);
   int ret = 0;
-  if (LEMU_DATA->osc->sendMsgToMds(&msg)) {
-    if (LEMU_DATA->osc->recvMsgFromMds(&res)) {
-      assert(res.t == FsResponse);
-      res.unmarshall(&ret, &errno);
-    }
+  if (LEMU_DATA->osc->callMds(&msg, &res) > 0) {
+    assert(res.t == FsResponse);
+    res.unmarshall(&ret, &errno);
   }
 
   return log_syscall("lsetxattr", ret, 0);
@@ -924,11 +881,9 @@ lemu_getxattr(const char *path, const char *name, char *value, size_t size)
   LnetMsg res(Unknown);
   ssize_t ret = 0;
   BufType mybuf = {.sz = size, .databuf = value};
-  if (LEMU_DATA->osc->sendMsgToMds(&msg)) {
-    if (LEMU_DATA->osc->recvMsgFromMds(&res)) {
-      assert(res.t == FsResponse);
-      res.unmarshall(&ret, &errno, &mybuf);
-    }
+  if (LEMU_DATA->osc->callMds(&msg, &res) > 0) {
+    assert(res.t == FsResponse);
+    res.unmarshall(&ret, &errno, &mybuf);
   }
 
   retstat = log_syscall("lgetxattr", ret, 0);
@@ -960,11 +915,9 @@ lemu_listxattr(const char *path, char *list, size_t size)
   LnetMsg res(Unknown);
   BufType mybuf = {.sz = size, .databuf = list};
   ssize_t ret = 0;
-  if (LEMU_DATA->osc->sendMsgToMds(&msg)) {
-    if (LEMU_DATA->osc->recvMsgFromMds(&res)) {
-      assert(res.t == FsResponse);
-      res.unmarshall(&ret, &errno, &mybuf);
-    }
+  if (LEMU_DATA->osc->callMds(&msg, &res) > 0) {
+    assert(res.t == FsResponse);
+    res.unmarshall(&ret, &errno, &mybuf);
   }
 
   retstat = log_syscall("llistxattr", ret, 0);
@@ -1021,11 +974,9 @@ int lemu_opendir(const char *path, struct fuse_file_info *fi)
   msg.marshall(fpath);
   LnetMsg res(Unknown);
   auto ret = 0;
-  if (LEMU_DATA->osc->sendMsgToMds(&msg)) {
-    if (LEMU_DATA->osc->recvMsgFromMds(&res)) {
-      assert(res.t == FsResponse);
-      res.unmarshall(&dp, &errno);
-    }
+  if (LEMU_DATA->osc->callMds(&msg, &res) > 0) {
+    assert(res.t == FsResponse);
+    res.unmarshall(&dp, &errno);
   }
   if (dp == NULL)
      ret = log_error("lemu_opendir opendir");
@@ -1059,21 +1010,19 @@ lemu_readdir(const char *path, void *buf, fuse_fill_dir_t filler, off_t offset,
   LnetMsg msg(FsRequest, Readdir, sizeof(dp) + strlen(fpath) + 1);
   msg.marshall(&dp, fpath);
   LnetMsg res(Unknown);
-  if (LEMU_DATA->osc->sendMsgToMds(&msg)) {
-    if (LEMU_DATA->osc->recvMsgFromMds(&res)) {
-      assert(res.t == FsResponse);
-      size_t count = 0;
-      size_t offset = 0;
-      res.extractData(&de, offset);
-      res.extractData(&errno, offset);
-      res.extractData(&count, offset);
-      for (size_t i = 0; i < count; i++) {
-        struct dirent des;
-        res.extractData(&des, offset);
-        if (filler(buf, des.d_name, NULL, 0) != 0) {
-          log_msg("    ERROR lemu_readdir filler:  buffer full");
-          return -ENOMEM;
-        }
+  if (LEMU_DATA->osc->callMds(&msg, &res) > 0) {
+    assert(res.t == FsResponse);
+    size_t count = 0;
+    size_t offset = 0;
+    res.extractData(&de, offset);
+    res.extractData(&errno, offset);
+    res.extractData(&count, offset);
+    for (size_t i = 0; i < count; i++) {
+      struct dirent des;
+      res.extractData(&des, offset);
+      if (filler(buf, des.d_name, NULL, 0) != 0) {
+        log_msg("    ERROR lemu_readdir filler:  buffer full");
+        return -ENOMEM;
       }
     }
   }
@@ -1105,11 +1054,9 @@ lemu_releasedir(const char *path, struct fuse_file_info *fi)
   LnetMsg msg(FsRequest, Releasedir, sizeof(fi->fh) + strlen(fpath) + 1);
   msg.marshall(&fi->fh, fpath);
   LnetMsg res(Unknown);
-  if (LEMU_DATA->osc->sendMsgToMds(&msg)) {
-    if (LEMU_DATA->osc->recvMsgFromMds(&res)) {
-      assert(res.t == FsResponse);
-      res.unmarshall(&retstat, &errno);
-    }
+  if (LEMU_DATA->osc->callMds(&msg, &res) > 0) {
+    assert(res.t == FsResponse);
+    res.unmarshall(&retstat, &errno);
   }
 
   return retstat;
@@ -1174,11 +1121,9 @@ lemu_access(const char *path, int mask)
   msg.marshall(&mask, fpath);
   LnetMsg res(Unknown);
   auto ret = 0;
-  if (LEMU_DATA->osc->sendMsgToMds(&msg)) {
-    if (LEMU_DATA->osc->recvMsgFromMds(&res)) {
-      assert(res.t == FsResponse);
-      res.unmarshall(&ret, &errno);
-    }
+  if (LEMU_DATA->osc->callMds(&msg, &res) > 0) {
+    assert(res.t == FsResponse);
+    res.unmarshall(&ret, &errno);
   }
   if (ret < 0)
      ret = log_error("lemu_access access");
@@ -1255,11 +1200,9 @@ lemu_fgetattr(const char *path, struct stat *statbuf, struct fuse_file_info *fi)
   msg.marshall(&fi->fh, fpath);
   auto ret = 0;
   LnetMsg res(Unknown);
-  if (LEMU_DATA->osc->sendMsgToMds(&msg) > 0) {
-    if (LEMU_DATA->osc->recvMsgFromMds(&res) > 0) {
-      assert(res.t == FsResponse);
-      res.unmarshall(&ret, &errno, statbuf);
-    }
+  if (LEMU_DATA->osc->callMds(&msg, &res) > 0) {
+    assert(res.t == FsResponse);
+    res.unmarshall(&ret, &errno, statbuf);
   }
 
   // retstat = fstat(fi->fh, statbuf);
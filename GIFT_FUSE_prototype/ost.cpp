@@ -8,7 +8,8 @@ using namespace std;
 
 const int DEFAULT_GC_TIMER = 15;
 
-OST::OST(const LSockAddr &addr, int port, int id, const char *name, int lnetport, int dataport)
+OST::OST(const LSockAddr &addr, int port, int id, const char *name, int lnetport, int dataport,
+         const LSockAddr *aggAddr, int aggPort)
 {
   this->_info = new OstInfo();
   this->_info->id = id;
@@ -19,6 +20,9 @@ OST::OST(const LSockAddr &addr, int port, int id, const char *name, int lnetport
   this->_dataNet = new DatanetOst(this->_info);
   this->_ostNet = new LnetOst(addr, port, this->_info, this->_dataNet);
   this->_mdsConnected = this->_ostNet->pubOstInfoToMds();
+  if (this->_mdsConnected && aggAddr) {
+    this->_mdsConnected = this->_ostNet->pubOstInfoToAgg(*aggAddr, aggPort);
+  }
 }
 
 OST::~OST()
@@ -42,7 +46,7 @@ void OST::eventLoop()
   thread dnetGcThread ( [=] {
     while (true) {
       ::sleep(DEFAULT_GC_TIMER);
-      this->_dataNet->garbageCollectCompletedReqs();
+      this->_dataNet->garbageCollectCgroups();
      }
   });
   lnetThread.join();
@@ -2,6 +2,8 @@
 #define _OST_H_
 
 #include <vector>
+#include <map>
+#include <mutex>
 
 #include "lnet.h"
 #include "dnet_ost.h"
@@ -12,23 +14,30 @@ class LnetOst: public LnetServer
     const OstInfo *_info;
     MdsInfo *_mdsInfo;
     LnetClient *_toMds;
+    LnetClient *_toAgg;
+    MdsInfo *_aggInfo;
     std::vector<OscInfo*> _oscs;
     DatanetOst *_dnet;
+    bool _changeNotified;
+    ReqSetHistory _sentReqs;
+    std::mutex *_lock; // guards _oscs, _changeNotified and _sentReqs
   
     void addOsc(const LSocket &, const OscInfo *);
-    void respondToMdsTimer(const LnetEntity *);
+    void respondToMdsTimer(const LnetEntity *, const LnetMsg *);
+    void notifyMdsOfChange(const LnetEntity *);
     void handleFsRequest(const LnetEntity *, const LnetMsg *);
 
   protected:
     virtual void onConnect();
     virtual void onDisconnect(const LnetEntity *);
-    virtual void onClientRequest(const LnetEntity *);
-    virtual void onRemoteServerRequest(const LnetEntity *);
+    virtual void onClientRequest(const LnetEntity *, LnetMsg *);
+    virtual void onRemoteServerRequest(const LnetEntity *, LnetMsg *);
 
   public:
     LnetOst(const LSockAddr &, int , const OstInfo *, DatanetOst *);
     ~LnetOst();
     bool pubOstInfoToMds();
+    bool pubOstInfoToAgg(const LSockAddr &, int );
     ssize_t sendMsgToMds(const LnetMsg *);
     ssize_t recvMsgFromMds(LnetMsg *);
 
@@ -47,7 +56,8 @@ class OST
 
   public:
     // constructor(s)
-    OST(const LSockAddr &addr, int port, int id, const char *name, int lnetport, int dataport);
+    OST(const LSockAddr &addr, int port, int id, const char *name, int lnetport, int dataport,
+        const LSockAddr *aggAddr = NULL, int aggPort = -1);
     ~OST();
 
     // methods
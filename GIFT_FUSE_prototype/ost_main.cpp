@@ -9,13 +9,13 @@ using namespace std;
 static void
 printUsage()
 {
-  cerr << "Usage: ost [mds-host] [mds-port] [ost-id] [ost-name] [ost-lnetport] [ost-dataport]" << endl;
+  cerr << "Usage: ost [mds-host] [mds-port] [ost-id] [ost-name] [ost-lnetport] [ost-dataport] [agg-host agg-port]" << endl;
 }
 
 int
 main(int argc, char *argv[])
 {
-  if (argc < 6) {
+  if (argc < 7) {
     printUsage();
     return -1;
   }
@@ -27,7 +27,15 @@ main(int argc, char *argv[])
   int dataport = atoi(argv[6]);
 
   LSockAddr addr(hostname, port);
-  OST *ost = new OST(addr, port, id, name, lnetport, dataport);
+  OST *ost = NULL;
+  if (argc > 8) {
+    // Take the timer and allocation msgs through an aggregator
+    int aggport = atoi(argv[8]);
+    LSockAddr aggaddr(argv[7], aggport);
+    ost = new OST(addr, port, id, name, lnetport, dataport, &aggaddr, aggport);
+  } else {
+    ost = new OST(addr, port, id, name, lnetport, dataport);
+  }
   ost->eventLoop();
   delete ost;
   return 0;
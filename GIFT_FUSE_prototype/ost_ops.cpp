@@ -28,24 +28,109 @@ OstOps::ost_read(const DatanetOst* dost, const LnetEntity *remote, const LnetMsg
   std::string fname;
   msg->unmarshall(&size, &offset, &fd, &fname);
 
+  struct stat st;
+  if (dost->doesIoHere(msg->_i.id) && ::fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+    // Send the data straight from the page cache
+    ssize_t ret = offset < st.st_size ? std::min((off_t)size, st.st_size - offset) : 0;
+    int err = 0;
+    LnetMsg res(FsResponse, sizeof(ret) + sizeof(err));
+    res.reqId = msg->reqId;
+    res.marshall(&ret, &err);
+    if (dost->sendFileToOsc(remote, &res, fd, offset, ret) < 0) {
+      // The connection is dropped rather than the data made up
+      std::cerr << "ost: could not send: " << fname << ". Error: " << strerror(errno) << std::endl;
+    }
+    return;
+  }
+
   char *buf = new char[size];
 
-  int ret = ::pread(fd, buf, size, offset);
+  ssize_t ret = dost->readFile(msg->_i.id, fd, buf, size, offset);
   if (ret < 0) {
     std::cerr << "ost: could not read: " << fname << ". Error: " << strerror(errno) << std::endl;
   }
   LnetMsg res(FsResponse, sizeof(ret) + sizeof(errno));
+  res.reqId = msg->reqId;
   res.marshall(&ret, &errno);
-  remote->sendMsgToRemote(&res);
-  if (ret > 0) {
-    remote->sendDataToRemote(buf, ret);
-  }
+  dost->sendMsgToOsc(remote, &res, buf, ret > 0 ? ret : 0);
   delete[] buf;
 }
 
+// Receive the data of a write off the connection a chunk at a time, and
+// write each chunk to the file. Data that cannot be received fails the
+// write, even if some of it is in the file.
+static ssize_t
+writeFromConnection(const DatanetOst *dost, const LnetEntity *remote, int id, int fd,
+                    size_t len, off_t offset)
+{
+  std::vector<char> buf(std::min(len, BULK_CHUNK));
+  size_t done = 0;
+  while (done < len) {
+    size_t n = std::min(len - done, buf.size());
+    if (dost->recvBulk(remote, buf.data(), n) != (ssize_t)n) {
+      errno = EIO;
+      return -1;
+    }
+    ssize_t w = dost->writeFile(id, fd, buf.data(), n, offset + done);
+    if (w < 0) return done > 0 ? (ssize_t)done : -1;
+    done += w;
+    if ((size_t)w < n) break;
+  }
+  return done;
+}
+
+// Like writeFromConnection(), but move each chunk through a pipe, which
+// the kernel fills from the socket and drains into the file without a
+// copy to user space. A file that cannot be spliced into, such as one
+// opened with O_APPEND, takes the chunks through a buffer.
+static ssize_t
+spliceFromConnection(const DatanetOst *dost, const LnetEntity *remote, int id, int fd,
+                     size_t len, off_t offset)
+{
+  PipeChunk_t p;
+  if (!LnetPipePool::instance()->alloc(&p)) {
+    return writeFromConnection(dost, remote, id, fd, len, offset);
+  }
+  std::vector<char> buf;
+  bool copy = false;
+  size_t done = 0;
+  ssize_t ret = 0;
+  while (done < len) {
+    if (dost->spliceBulk(remote, &p, len - done) <= 0) {
+      errno = EIO;
+      ret = -1;
+      break;
+    }
+    size_t n = p.len;
+    ssize_t moved = copy ? -1 : spliceAll(p.rfd, fd, offset + done, n);
+    if (copy || (moved < 0 && errno == EINVAL)) {
+      copy = true;
+      buf.resize(n);
+      moved = readAll(p.rfd, buf.data(), n);
+      if (moved > 0) {
+        p.len -= moved;
+        moved = dost->writeFile(id, fd, buf.data(), moved, offset + done);
+      }
+    } else if (moved > 0) {
+      p.len -= moved;
+    }
+    if (moved < 0) {
+      ret = done > 0 ? (ssize_t)done : -1;
+      break;
+    }
+    done += moved;
+    ret = done;
+    if ((size_t)moved < n) break;
+  }
+  LnetPipePool::instance()->release(p);
+  return ret;
+}
+
 // ssize_t ost_write(const char *path, const char *buf, size_t size, off_t offset)
+// Without buf, the data is read off the connection.
 void
-OstOps::ost_write(const DatanetOst *dost, const LnetEntity *remote, const LnetMsg *msg)
+OstOps::ost_write(const DatanetOst *dost, const LnetEntity *remote, const LnetMsg *msg,
+                  const char *buf)
 {
   assert(msg->t == FsRequest);
   assert(msg->extraData && msg->len > 0);
@@ -56,19 +141,22 @@ OstOps::ost_write(const DatanetOst *dost, const LnetEntity *remote, const LnetMs
   std::string fname;
   msg->unmarshall(&size, &offset, &fd, &fname);
 
-  char *buf = new char[size];
-  // TODO: Spawn thread to do the write; put the thread in a cgroup
   // TODO: In open, always open with O_DIRECT
-  remote->recvDataFromRemote(buf, size);
-
-  int ret = ::pwrite(fd, buf, size, offset);
+  int ret;
+  if (buf) {
+    ret = dost->writeFile(msg->_i.id, fd, buf, size, offset);
+  } else if (size >= SPLICE_MIN && dost->doesIoHere(msg->_i.id)) {
+    ret = spliceFromConnection(dost, remote, msg->_i.id, fd, size, offset);
+  } else {
+    ret = writeFromConnection(dost, remote, msg->_i.id, fd, size, offset);
+  }
   if (ret < 0) {
     std::cerr << "ost: could not write: " << fname << ". Error: " << strerror(errno) << std::endl;
   }
   LnetMsg res(FsResponse, sizeof(ret) + sizeof(errno));
+  res.reqId = msg->reqId;
   res.marshall(&ret, &errno);
-  remote->sendMsgToRemote(&res);
-  delete[] buf;
+  dost->sendMsgToOsc(remote, &res);
 }
 
 // Metadata API
@@ -90,7 +178,7 @@ OstOps::ost_readlink(const LnetOst *lost, const LnetEntity *remote, const LnetMs
   }
   BufType mybuf = {.sz = size, .databuf = link};
   LnetMsg res(FsResponse, sizeof(ret) + sizeof(errno) + sizeof(mybuf.sz) + size);
-  res.src = msg->src;
+  res.reqId = msg->reqId;
   res.marshall(&ret, &errno, &mybuf);
   remote->sendMsgToRemote(&res);
 }
@@ -112,7 +200,7 @@ OstOps::ost_mknod(const LnetOst *lost, const LnetEntity *remote, const LnetMsg *
     std::cerr << "ost: could not mknod: " << fname << ". Error: " << strerror(errno) << std::endl;
   }
   LnetMsg res(FsResponse, sizeof(ret) + sizeof(errno));
-  res.src = msg->src;
+  res.reqId = msg->reqId;
   res.marshall(&ret, &errno);
   remote->sendMsgToRemote(&res);
 }
@@ -133,7 +221,7 @@ OstOps::ost_mkdir(const LnetOst *lost, const LnetEntity *remote, const LnetMsg *
     std::cerr << "ost: could not create dir: " << dname << ". Error: " << strerror(errno) << std::endl;
   }
   LnetMsg res(FsResponse, sizeof(ret) + sizeof(errno));
-  res.src = msg->src;
+  res.reqId = msg->reqId;
   res.marshall(&ret, &errno);
   remote->sendMsgToRemote(&res);
 }
@@ -155,7 +243,7 @@ OstOps::ost_access(const LnetOst *lost, const LnetEntity *remote, const LnetMsg
     std::cerr << "ost: could not access path: " << fname << ". Error: " << strerror(errno) << std::endl;
   }
   LnetMsg res(FsResponse, sizeof(ret) + sizeof(errno));
-  res.src = msg->src;
+  res.reqId = msg->reqId;
   res.marshall(&ret, &errno);
   remote->sendMsgToRemote(&res);
 }
@@ -177,7 +265,7 @@ OstOps::ost_opendir(const LnetOst *lost, const LnetEntity *remote, const LnetMsg
     std::cerr << "ost: opendir: " << dname << ". DP: " << dp << std::endl;
   }
   LnetMsg res(FsResponse, sizeof(dp) + sizeof(errno));
-  res.src = msg->src;
+  res.reqId = msg->reqId;
   res.marshall(&dp, &errno);
   remote->sendMsgToRemote(&res);
 }
@@ -198,7 +286,7 @@ OstOps::ost_releasedir(const LnetOst *lost, const LnetEntity *remote, const Lnet
     std::cerr << "ost: could not release directory path: " << dname << ". DP: " << dp << ". Error: " << strerror(errno) << std::endl;
   }
   LnetMsg res(FsResponse, res.len = sizeof(ret) + sizeof(errno));
-  res.src = msg->src;
+  res.reqId = msg->reqId;
   res.marshall(&ret, &errno);
   remote->sendMsgToRemote(&res);
 }
@@ -221,7 +309,7 @@ OstOps::ost_getattr(const LnetOst *lost, const LnetEntity *remote, const LnetMsg
     std::cerr << "ost: lstat: " << fname << std::endl;
   }
   LnetMsg res(FsResponse, sizeof(ret) + sizeof(errno) + sizeof(statbuf));
-  res.src = msg->src;
+  res.reqId = msg->reqId;
   res.marshall(&ret, &errno, &statbuf);
   remote->sendMsgToRemote(&res);
 }
@@ -243,7 +331,7 @@ OstOps::ost_unlink(const LnetOst *lost, const LnetEntity *remote, const LnetMsg
     std::cerr << "ost: unlink: " << fname << std::endl;
   }
   LnetMsg res(FsResponse, sizeof(ret) + sizeof(errno));
-  res.src = msg->src;
+  res.reqId = msg->reqId;
   res.marshall(&ret, &errno);
   remote->sendMsgToRemote(&res);
 }
@@ -265,7 +353,7 @@ OstOps::ost_rmdir(const LnetOst *lost, const LnetEntity *remote, const LnetMsg *
     std::cerr << "ost: rmdir: " << dname << std::endl;
   }
   LnetMsg res(FsResponse, sizeof(ret) + sizeof(errno));
-  res.src = msg->src;
+  res.reqId = msg->reqId;
   res.marshall(&ret, &errno);
   remote->sendMsgToRemote(&res);
 }
@@ -289,7 +377,7 @@ OstOps::ost_symlink(const LnetOst *lost, const LnetEntity *remote, const LnetMsg
     std::cerr << "ost: symlink: " << ln << " --> " << fn << std::endl;
   }
   LnetMsg res(FsResponse, sizeof(ret) + sizeof(errno));
-  res.src = msg->src;
+  res.reqId = msg->reqId;
   res.marshall(&ret, &errno);
   remote->sendMsgToRemote(&res);
 }
@@ -313,7 +401,7 @@ OstOps::ost_rename(const LnetOst *lost, const LnetEntity *remote, const LnetMsg
     std::cerr << "ost: rename: " << fn << std::endl;
   }
   LnetMsg res(FsResponse, sizeof(ret) + sizeof(errno));
-  res.src = msg->src;
+  res.reqId = msg->reqId;
   res.marshall(&ret, &errno);
   remote->sendMsgToRemote(&res);
 }
@@ -337,7 +425,7 @@ OstOps::ost_link(const LnetOst *lost, const LnetEntity *remote, const LnetMsg *m
     std::cerr << "ost: link: " << fn << std::endl;
   }
   LnetMsg res(FsResponse, sizeof(ret) + sizeof(errno));
-  res.src = msg->src;
+  res.reqId = msg->reqId;
   res.marshall(&ret, &errno);
   remote->sendMsgToRemote(&res);
 }
@@ -360,7 +448,7 @@ OstOps::ost_chmod(const LnetOst *lost, const LnetEntity *remote, const LnetMsg *
     std::cerr << "ost: chmod: " << fname << std::endl;
   }
   LnetMsg res(FsResponse, sizeof(ret) + sizeof(errno));
-  res.src = msg->src;
+  res.reqId = msg->reqId;
   res.marshall(&ret, &errno);
   remote->sendMsgToRemote(&res);
 }
@@ -384,7 +472,7 @@ OstOps::ost_chown(const LnetOst *lost, const LnetEntity *remote, const LnetMsg *
     std::cerr << "ost: chown: " << fname << std::endl;
   }
   LnetMsg res(FsResponse, sizeof(ret) + sizeof(errno));
-  res.src = msg->src;
+  res.reqId = msg->reqId;
   res.marshall(&ret, &errno);
   remote->sendMsgToRemote(&res);
 }
@@ -407,7 +495,7 @@ OstOps::ost_truncate(const LnetOst *lost, const LnetEntity *remote, const LnetMs
     std::cerr << "ost: truncate: " << fname << std::endl;
   }
   LnetMsg res(FsResponse, sizeof(ret) + sizeof(errno));
-  res.src = msg->src;
+  res.reqId = msg->reqId;
   res.marshall(&ret, &errno);
   remote->sendMsgToRemote(&res);
 }
@@ -430,57 +518,11 @@ OstOps::ost_utime(const LnetOst *lost, const LnetEntity *remote, const LnetMsg *
     std::cerr << "ost: utime: " << fname << std::endl;
   }
   LnetMsg res(FsResponse, sizeof(ret) + sizeof(errno) + sizeof(ubuf));
-  res.src = msg->src;
+  res.reqId = msg->reqId;
   res.marshall(&ret, &errno, &ubuf);
   remote->sendMsgToRemote(&res);
 }
 
-void
-OstOps::startRwThread(const LnetOst *lost, int fd, const LnetEntity *remote, AppInfo i)
-{
-  pid_t tid = -1;
-  std::mutex *m = new std::mutex();
-  std::condition_variable *cv = new std::condition_variable();
-  bool wThreadReady = false; // Indicates if the RW thread has finished initialization
-  bool *pThreadReady = new bool(false); // Indicates if the parent thread has some data
-  bool *wThreadReqProcessed = new bool(false); // Indicates if the RW thread has processed a RW request
-  const LnetEntity **ent = new const LnetEntity*;
-  LnetMsg *msg = new LnetMsg(Unknown);
-
-  std::thread *wThread = new std::thread( [=, &tid, &wThreadReady]() mutable -> void
-  {
-    tid = syscall(SYS_gettid);
-    {
-      std::lock_guard<std::mutex> lk(*m);
-      wThreadReady = true;
-    }
-    cv->notify_one();
-    while (true) {
-      // Wait for Read/Write/Close msg from the remote
-      lost->_dnet->waitForMsg(m, cv, pThreadReady);
-      if (msg->f == Release) {
-        break;
-      } else if (msg->f == Write) {
-        OstOps::ost_write(lost->_dnet, *ent, msg);
-        lost->_dnet->wakeUp(m, cv, wThreadReqProcessed);
-      } else if (msg->f == Read) {
-        OstOps::ost_read(lost->_dnet, *ent, msg);
-        lost->_dnet->wakeUp(m, cv, wThreadReqProcessed);
-      } else {
-        continue;
-      }
-    }
-    lost->_dnet->wakeUp(m, cv, wThreadReqProcessed);
-    lost->_dnet->dequeue(remote, msg, i);
-  });
-  {
-    std::unique_lock<std::mutex> lk(*m);
-    cv->wait(lk, [&wThreadReady]{return wThreadReady;});
-  }
-  lost->_dnet->enqueue(ent, msg, fd, wThread, tid,
-                       m, cv, pThreadReady, wThreadReqProcessed, i);
-}
-
 // int ost_open(const char *path, int flags, mode_t mode)
 void
 OstOps::ost_open(const LnetOst *lost, const LnetEntity *remote, const LnetMsg *msg)
@@ -491,17 +533,20 @@ OstOps::ost_open(const LnetOst *lost, const LnetEntity *remote, const LnetMsg *m
   int flags;
   mode_t mode;
   std::string fname;
-  msg->unmarshall(&flags, &mode, &fname);
+  std::string appName;
+  msg->unmarshall(&flags, &mode, &fname, &appName);
 
   int ret = ::open(fname.c_str(), flags, mode);
   if (ret < 0) {
     std::cerr << "ost: could not open: " << fname << ". Error: " << strerror(errno) << std::endl;
   } else {
     std::cerr << "ost: open: " << fname << std::endl;
-    OstOps::startRwThread(lost, ret, msg->src, msg->_i);
+    AppInfo i = msg->_i;
+    strncpy(i.name, appName.c_str(), sizeof(i.name) - 1);
+    lost->_dnet->openStream(ret, i);
   }
   LnetMsg res(FsResponse, sizeof(ret) + sizeof(errno));
-  res.src = msg->src;
+  res.reqId = msg->reqId;
   res.marshall(&ret, &errno);
   remote->sendMsgToRemote(&res);
 }
@@ -524,7 +569,7 @@ OstOps::ost_statfs(const LnetOst *lost, const LnetEntity *remote, const LnetMsg
     std::cerr << "ost: stat: " << fname << std::endl;
   }
   LnetMsg res(FsResponse, sizeof(ret) + sizeof(errno) + sizeof(statbuf));
-  res.src = msg->src;
+  res.reqId = msg->reqId;
   res.marshall(&ret, &errno, &statbuf);
   remote->sendMsgToRemote(&res);
 }
@@ -547,7 +592,7 @@ OstOps::ost_flush(const LnetOst *lost, const LnetEntity *remote, const LnetMsg *
     std::cerr << "ost: flush: " << fname << std::endl;
   }
   LnetMsg res(FsResponse, sizeof(ret) + sizeof(errno));
-  res.src = msg->src;
+  res.reqId = msg->reqId;
   res.marshall(&ret, &errno);
   remote->sendMsgToRemote(&res);
 }
@@ -563,15 +608,17 @@ OstOps::ost_release(const LnetOst *lost, const LnetEntity *remote, const LnetMsg
   std::string fname;
   msg->unmarshall(&fd, &fname);
 
+  // Drop the stream first, as an open on another event loop may get the fd
+  // number back once it is closed
+  lost->_dnet->closeStream(msg->_i.id, fd);
   int ret = ::close(fd);
   if (ret < 0) {
     std::cerr << "ost: could not release: " << fname << ". Error: " << strerror(errno) << std::endl;
   } else {
-    lost->_dnet->sendMsgToRwThread(msg->src, msg);
     std::cerr << "ost: release: " << fname << std::endl;
   }
   LnetMsg res(FsResponse, sizeof(ret) + sizeof(errno));
-  res.src = msg->src;
+  res.reqId = msg->reqId;
   res.marshall(&ret, &errno);
   remote->sendMsgToRemote(&res);
 }
@@ -600,7 +647,7 @@ OstOps::ost_fsync(const LnetOst *lost, const LnetEntity *remote, const LnetMsg *
     std::cerr << "ost: fsync: " << fname << std::endl;
   }
   LnetMsg res(FsResponse, sizeof(ret) + sizeof(errno));
-  res.src = msg->src;
+  res.reqId = msg->reqId;
   res.marshall(&ret, &errno);
   remote->sendMsgToRemote(&res);
 }
@@ -627,7 +674,7 @@ OstOps::ost_setxattr(const LnetOst *lost, const LnetEntity *remote, const LnetMs
     std::cerr << "ost: setxattr: " << fn << ": " << ln << ". Value: " << vn << std::endl;
   }
   LnetMsg res(FsResponse, sizeof(ret) + sizeof(errno));
-  res.src = msg->src;
+  res.reqId = msg->reqId;
   res.marshall(&ret, &errno);
   remote->sendMsgToRemote(&res);
 }
@@ -656,7 +703,7 @@ OstOps::ost_getxattr(const LnetOst *lost, const LnetEntity *remote, const LnetMs
     mybuf.sz = ret;
   }
   LnetMsg res(FsResponse, sizeof(ret) + sizeof(errno) + sizeof(mybuf.sz) + mybuf.sz);
-  res.src = msg->src;
+  res.reqId = msg->reqId;
   res.marshall(&ret, &errno, &mybuf);
   remote->sendMsgToRemote(&res);
 }
@@ -683,7 +730,7 @@ OstOps::ost_listxattr(const LnetOst *lost, const LnetEntity *remote, const LnetM
     mybuf.sz = ret;
   }
   LnetMsg res(FsResponse, sizeof(ret) + sizeof(errno) + sizeof(mybuf.sz) + mybuf.sz);
-  res.src = msg->src;
+  res.reqId = msg->reqId;
   res.marshall(&ret, &errno, &mybuf);
   remote->sendMsgToRemote(&res);
 }
@@ -725,7 +772,7 @@ OstOps::ost_readdir(const LnetOst *lost, const LnetEntity *remote, const LnetMsg
 done:
   size_t len = dirents.size();
   LnetMsg res(FsResponse, sizeof(de) + sizeof(errno) + sizeof(len) + sizeof(*de) * dirents.size());
-  res.src = msg->src;
+  res.reqId = msg->reqId;
   res.marshall(&de, &errno, &len);
   for (auto d: dirents) {
     res.marshall(&d);
@@ -756,7 +803,7 @@ OstOps::ost_fgetattr(const LnetOst *lost, const LnetEntity *remote, const LnetMs
     std::cerr << "ost: could not fgetattr: " << fname << ". Error: " << strerror(errno) << std::endl;
   }
   LnetMsg res(FsResponse, sizeof(ret) + sizeof(errno) + sizeof(statbuf));
-  res.src = msg->src;
+  res.reqId = msg->reqId;
   res.marshall(&ret, &errno, &statbuf);
   remote->sendMsgToRemote(&res);
 }
\ No newline at end of file
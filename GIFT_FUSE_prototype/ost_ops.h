@@ -13,7 +13,7 @@ class OstOps
   public:
     // Data API
     static void ost_read(const DatanetOst* , const LnetEntity* , const LnetMsg* );
-    static void ost_write(const DatanetOst* , const LnetEntity* , const LnetMsg* );
+    static void ost_write(const DatanetOst* , const LnetEntity* , const LnetMsg* , const char* );
 
     // Metadata API
     static void ost_mkdir(const LnetOst* , const LnetEntity* , const LnetMsg* );
@@ -42,9 +42,6 @@ class OstOps
     static void ost_getxattr(const LnetOst* , const LnetEntity* , const LnetMsg* );
     static void ost_setxattr(const LnetOst* , const LnetEntity* , const LnetMsg* );
     static void ost_listxattr(const LnetOst* , const LnetEntity* , const LnetMsg* );
-
-    // Other
-    static void startRwThread(const LnetOst* , int , const LnetEntity* , AppInfo );
 };
 
 // Used during mount
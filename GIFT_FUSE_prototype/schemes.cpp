@@ -1,12 +1,20 @@
 #include <algorithm>
 #include <cassert>
+#include <chrono>
+#include <cmath>
 #include <iostream>
+#include <numeric>
+#include <queue>
+#include <unordered_map>
 #include <vector>
 #include <set>
+#include <thread>
 
 #include "lnet.h"
 #include "mds.h"
+#ifdef USE_CLP
 #include "ClpSimplex.hpp"
+#endif
 
 // Required for all policies
 #define ALLOC_XTRA_BW   false
@@ -41,12 +49,14 @@ struct AppFreq_t {
 };
 
 vector<AppFreq_t> freqDatabase;
+unordered_map<int, size_t> freqDbIndex;
 
 // Required for GIFT policy
 double sys_coup_issu = 0.0;
 double sys_coup_rdmp = 0.0;
 
 vector<AppData_t> appDatabase;
+unordered_map<int, size_t> appDbIndex;
 
 vector<int>    numCouponsIssued;
 vector<double> valCouponsIssued;
@@ -54,948 +64,1178 @@ vector<double> valCouponsIssued;
 // Track the effective storage system utilization for all policies
 vector<double> runEffStorageSysUtil;
 
-void LnetMds::computeBwAllocationsPOFS(const size_t NUM_OSTS,
-                                       const std::vector<std::vector<int>> &reqs,
-                                       MapOstToAppAllocs_t &allocs)
+void ReqIncidence_t::build(const std::vector<std::vector<int>> &reqs)
 {
+  this->numOsts = reqs.size();
+
+  // Lay out the per-OST requests and intern the app ids
+  this->reqStart.assign(1, 0);
+  this->reqApp.clear();
+  for (auto &ost : reqs) {
+    this->reqApp.insert(this->reqApp.end(), ost.begin(), ost.end());
+    this->reqStart.push_back((int)this->reqApp.size());
+  }
+  this->apps = this->reqApp;
+  sort(this->apps.begin(), this->apps.end());
+  this->apps.erase(unique(this->apps.begin(), this->apps.end()), this->apps.end());
+  const int numApps = this->numApps();
+
+  this->index.clear();
+  this->index.reserve(numApps);
+  for (int a = 0; a < numApps; a++) {
+    this->index[this->apps[a]] = a;
+  }
+  for (auto &req : this->reqApp) {
+    req = this->index[req];
+  }
 
-  // Create a flat vector
-  vector<int> flat;
-  for (size_t i = 0; i < NUM_OSTS; i++) {
-    for (auto req : reqs[i]) {
-      flat.push_back(req);
+  // Merge repeated requests of an app on an OST into one counted cell
+  vector<int> lastOst(numApps, -1), cell(numApps, 0);
+  this->ostStart.assign(1, 0);
+  this->ostApp.clear();
+  this->ostCnt.clear();
+  this->appReqs.assign(numApps, 0);
+  for (size_t i = 0; i < this->numOsts; i++) {
+    for (int k = this->reqStart[i]; k < this->reqStart[i + 1]; k++) {
+      int a = this->reqApp[k];
+      if (lastOst[a] != (int)i) {
+        lastOst[a] = (int)i;
+        cell[a] = (int)this->ostApp.size();
+        this->ostApp.push_back(a);
+        this->ostCnt.push_back(0);
+      }
+      this->ostCnt[cell[a]] += 1;
+      this->appReqs[a] += 1;
     }
+    this->ostStart.push_back((int)this->ostApp.size());
   }
 
-  // Determine the number of applications doing I/O
-  set<int> s = set<int>(flat.begin(), flat.end());
-  vector<int> apps(s.begin(), s.end());
-  const int numApps = (int)apps.size();
+  // Transpose the cells into app-major order, OSTs ascending within an app
+  this->appStart.assign(numApps + 1, 0);
+  for (auto a : this->ostApp) {
+    this->appStart[a + 1] += 1;
+  }
+  for (int a = 0; a < numApps; a++) {
+    this->appStart[a + 1] += this->appStart[a];
+  }
+  this->appOst.resize(this->ostApp.size());
+  this->appCnt.resize(this->ostApp.size());
+  vector<int> next(this->appStart.begin(), this->appStart.end() - 1);
+  for (size_t i = 0; i < this->numOsts; i++) {
+    for (int k = this->ostStart[i]; k < this->ostStart[i + 1]; k++) {
+      int pos = next[this->ostApp[k]]++;
+      this->appOst[pos] = (int)i;
+      this->appCnt[pos] = this->ostCnt[k];
+    }
+  }
+}
 
-  // Determine the minimum bandwidth of each app after fair share
-  double* minBw = NULL;
-  minBw = new double[numApps];
-  fill_n(minBw, numApps, numeric_limits<double>::infinity());
+static int findRoot(vector<int> &parent, int x)
+{
+  while (parent[x] != x) {
+    parent[x] = parent[parent[x]];
+    x = parent[x];
+  }
+  return x;
+}
 
-  for (size_t i = 0; i < NUM_OSTS; i++) {
-    double alloc = 1.0 / (double)reqs[i].size();
-    for (auto req : reqs[i]) {
-      int ind = (int)(find(apps.begin(), apps.end(), req) - apps.begin());
-      minBw[ind] = min(minBw[ind], alloc);
+// Split into the connected components of the app/OST graph. OSTs without
+// requests belong to no component. partOsts maps each component's OST
+// indices back to this incidence's.
+void ReqIncidence_t::split(std::vector<ReqIncidence_t> &parts,
+                           std::vector<std::vector<int>> &partOsts) const
+{
+  const int numOsts = (int)this->numOsts;
+
+  // OSTs are nodes [0, numOsts) and apps follow them
+  vector<int> parent(numOsts + this->numApps());
+  iota(parent.begin(), parent.end(), 0);
+  for (int i = 0; i < numOsts; i++) {
+    for (int k = this->ostStart[i]; k < this->ostStart[i + 1]; k++) {
+      int a = findRoot(parent, i);
+      int b = findRoot(parent, numOsts + this->ostApp[k]);
+      if (a != b) {
+        parent[max(a, b)] = min(a, b);
+      }
     }
   }
 
-  // Determine effective storage system utilization and allocation of the bandwidth
-  double totalUsedBw = 0.0;
-  for (size_t i = 0; i < NUM_OSTS; i++) {
-    double usedBw = 0.0;
-    for (auto req : reqs[i]) {
-      int ind = (int)(find(apps.begin(), apps.end(), req) - apps.begin());
-      usedBw += minBw[ind];
+  // Roots are the lowest OST of each component, so components come out in
+  // order of their lowest OST
+  vector<int> part(numOsts, -1);
+  partOsts.clear();
+  for (int i = 0; i < numOsts; i++) {
+    if (this->numReqs(i) == 0) {
+      continue;
     }
-    totalUsedBw += usedBw;
+    int root = findRoot(parent, i);
+    if (part[root] == -1) {
+      part[root] = (int)partOsts.size();
+      partOsts.push_back(vector<int>());
+    }
+    partOsts[part[root]].push_back(i);
+  }
 
-    AppAllocs_t alloc;
-    double perAppBw = 1.0 / (double)reqs[i].size();
-    for (auto req : reqs[i]) {
-      alloc.push_back(make_tuple(req, perAppBw));
+  parts.assign(partOsts.size(), ReqIncidence_t());
+  for (size_t p = 0; p < partOsts.size(); p++) {
+    vector<vector<int>> reqs;
+    for (auto i : partOsts[p]) {
+      reqs.push_back(vector<int>());
+      for (int k = this->reqStart[i]; k < this->reqStart[i + 1]; k++) {
+        reqs.back().push_back(this->apps[this->reqApp[k]]);
+      }
     }
-    allocs.push_back(alloc);
+    parts[p].build(reqs);
   }
+}
 
-  runEffStorageSysUtil.push_back(totalUsedBw);
+// Index of an app in the GIFT database, adding it on first sight
+static size_t getAppData(int app)
+{
+  auto it = appDbIndex.find(app);
+  if (it != appDbIndex.end()) {
+    return it->second;
+  }
+  appDatabase.push_back(AppData_t());
+  appDatabase.back().app_id = app;
+  appDatabase.back().bw_issued = GIFT_COUP_BW_SZ * GIFT_WINDOW_LEN;
+  appDatabase.back().bw_redeemed = GIFT_COUP_BW_SZ * GIFT_WINDOW_LEN;
+  appDbIndex[app] = appDatabase.size() - 1;
+  return appDatabase.size() - 1;
+}
 
-  delete [] minBw;
+#ifdef USE_CLP
+AllocLp::AllocLp()
+  : _model(new ClpSimplex())
+{
 }
 
-void LnetMds::computeBwAllocationsGIFT(const size_t NUM_OSTS,
-                                       const std::vector<std::vector<int>> &reqs,
-                                       MapOstToAppAllocs_t &allocs)
+AllocLp::~AllocLp()
 {
-  // Create a flat vector
-  vector<int> flat;
-  for (size_t i = 0; i < NUM_OSTS; i++) {
-    for (auto req : reqs[i]) {
-      flat.push_back(req);
-    }
-  }
+  delete this->_model;
+}
 
-  // Determine the number of applications doing I/O
-  set<int> s = set<int>(flat.begin(), flat.end());
-  vector<int> apps(s.begin(), s.end());
-  const int numApps = (int)apps.size();
+// Reload the whole problem, columns in dense app order
+void AllocLp::load(const ReqIncidence_t &m, const double *collb,
+                   const double *colub, const double *obj)
+{
+  const size_t NUM_OSTS = m.numOsts;
+  const int numApps = m.numApps();
 
-  // Row Order matrix
-  const bool cOrd = false;
+  // Column Order matrix holding only the non-zero (OST, app) cells
+  const bool cOrd = true;
 
-  // Row Indices
-  int* rInd = NULL;
-  rInd = new int[NUM_OSTS * numApps];
-  for (size_t i = 0; i < NUM_OSTS; i++) {
-    for (int j = 0; j < numApps; j++) {
-      rInd[(i * numApps) + j] = i;
-    }
+  // Column Starts
+  CoinBigIndex* cStart = NULL;
+  cStart = new CoinBigIndex[numApps + 1];
+  for (int j = 0; j <= numApps; j++) {
+    cStart[j] = m.appStart[j];
   }
 
-  // Col Indices
-  int* cInd = NULL;
-  cInd = new int[NUM_OSTS * numApps];
-  for (size_t i = 0; i < NUM_OSTS; i++) {
-    for (int j = 0; j < numApps; j++) {
-      cInd[(i * numApps) + j] = j;
-    }
-  }
+  // Number of elements in the constraints matrix
+  CoinBigIndex numels = cStart[numApps];
 
-  // Constraints matrix
+  // Row Indices and constraints of each column
+  int* rInd = NULL;
+  rInd = new int[numels];
   double* ele = NULL;
-  ele = new double[NUM_OSTS * numApps];
-  memset(ele, 0, (NUM_OSTS * numApps) * sizeof(double));
-  for (size_t i = 0; i < NUM_OSTS; i++) {
-    for (auto req : reqs[i]) {
-      int app = (int)(find(apps.begin(), apps.end(), req) - apps.begin());
-      ele[(i * numApps) + app] += 1;
-    }
+  ele = new double[numels];
+  for (CoinBigIndex k = 0; k < numels; k++) {
+    rInd[k] = m.appOst[k];
+    ele[k] = m.appCnt[k];
   }
 
-  // Number of elements in the constraints matrix
-  CoinBigIndex numels = NUM_OSTS * numApps;
-
   // Make a matrix of constraints
-  const CoinPackedMatrix matrix(cOrd, rInd, cInd, ele, numels);
+  const CoinPackedMatrix matrix(cOrd, NUM_OSTS, numApps, numels, ele, rInd, cStart, NULL);
 
-  // Lower allocation bound for each app
-  double* alcs = NULL;
-  alcs = new double[numApps];	
-  fill_n(alcs, numApps, numeric_limits<double>::infinity());
+  // The upper and lower bounds of each OST
+  double rowlb[NUM_OSTS], rowub[NUM_OSTS];
+  memset(rowlb, 0, NUM_OSTS * sizeof(double));
+  fill_n(rowub, NUM_OSTS, 1);
 
-  int* osts = NULL;
-  osts = new int[numApps];
-  memset(osts, 0, numApps * sizeof(int));
+  this->_model->loadProblem(matrix, collb, colub, obj, rowlb, rowub, NULL);
 
-  vector<double> apTh; // = {true, false, true, false, true};
-  bool found = false;
-  for (auto app : apps) {
-    found = false;
-    for (auto base : appDatabase) {
-      if (base.app_id == app) {
-        if ((base.bw_redeemed / base.bw_issued) >= GIFT_RDMP_RT_TH) {
-          apTh.push_back(base.bw_redeemed - (base.bw_issued * GIFT_RDMP_RT_TH));
-        } else {
-          apTh.push_back(0.0);
-        }
-        found = true;
-        break;
-      }
+  this->_colApp = m.apps;
+  this->_appCol.clear();
+  this->_colCells.assign(numApps, vector<pair<int, int>>());
+  for (int a = 0; a < numApps; a++) {
+    this->_appCol[m.apps[a]] = a;
+    for (int k = m.appStart[a]; k < m.appStart[a + 1]; k++) {
+      this->_colCells[a].push_back(make_pair(m.appOst[k], m.appCnt[k]));
     }
+  }
 
-    if (!found) {
-      appDatabase.push_back(AppData_t());
-      appDatabase.back().app_id = app;
-      appDatabase.back().bw_issued = GIFT_COUP_BW_SZ * GIFT_WINDOW_LEN;
-      appDatabase.back().bw_redeemed = GIFT_COUP_BW_SZ * GIFT_WINDOW_LEN;
-      apTh.push_back(appDatabase.back().bw_redeemed - (appDatabase.back().bw_issued * GIFT_RDMP_RT_TH));
-    }
+  delete [] cStart;
+  delete [] rInd;
+  delete [] ele;
+}
+
+// Patch the loaded problem into this epoch's one. Returns false, leaving
+// the model untouched, when too much changed for patching to pay off.
+bool AllocLp::update(const ReqIncidence_t &m, const double *collb,
+                     const double *colub, const double *obj)
+{
+  const int numRows = this->_model->numberRows();
+  const int numCols = (int)this->_colApp.size();
+  const int numApps = m.numApps();
+
+  if (numCols == 0) {
+    return false;
   }
 
-  for (size_t i = 0; i < NUM_OSTS; i++) {
-    double alc = 1.0 / (double)reqs[i].size();
-    for (auto req : reqs[i]) {
-      int app = (int)(find(apps.begin(), apps.end(), req) - apps.begin());
-      alcs[app] = min(alcs[app], alc);
-      osts[app] += 1;
+  vector<int> gone;
+  for (int c = 0; c < numCols; c++) {
+    if (m.index.find(this->_colApp[c]) == m.index.end()) {
+      gone.push_back(c);
     }
   }
+  int added = numApps - (numCols - (int)gone.size());
+  if ((int)(gone.size() + added) * 2 > numCols) {
+    return false;
+  }
 
-  double efbw[NUM_OSTS];
-  memset(efbw, 0.0, NUM_OSTS * sizeof(double));
-  for (size_t i = 0; i < NUM_OSTS; i++) {
-    for (auto req : reqs[i]) {
-      int app = (int)(find(apps.begin(), apps.end(), req) - apps.begin());
-      efbw[i] += alcs[app];
+  // OSTs that joined get a row, OSTs beyond the current count lose theirs
+  for (int i = numRows; i < (int)m.numOsts; i++) {
+    this->_model->addRow(0, NULL, NULL, 0.0, 1.0);
+  }
+  if ((int)m.numOsts < numRows) {
+    vector<int> rows;
+    for (int i = (int)m.numOsts; i < numRows; i++) {
+      rows.push_back(i);
+    }
+    this->_model->deleteRows((int)rows.size(), rows.data());
+    for (auto &cells : this->_colCells) {
+      while (!cells.empty() && (cells.back().first >= (int)m.numOsts)) {
+        cells.pop_back();
+      }
     }
-    //cout << efbw[i] << endl;
   }
 
-  /* for (int i = 0; i < numApps; i++) {
-     cout << alcs[i] << endl;
-     cout << osts[i] << endl;
-     } */
-
-  int    numCoups = 0;
-  double valCoups = 0.0;
-
-  vector<double> bwRd;
-  vector<int> apps_cpy = apps;
-  random_shuffle(apps_cpy.begin(), apps_cpy.end());
-  for (auto app : apps_cpy) {
-    double bwRq = 0.0;
-    for (auto base : appDatabase) {
-      if (base.app_id == app) {
-        bwRq = base.bw_issued - base.bw_redeemed;
-        break;
+  // Apps that vanished lose their column
+  if (!gone.empty()) {
+    this->_model->deleteColumns((int)gone.size(), gone.data());
+    size_t next = 0, out = 0;
+    for (int c = 0; c < numCols; c++) {
+      if ((next < gone.size()) && (gone[next] == c)) {
+        next++;
+        continue;
       }
+      this->_colApp[out] = this->_colApp[c];
+      this->_colCells[out].swap(this->_colCells[c]);
+      out++;
     }
+    this->_colApp.resize(out);
+    this->_colCells.resize(out);
+    this->_appCol.clear();
+    for (size_t c = 0; c < out; c++) {
+      this->_appCol[this->_colApp[c]] = c;
+    }
+  }
 
-    if (bwRq == 0.0) {
-      bwRd.push_back(0.0);
+  vector<int> rows;
+  vector<double> els;
+  for (int a = 0; a < numApps; a++) {
+    auto it = this->_appCol.find(m.apps[a]);
+
+    // Apps that appeared get a new column
+    if (it == this->_appCol.end()) {
+      rows.clear();
+      els.clear();
+      vector<pair<int, int>> cells;
+      for (int k = m.appStart[a]; k < m.appStart[a + 1]; k++) {
+        rows.push_back(m.appOst[k]);
+        els.push_back(m.appCnt[k]);
+        cells.push_back(make_pair(m.appOst[k], m.appCnt[k]));
+      }
+      this->_model->addColumn((int)rows.size(), rows.data(), els.data(),
+                              collb[a], colub[a], obj[a]);
+      this->_appCol[m.apps[a]] = (int)this->_colApp.size();
+      this->_colApp.push_back(m.apps[a]);
+      this->_colCells.push_back(cells);
       continue;
     }
 
-    double bwAv = numeric_limits<double>::infinity();
-    for (size_t i = 0; i < NUM_OSTS; i++) {
-      int numReqs = 0;
-      for (auto req : reqs[i]) {
-        if (req == app) {
-          numReqs += 1;
-        }
-      }
-      if (numReqs == 0) {
+    // Merge the old and new cells of the column, both in OST order
+    const int c = it->second;
+    vector<pair<int, int>> &cells = this->_colCells[c];
+    vector<pair<int, int>> now;
+    size_t o = 0;
+    int k = m.appStart[a];
+    while ((o < cells.size()) || (k < m.appStart[a + 1])) {
+      if ((k == m.appStart[a + 1]) ||
+          ((o < cells.size()) && (cells[o].first < m.appOst[k]))) {
+        this->_model->modifyCoefficient(cells[o].first, c, 0.0);
+        o++;
         continue;
       }
-      if (efbw[i] == 1.0) {
-        bwAv = 0.0;
-        break;
+      if ((o == cells.size()) || (m.appOst[k] < cells[o].first) ||
+          (m.appCnt[k] != cells[o].second)) {
+        this->_model->modifyCoefficient(m.appOst[k], c, m.appCnt[k]);
       }
-      bwAv = min(bwAv, ((1.0 - efbw[i])/(double)numReqs));
-    }
-
-    if (bwAv == 0.0) {
-      bwRd.push_back(0.0);
-      continue;
-    }
-
-    int index = 0;
-    for (auto a : apps) {
-      if (a == app) {
-        break;
+      if ((o < cells.size()) && (cells[o].first == m.appOst[k])) {
+        o++;
       }
-      index++;
+      now.push_back(make_pair(m.appOst[k], m.appCnt[k]));
+      k++;
     }
+    cells.swap(now);
 
-    double bwGv = min(bwRq, bwAv * osts[index]);
-    for (auto& base : appDatabase) {
-      if (base.app_id == app) {
-        for (size_t i = 0; i < NUM_OSTS; i++) {
-          int numReqs = 0;
-          for (auto req : reqs[i]) {
-            if (req == app) {
-              numReqs += 1;
-            }
-          }
-          if (numReqs == 0) {
-            continue;
-          }
-          efbw[i] -= ((bwGv / (double)osts[index]) * (double)numReqs);
-        }
-        base.bw_redeemed += (double)((int)(bwGv / GIFT_COUP_BW_SZ)) * GIFT_COUP_BW_SZ;
-        break;
-      }
-    }
-    valCoups -= (double)((int)(bwGv / GIFT_COUP_BW_SZ)) * GIFT_COUP_BW_SZ;
-    sys_coup_rdmp += (double)((int)(bwGv / GIFT_COUP_BW_SZ)) * GIFT_COUP_BW_SZ;
-    bwRd.push_back(bwGv/(double)osts[index]);
+    this->_model->setColumnLower(c, collb[a]);
+    this->_model->setColumnUpper(c, colub[a]);
+    this->_model->setObjectiveCoefficient(c, obj[a]);
   }
 
-  double* collb = NULL;
-  collb = new double[numApps];
-  double* fsbw = NULL;
-  fsbw = new double[numApps];
-  fill_n(collb, numApps, numeric_limits<double>::infinity());
-  fill_n(fsbw, numApps, numeric_limits<double>::infinity());
+  return true;
+}
 
-  for (int app = 0; app < numApps; app++) {
-    if (((sys_coup_issu == 0.0) or ((sys_coup_issu != 0.0) && ((sys_coup_rdmp/sys_coup_issu) > GIFT_SYS_RDMP_T))) && (apTh[app] > 0.0)) {
-      if (apTh[app] > ((alcs[app] * GIFT_B_THRESOLD) * osts[app])) {
-        collb[app] = (alcs[app] * (1.0 - GIFT_B_THRESOLD)) + bwRd[app];
-      } else {
-        collb[app] = alcs[app] - (apTh[app] / (double)osts[app]) + bwRd[app];
-      }
-    } else {
-      collb[app] = alcs[app] + bwRd[app];
-    }
-    fsbw[app] = alcs[app] + bwRd[app];
+const double *AllocLp::solve(const ReqIncidence_t &m, const double *collb,
+                             const double *colub, const double *obj)
+{
+  if (!this->update(m, collb, colub, obj)) {
+    this->load(m, collb, colub, obj);
   }
+  this->_model->primal();
 
-  /*
-     for (size_t i = 0; i < NUM_OSTS; i++) {
-     double alloc = 1.0 / (double)reqs[i].size();
-     for (auto req : reqs[i]) {
-     int app = (int)(find(apps.begin(), apps.end(), req) - apps.begin());
-     if (apTh[app]) {
-     collb[app] = min(collb[app], (alloc * (1.0 - GIFT_B_THRESOLD)) + bwRd[app]);
-     } else {
-     collb[app] = min(collb[app], alloc + bwRd[app]);
-     }
-     fsbw[app] = min(fsbw[app], alloc + bwRd[app]);
-     }
-     }*/
+  const double *cVal = this->_model->primalColumnSolution();
+  this->_val.resize(m.numApps());
+  for (int a = 0; a < m.numApps(); a++) {
+    this->_val[a] = cVal[this->_appCol[m.apps[a]]];
+  }
+  return this->_val.data();
+}
 
-  // Upper allocation bound for each app
-  double* colub = NULL;
-  colub = new double[numApps];
-  fill_n(colub, numApps, 1);
+double AllocLp::getObjValue() const
+{
+  return this->_model->getObjValue();
+}
 
-  // The cooefficients of the minimum objective function
-  double* obj = NULL;
-  obj = new double[numApps];
-  memset(obj, 0, numApps * sizeof(double));
-  for (auto f : flat) {
-    int app = (int)(find(apps.begin(), apps.end(), f) - apps.begin());
-    obj[app] -= 1;
+SplitAllocLp::SplitAllocLp(unsigned numThreads)
+  : _objValue(0.0),
+    _lock(new std::mutex()),
+    _workReady(new std::condition_variable()),
+    _workDone(new std::condition_variable()),
+    _pending(0),
+    _stop(false)
+{
+  for (unsigned t = 1; t < numThreads; t++) {
+    this->_workers.push_back(thread(&SplitAllocLp::workerLoop, this));
   }
+}
 
-  // The upper and lower bounds of each OST
-  double rowlb[NUM_OSTS], rowub[NUM_OSTS];
-  memset(rowlb, 0, NUM_OSTS * sizeof(double));
-  fill_n(rowub, NUM_OSTS, 1);
-
-  ClpSimplex model;
-  model.loadProblem(matrix, collb, colub, obj, rowlb, rowub, NULL);
-  model.primal();
-  double* cVal = model.primalColumnSolution();
+SplitAllocLp::~SplitAllocLp()
+{
+  {
+    lock_guard<mutex> lk(*this->_lock);
+    this->_stop = true;
+  }
+  this->_workReady->notify_all();
+  for (auto &t : this->_workers) {
+    t.join();
+  }
+  delete this->_workDone;
+  delete this->_workReady;
+  delete this->_lock;
+  for (auto part : this->_parts) {
+    delete part.second;
+  }
+  this->_parts.clear();
+}
 
-  bool* done = NULL;
-  done = new bool[numApps];
-  fill_n(done, numApps, false);
+const double *SplitAllocLp::solve(const ReqIncidence_t &m, const double *collb,
+                                  const double *colub, const double *obj)
+{
+  vector<ReqIncidence_t> parts;
+  vector<vector<int>> partOsts;
+  m.split(parts, partOsts);
+  const size_t numParts = parts.size();
+
+  // Bounds and objective of each component, in its own dense app order
+  vector<vector<double>> lb(numParts), ub(numParts), ob(numParts);
+  vector<vector<double>> val(numParts);
+  vector<double> objValue(numParts, 0.0);
+  vector<AllocLp*> lps(numParts, NULL);
+  map<int, AllocLp*> live;
+  for (size_t p = 0; p < numParts; p++) {
+    for (auto app : parts[p].apps) {
+      int a = m.index.at(app);
+      lb[p].push_back(collb[a]);
+      ub[p].push_back(colub[a]);
+      ob[p].push_back(obj[a]);
+    }
+
+    // A lone app only has to fit the OST it loads the most
+    if (parts[p].numApps() == 1) {
+      int cnt = *max_element(parts[p].ostCnt.begin(), parts[p].ostCnt.end());
+      double cap = min(ub[p][0], 1.0 / (double)cnt);
+      if (lb[p][0] <= cap) {
+        val[p].push_back((ob[p][0] < 0.0) ? cap : lb[p][0]);
+        objValue[p] = ob[p][0] * val[p][0];
+        continue;
+      }
+    }
 
-  // Determine allocation of the bandwidth
-  for (size_t i = 0; i < NUM_OSTS; i++) {
-    double usedBw = 0.0;
-    for (auto req : reqs[i]) {
-      int ind = (int)(find(apps.begin(), apps.end(), req) - apps.begin());
-      usedBw += cVal[ind];
+    // Components keep their model while their lowest OST stays the same
+    int key = partOsts[p].front();
+    auto it = this->_parts.find(key);
+    if (it != this->_parts.end()) {
+      lps[p] = it->second;
+      this->_parts.erase(it);
+    } else {
+      lps[p] = new AllocLp();
     }
+    live[key] = lps[p];
+  }
 
-    double xtraBw = 0.0;
-    if ((ALLOC_XTRA_BW == true) && (ALLOC_X_BW_EQ == true)) {
-      xtraBw = (1.0 - usedBw) / (double)reqs[i].size();
+  // Models of components that broke up or went away are dropped
+  for (auto part : this->_parts) {
+    delete part.second;
+  }
+  this->_parts.swap(live);
+
+  // Largest components first, so that one big solve is not left for last
+  vector<size_t> order;
+  for (size_t p = 0; p < numParts; p++) {
+    if (lps[p] != NULL) {
+      order.push_back(p);
     }
+  }
+  sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+    return parts[a].ostApp.size() > parts[b].ostApp.size();
+  });
+
+  {
+    unique_lock<mutex> lk(*this->_lock);
+    this->_solvePart = [&](size_t p) {
+      const double *cVal = lps[p]->solve(parts[p], lb[p].data(), ub[p].data(), ob[p].data());
+      val[p].assign(cVal, cVal + parts[p].numApps());
+      objValue[p] = lps[p]->getObjValue();
+    };
+    this->_queue.assign(order.begin(), order.end());
+    this->_pending = order.size();
+    this->_workReady->notify_all();
+    while (this->solveNext(lk)) {
+    }
+    this->_workDone->wait(lk, [this]() { return this->_pending == 0; });
+    this->_solvePart = nullptr;
+  }
 
-    AppAllocs_t alloc;
+  // Merge the components back into dense app order
+  this->_val.assign(m.numApps(), 0.0);
+  this->_objValue = 0.0;
+  for (size_t p = 0; p < numParts; p++) {
+    for (int j = 0; j < parts[p].numApps(); j++) {
+      this->_val[m.index.at(parts[p].apps[j])] = val[p][j];
+    }
+    this->_objValue += objValue[p];
+  }
+  return this->_val.data();
+}
 
-    for (auto req : reqs[i]) {
-      int ind = (int)(find(apps.begin(), apps.end(), req) - apps.begin());
-      if ((ALLOC_XTRA_BW == true) && (ALLOC_X_BW_EQ == false)) {
-        xtraBw = (1.0 - usedBw) * (cVal[ind] / usedBw);
-      }
-      alloc.push_back(make_tuple(req, cVal[ind] + xtraBw));
+// Solve the next queued component, if any, with _lock released meanwhile.
+// Called with _lock held.
+bool SplitAllocLp::solveNext(unique_lock<mutex> &lk)
+{
+  if (this->_queue.empty()) return false;
+  size_t p = this->_queue.front();
+  this->_queue.pop_front();
+  lk.unlock();
+  this->_solvePart(p);
+  lk.lock();
+  if (--this->_pending == 0) {
+    this->_workDone->notify_all();
+  }
+  return true;
+}
 
-      if ((!done[ind]) && (cVal[ind] < fsbw[ind])) {
-        done[ind] = true;
-        for (auto& base : appDatabase) {
-          if (base.app_id == req) {
-            base.bw_redeemed -= (double)((int)(((fsbw[ind] - cVal[ind]) * osts[ind]) / GIFT_COUP_BW_SZ)) * GIFT_COUP_BW_SZ;
-            numCoups += (int)(((fsbw[ind] - cVal[ind]) * osts[ind]) / GIFT_COUP_BW_SZ);
-            valCoups += (double)((int)(((fsbw[ind] - cVal[ind]) * osts[ind]) / GIFT_COUP_BW_SZ)) * GIFT_COUP_BW_SZ;
-            sys_coup_issu += (double)((int)(((fsbw[ind] - cVal[ind]) * osts[ind]) / GIFT_COUP_BW_SZ)) * GIFT_COUP_BW_SZ;
-            //cout << "APP: " << base.app_id << endl;
-            //cout << "ZOM: " << fsbw[ind] << endl;
-            //cout << "RED: " << cVal[ind] << endl;
-            //cout << "GOD: " << osts[ind] << endl;
-            break;
-          }
-        }
-      }
+void SplitAllocLp::workerLoop()
+{
+  unique_lock<mutex> lk(*this->_lock);
+  while (!this->_stop) {
+    if (!this->solveNext(lk)) {
+      this->_workReady->wait(lk);
     }
-    allocs.push_back(alloc);
   }
+}
 
-  numCouponsIssued.push_back(numCouponsIssued.back() + numCoups);
-  valCouponsIssued.push_back(valCouponsIssued.back() + valCoups);
+double SplitAllocLp::getObjValue() const
+{
+  return this->_objValue;
+}
+#endif // ifdef USE_CLP
 
-  // Determine effective storage system utilization	
-  if (model.getObjValue() < 0) {
-    runEffStorageSysUtil.push_back(-1 * model.getObjValue());
+static size_t hashReqs(Policy_t policy, const vector<vector<int>> &reqs)
+{
+  size_t h = hash<int>()(policy);
+  auto mix = [&h](size_t v) { h ^= v + 0x9e3779b9 + (h << 6) + (h >> 2); };
+  mix(reqs.size());
+  for (auto &r : reqs) {
+    mix(r.size());
+    for (int app : r) {
+      mix(hash<int>()(app));
+    }
   }
+  return h;
+}
 
-  delete [] rInd;
-  delete [] cInd;
-  delete [] ele;
-  delete [] alcs;
-  delete [] osts;
-  delete [] collb;
-  delete [] fsbw;
-  delete [] colub;
-  delete [] obj;
-  delete [] done;
+AllocCache::AllocCache(size_t capacity)
+  : _capacity(capacity),
+    _missUtil(0),
+    _hits(0),
+    _misses(0),
+    _savedTime(0.0)
+{
 }
 
-void LnetMds::computeBwAllocationsBSIP(const size_t NUM_OSTS,
-                                       const std::vector<std::vector<int>> &reqs,
-                                       MapOstToAppAllocs_t &allocs)
+bool AllocCache::lookup(Policy_t policy, const vector<vector<int>> &reqs,
+                        MapOstToAppAllocs_t &allocs)
 {
-  // Create a flat vector
-  vector<int> flat;
-  for (size_t i = 0; i < NUM_OSTS; i++) {
-    for (auto req : reqs[i]) {
-      flat.push_back(req);
+  // The policies only depend on how many requests each app has on each OST
+  this->_miss.policy = policy;
+  this->_miss.reqs = reqs;
+  for (auto &r : this->_miss.reqs) {
+    sort(r.begin(), r.end());
+  }
+  this->_miss.hash = hashReqs(policy, this->_miss.reqs);
+
+  auto range = this->_index.equal_range(this->_miss.hash);
+  for (auto it = range.first; it != range.second; it++) {
+    auto e = it->second;
+    if (e->policy != policy || e->reqs != this->_miss.reqs) continue;
+    this->_lru.splice(this->_lru.begin(), this->_lru, e);
+    allocs = e->allocs;
+    runEffStorageSysUtil.insert(runEffStorageSysUtil.end(), e->util.begin(), e->util.end());
+    this->_hits++;
+    this->_savedTime += e->solveTime;
+    return true;
+  }
+  this->_misses++;
+  this->_missUtil = runEffStorageSysUtil.size();
+  return false;
+}
+
+void AllocCache::insert(const MapOstToAppAllocs_t &allocs, double solveTime)
+{
+  if (this->_capacity == 0) return;
+  if (this->_lru.size() == this->_capacity) {
+    auto range = this->_index.equal_range(this->_lru.back().hash);
+    for (auto it = range.first; it != range.second; it++) {
+      if (it->second == prev(this->_lru.end())) {
+        this->_index.erase(it);
+        break;
+      }
     }
+    this->_lru.pop_back();
   }
+  this->_miss.allocs = allocs;
+  this->_miss.util.assign(runEffStorageSysUtil.begin() + this->_missUtil,
+                          runEffStorageSysUtil.end());
+  this->_miss.solveTime = solveTime;
+  this->_lru.push_front(std::move(this->_miss));
+  this->_index.insert(make_pair(this->_lru.front().hash, this->_lru.begin()));
+  this->_miss = Entry_t();
+}
 
-  // Determine the number of applications doing I/O
-  set<int> s = set<int>(flat.begin(), flat.end());
-  vector<int> apps(s.begin(), s.end());
-  const int numApps = (int)apps.size();
+void AllocCache::printStats() const
+{
+  size_t total = this->_hits + this->_misses;
+  if (total == 0) return;
+  cout << "Allocation cache: " << this->_hits << "/" << total << " hits ("
+       << 100.0 * this->_hits / total << "%), saved "
+       << this->_savedTime * 1e3 << " ms of solves" << endl;
+}
 
-  // Determine the minimum bandwidth of each app after fair share
-  double* minBw = NULL;
-  minBw = new double[numApps];
-  fill_n(minBw, numApps, numeric_limits<double>::infinity());
+// Minimum bandwidth of each app after fair share on every OST it uses
+static void fairShareMinBw(const ReqIncidence_t &m, double *minBw)
+{
+  fill_n(minBw, m.numApps(), numeric_limits<double>::infinity());
 
-  for (size_t i = 0; i < NUM_OSTS; i++) {
-    double alloc = 1.0 / (double)reqs[i].size();
-    for (auto req : reqs[i]) {
-      int ind = (int)(find(apps.begin(), apps.end(), req) - apps.begin());
+  for (size_t i = 0; i < m.numOsts; i++) {
+    double alloc = 1.0 / (double)m.numReqs(i);
+    for (int k = m.ostStart[i]; k < m.ostStart[i + 1]; k++) {
+      int ind = m.ostApp[k];
       minBw[ind] = min(minBw[ind], alloc);
     }
   }
+}
 
-  // Determine effective storage system utilization and allocation of the bandwidth
+// Allocate minBw to every request and record the effective utilization
+static void allocateMinBw(const ReqIncidence_t &m, const double *minBw,
+                          MapOstToAppAllocs_t &allocs)
+{
   double totalUsedBw = 0.0;
-  for (size_t i = 0; i < NUM_OSTS; i++) {
+  for (size_t i = 0; i < m.numOsts; i++) {
     double usedBw = 0.0;
-    for (auto req : reqs[i]) {
-      int ind = (int)(find(apps.begin(), apps.end(), req) - apps.begin());
-      usedBw += minBw[ind];
+    for (int k = m.reqStart[i]; k < m.reqStart[i + 1]; k++) {
+      usedBw += minBw[m.reqApp[k]];
     }
     totalUsedBw += usedBw;
 
     double xtraBw = 0.0;
     if ((ALLOC_XTRA_BW == true) && (ALLOC_X_BW_EQ == true)) {
-      xtraBw = (1.0 - usedBw) / (double)reqs[i].size();
+      xtraBw = (1.0 - usedBw) / (double)m.numReqs(i);
     }
 
     AppAllocs_t alloc;
-    for (auto req : reqs[i]) {
-      int ind = (int)(find(apps.begin(), apps.end(), req) - apps.begin());
+    for (int k = m.reqStart[i]; k < m.reqStart[i + 1]; k++) {
+      int ind = m.reqApp[k];
       if ((ALLOC_XTRA_BW == true) && (ALLOC_X_BW_EQ == false)) {
         xtraBw = (1.0 - usedBw) * (minBw[ind] / usedBw);
       }
-      alloc.push_back(make_tuple(req, minBw[ind] + xtraBw));
+      alloc.push_back(make_tuple(m.apps[ind], minBw[ind] + xtraBw));
     }
     allocs.push_back(alloc);
   }
 
   runEffStorageSysUtil.push_back(totalUsedBw);
-
-  delete [] minBw;
 }
 
-void LnetMds::computeBwAllocationsTSA(const size_t NUM_OSTS,
-                                      const std::vector<std::vector<int>> &reqs,
-                                      MapOstToAppAllocs_t &allocs)
+// Progressive filling: the rate of every app rises from its lower bound at
+// the same pace until the app reaches its upper bound or one of its OSTs is
+// full, which gives the max-min fair allocation in O(nnz log nnz). Returns
+// true when every OST with requests ends up exactly full. The allocation
+// then also maximizes sum(appReqs * x), as that sum is the total OST usage
+// and each OST can give at most 1, so no LP solve is needed.
+bool waterFill(const ReqIncidence_t &m, const double *lb, const double *ub, double *x)
 {
-  // Create a flat vector
-  vector<int> flat;
-  for (size_t i = 0; i < NUM_OSTS; i++) {
-    for (auto req : reqs[i]) {
-      flat.push_back(req);
+  const int numOsts = (int)m.numOsts;
+  const int numApps = m.numApps();
+  const double EPS = 1e-9;
+
+  // (level, kind, app or OST, version), lowest level first
+  enum { Join, Cap, Full };
+  using Event_t = tuple<double, int, int, int>;
+  priority_queue<Event_t, vector<Event_t>, greater<Event_t>> events;
+
+  vector<double> fixedUse(numOsts, 0.0); // usage of the apps not rising
+  vector<int> slope(numOsts, 0);         // requests of the rising apps
+  vector<int> version(numOsts, 0);
+  vector<bool> full(numOsts, false);
+  vector<int> state(numApps, Join);      // Join: waiting, Cap: rising, Full: frozen
+  bool feasible = true;
+
+  for (int a = 0; a < numApps; a++) {
+    x[a] = lb[a];
+    if (lb[a] > ub[a] + EPS) {
+      feasible = false;
+    }
+    for (int k = m.appStart[a]; k < m.appStart[a + 1]; k++) {
+      fixedUse[m.appOst[k]] += m.appCnt[k] * lb[a];
+    }
+    if (lb[a] >= ub[a]) {
+      state[a] = Full;
+    } else {
+      events.push(make_tuple(lb[a], (int)Join, a, 0));
     }
   }
-
-  // Determine the number of applications doing I/O
-  set<int> s = set<int>(flat.begin(), flat.end());
-  vector<int> apps(s.begin(), s.end());
-  const int numApps = (int)apps.size();
-
-  unsigned int* appSize = NULL;
-  appSize = new unsigned int[numApps];
-  fill_n(appSize, numApps, 0);
-  double meanSize = 0.0;
-
-  // Determine the size of the applications
-  for (size_t i = 0; i < NUM_OSTS; i++) {
-    for (auto req : reqs[i]) {
-      int ind = (int)(find(apps.begin(), apps.end(), req) - apps.begin());
-      appSize[ind] += 1;
-      meanSize += 1;
-    }
+  for (int i = 0; i < numOsts; i++) {
+    full[i] = (fixedUse[i] >= 1.0 - EPS);
   }
 
-  /* cout << "NEW" << endl;
-     for (int i = 0; i < numApps; i++) {
-     cout << "App " << apps[i] << " has size " << appSize[i] << "." << endl;
-     } */
-  meanSize = meanSize / (double)numApps;
-  // cout << "Mean size " << meanSize << endl;
-
-  // Determine the minimum bandwidth of each app after fair share
-  double* minBw = NULL;
-  minBw = new double[numApps];
-  fill_n(minBw, numApps, numeric_limits<double>::infinity());
-
-  for (size_t i = 0; i < NUM_OSTS; i++) {
-    double alloc = 1.0 / (double)reqs[i].size();
-    for (auto req : reqs[i]) {
-      int ind = (int)(find(apps.begin(), apps.end(), req) - apps.begin());
-      minBw[ind] = min(minBw[ind], alloc);
-    }
-  }
-
-  // Throttle some jobs' bandwidth
-  bool* thtBw = NULL;
-  thtBw = new bool[numApps];
-  for (int i = 0; i < numApps; i++) {
-    if (appSize[i] <= meanSize) {
-      minBw[i] = minBw[i] * (1.0 - TSA_B_THRESHOLD);
-      thtBw[i] = true;
+  auto schedule = [&](int i, double level) {
+    version[i]++;
+    if ((!full[i]) && (slope[i] > 0)) {
+      double at = (1.0 - fixedUse[i]) / (double)slope[i];
+      events.push(make_tuple(max(at, level), (int)Full, i, version[i]));
+    }
+  };
+
+  auto freeze = [&](int a, double level) {
+    state[a] = Full;
+    x[a] = level;
+    for (int k = m.appStart[a]; k < m.appStart[a + 1]; k++) {
+      int i = m.appOst[k];
+      fixedUse[i] += m.appCnt[k] * level;
+      slope[i] -= m.appCnt[k];
+      schedule(i, level);
+    }
+  };
+
+  while (!events.empty()) {
+    double level = get<0>(events.top());
+    int kind = get<1>(events.top());
+    int id = get<2>(events.top());
+    int ver = get<3>(events.top());
+    events.pop();
+
+    if (kind == Join) {
+      if (state[id] != Join) {
+        continue;
+      }
+      bool blocked = false;
+      for (int k = m.appStart[id]; k < m.appStart[id + 1]; k++) {
+        blocked = blocked || full[m.appOst[k]];
+      }
+      if (blocked) {
+        state[id] = Full;
+        continue;
+      }
+      state[id] = Cap;
+      for (int k = m.appStart[id]; k < m.appStart[id + 1]; k++) {
+        int i = m.appOst[k];
+        fixedUse[i] -= m.appCnt[k] * lb[id];
+        slope[i] += m.appCnt[k];
+        schedule(i, level);
+      }
+      events.push(make_tuple(ub[id], (int)Cap, id, 0));
+    } else if (kind == Cap) {
+      if (state[id] == Cap) {
+        freeze(id, level);
+      }
     } else {
-      minBw[i] = numeric_limits<double>::infinity();
-      thtBw[i] = false;
-    }
-    // cout << "App " << apps[i] << " has b/w " << thtBw[i] << "." << endl;
-  }
-
-  // Increase bandwidth allocations of other jobs
-  for (size_t i = 0; i < NUM_OSTS; i++) {
-    int numJobs = 0;
-    double usedBw = 0.0;
-    for (auto req : reqs[i]) {
-      int ind = (int)(find(apps.begin(), apps.end(), req) - apps.begin());
-      if (thtBw[ind] == true) {
-        numJobs += 1;
-        usedBw += minBw[ind];
+      if ((ver != version[id]) || full[id]) {
+        continue;
       }
-    }
-
-    double alloc = (1.0 - usedBw) / ((int)reqs[i].size() - numJobs);
-    // cout << i << " " << alloc << endl;
-    for (auto req : reqs[i]) {
-      int ind = (int)(find(apps.begin(), apps.end(), req) - apps.begin());
-      if (thtBw[ind] == false) {
-        minBw[ind] = min(minBw[ind], alloc);
+      full[id] = true;
+      for (int k = m.ostStart[id]; k < m.ostStart[id + 1]; k++) {
+        if (state[m.ostApp[k]] == Cap) {
+          freeze(m.ostApp[k], level);
+        }
       }
     }
   }
 
-  // Determine effective storage system utilization and allocation of the bandwidth
-  double totalUsedBw = 0.0;
-  for (size_t i = 0; i < NUM_OSTS; i++) {
-    double usedBw = 0.0;
-    for (auto req : reqs[i]) {
-      int ind = (int)(find(apps.begin(), apps.end(), req) - apps.begin());
-      usedBw += minBw[ind];
-    }
-    totalUsedBw += usedBw;
-
-    double xtraBw = 0.0;
-    if ((ALLOC_XTRA_BW == true) && (ALLOC_X_BW_EQ == true)) {
-      xtraBw = (1.0 - usedBw) / (double)reqs[i].size();
+  for (int i = 0; (i < numOsts) && feasible; i++) {
+    if (m.numReqs(i) == 0) {
+      continue;
     }
-
-    AppAllocs_t alloc;
-    for (auto req : reqs[i]) {
-      int ind = (int)(find(apps.begin(), apps.end(), req) - apps.begin());
-      if ((ALLOC_XTRA_BW == true) && (ALLOC_X_BW_EQ == false)) {
-        xtraBw = (1.0 - usedBw) * (minBw[ind] / usedBw);
-      }
-      alloc.push_back(make_tuple(req, minBw[ind] + xtraBw));
+    double usedBw = 0.0;
+    for (int k = m.ostStart[i]; k < m.ostStart[i + 1]; k++) {
+      usedBw += m.ostCnt[k] * x[m.ostApp[k]];
     }
-    allocs.push_back(alloc);
+    feasible = (fabs(usedBw - 1.0) <= EPS);
   }
-
-  runEffStorageSysUtil.push_back(totalUsedBw);
-
-  delete [] appSize;
-  delete [] thtBw;
-  delete [] minBw;
+  return feasible;
 }
 
-void LnetMds::computeBwAllocationsESA(const size_t NUM_OSTS,
-                                      const std::vector<std::vector<int>> &reqs,
-                                      MapOstToAppAllocs_t &allocs)
+#ifndef USE_CLP
+// Whether rates keep to the upper bounds and the capacity of every OST
+static bool withinCapacity(const ReqIncidence_t &m, const double *ub, const double *x)
 {
-  // Create a flat vector
-  vector<int> flat;
-  for (size_t i = 0; i < NUM_OSTS; i++) {
-    for (auto req : reqs[i]) {
-      flat.push_back(req);
-    }
+  const double EPS = 1e-9;
+  for (int a = 0; a < m.numApps(); a++) {
+    if (x[a] > ub[a] + EPS) return false;
   }
-
-  // Determine the number of applications doing I/O
-  set<int> s = set<int>(flat.begin(), flat.end());
-  vector<int> apps(s.begin(), s.end());
-  const int numApps = (int)apps.size();
-
-  unsigned int* appSize = NULL;
-  appSize = new unsigned int[numApps];
-  fill_n(appSize, numApps, 0);
-  double meanSize = 0.0;
-
-  // Determine the size of the applications
-  for (size_t i = 0; i < NUM_OSTS; i++) {
-    for (auto req : reqs[i]) {
-      int ind = (int)(find(apps.begin(), apps.end(), req) - apps.begin());
-      appSize[ind] += 1;
-      meanSize += 1;
+  for (int i = 0; i < (int)m.numOsts; i++) {
+    double usedBw = 0.0;
+    for (int k = m.ostStart[i]; k < m.ostStart[i + 1]; k++) {
+      usedBw += m.ostCnt[k] * x[m.ostApp[k]];
     }
+    if (usedBw > 1.0 + EPS) return false;
+  }
+  return true;
+}
+#endif // ifndef USE_CLP
+
+// Rates that maximize sum(-obj * x) within the bounds (GIFT, MBW): the
+// water-filling ones when they fill every OST in use, else the LP's. The
+// water-filling rates are left in x either way. Without the LP, lower
+// bounds that cannot be met are dropped, as POFS has none.
+const double *maxUtilRates(const ReqIncidence_t &m, const double *lb, const double *ub,
+                           const double *obj, SplitAllocLp *lp, double *x)
+{
+  if (waterFill(m, lb, ub, x)) return x;
+#ifdef USE_CLP
+  return lp->solve(m, lb, ub, obj);
+#else
+  if (!withinCapacity(m, ub, x)) {
+    cerr << "No LP to meet the lower bounds of the rates; allocating without them" << endl;
+    vector<double> noLb(m.numApps(), 0.0);
+    waterFill(m, noLb.data(), ub, x);
   }
+  return x;
+#endif
+}
 
-  meanSize = meanSize / (double)numApps;
+// Throttle the flagged apps below their fair share by threshold and give
+// the freed bandwidth to the others (TSA, ESA, TMF and RND)
+static void throttleAndAllocate(const ReqIncidence_t &m, const bool *thtBw,
+                                double threshold, MapOstToAppAllocs_t &allocs)
+{
+  const int numApps = m.numApps();
 
-  // Determine the minimum bandwidth of each app after fair share
   double* minBw = NULL;
   minBw = new double[numApps];
-  fill_n(minBw, numApps, numeric_limits<double>::infinity());
-
-  for (size_t i = 0; i < NUM_OSTS; i++) {
-    double alloc = 1.0 / (double)reqs[i].size();
-    for (auto req : reqs[i]) {
-      int ind = (int)(find(apps.begin(), apps.end(), req) - apps.begin());
-      minBw[ind] = min(minBw[ind], alloc);
-    }
-  }
+  fairShareMinBw(m, minBw);
 
   // Throttle some jobs' bandwidth
-  bool* thtBw = NULL;
-  thtBw = new bool[numApps];
   for (int i = 0; i < numApps; i++) {
-    if (appSize[i] > meanSize) {
-      minBw[i] = minBw[i] * (1.0 - ESA_B_THRESHOLD);
-      thtBw[i] = true;
+    if (thtBw[i]) {
+      minBw[i] = minBw[i] * (1.0 - threshold);
     } else {
       minBw[i] = numeric_limits<double>::infinity();
-      thtBw[i] = false;
     }
-    // cout << "App " << apps[i] << " has b/w " << thtBw[i] << "." << endl;
   }
 
   // Increase bandwidth allocations of other jobs
-  for (size_t i = 0; i < NUM_OSTS; i++) {
+  for (size_t i = 0; i < m.numOsts; i++) {
     int numJobs = 0;
     double usedBw = 0.0;
-    for (auto req : reqs[i]) {
-      int ind = (int)(find(apps.begin(), apps.end(), req) - apps.begin());
+    for (int k = m.reqStart[i]; k < m.reqStart[i + 1]; k++) {
+      int ind = m.reqApp[k];
       if (thtBw[ind] == true) {
         numJobs += 1;
         usedBw += minBw[ind];
       }
     }
 
-    double alloc = (1.0 - usedBw) / ((int)reqs[i].size() - numJobs);
-    // cout << i << " " << alloc << endl;
-    for (auto req : reqs[i]) {
-      int ind = (int)(find(apps.begin(), apps.end(), req) - apps.begin());
+    double alloc = (1.0 - usedBw) / (m.numReqs(i) - numJobs);
+    for (int k = m.ostStart[i]; k < m.ostStart[i + 1]; k++) {
+      int ind = m.ostApp[k];
       if (thtBw[ind] == false) {
         minBw[ind] = min(minBw[ind], alloc);
       }
     }
   }
 
+  // Determine effective storage system utilization and allocation of the bandwidth
+  allocateMinBw(m, minBw, allocs);
+
+  delete [] minBw;
+}
+
+void LnetMds::computeBwAllocationsPOFS(const ReqIncidence_t &m,
+                                       MapOstToAppAllocs_t &allocs)
+{
+  const size_t NUM_OSTS = m.numOsts;
+  const int numApps = m.numApps();
+
+  // Determine the minimum bandwidth of each app after fair share
+  double* minBw = NULL;
+  minBw = new double[numApps];
+  fairShareMinBw(m, minBw);
+
   // Determine effective storage system utilization and allocation of the bandwidth
   double totalUsedBw = 0.0;
   for (size_t i = 0; i < NUM_OSTS; i++) {
     double usedBw = 0.0;
-    for (auto req : reqs[i]) {
-      int ind = (int)(find(apps.begin(), apps.end(), req) - apps.begin());
-      usedBw += minBw[ind];
+    for (int k = m.reqStart[i]; k < m.reqStart[i + 1]; k++) {
+      usedBw += minBw[m.reqApp[k]];
     }
     totalUsedBw += usedBw;
 
-    double xtraBw = 0.0;
-    if ((ALLOC_XTRA_BW == true) && (ALLOC_X_BW_EQ == true)) {
-      xtraBw = (1.0 - usedBw) / (double)reqs[i].size();
-    }
-
     AppAllocs_t alloc;
-    for (auto req : reqs[i]) {
-      int ind = (int)(find(apps.begin(), apps.end(), req) - apps.begin());
-      if ((ALLOC_XTRA_BW == true) && (ALLOC_X_BW_EQ == false)) {
-        xtraBw = (1.0 - usedBw) * (minBw[ind] / usedBw);
-      }
-      alloc.push_back(make_tuple(req, minBw[ind] + xtraBw));
+    double perAppBw = 1.0 / (double)m.numReqs(i);
+    for (int k = m.reqStart[i]; k < m.reqStart[i + 1]; k++) {
+      alloc.push_back(make_tuple(m.apps[m.reqApp[k]], perAppBw));
     }
     allocs.push_back(alloc);
   }
 
   runEffStorageSysUtil.push_back(totalUsedBw);
 
-  delete [] appSize;
-  delete [] thtBw;
   delete [] minBw;
 }
 
-void LnetMds::computeBwAllocationsTMF(const size_t NUM_OSTS,
-                                      const std::vector<std::vector<int>> &reqs,
-                                      MapOstToAppAllocs_t &allocs)
+void LnetMds::computeBwAllocationsGIFT(const ReqIncidence_t &m,
+                                       MapOstToAppAllocs_t &allocs)
 {
-  // Create a flat vector
-  vector<int> flat;
+  const size_t NUM_OSTS = m.numOsts;
+  const int numApps = m.numApps();
+
+  // Lower allocation bound for each app
+  double* alcs = NULL;
+  alcs = new double[numApps];	
+  fill_n(alcs, numApps, numeric_limits<double>::infinity());
+
+  // Number of requests of each app
+  const int* osts = m.appReqs.data();
+
+  vector<double> apTh; // = {true, false, true, false, true};
+  for (auto app : m.apps) {
+    const AppData_t &base = appDatabase[getAppData(app)];
+    if ((base.bw_redeemed / base.bw_issued) >= GIFT_RDMP_RT_TH) {
+      apTh.push_back(base.bw_redeemed - (base.bw_issued * GIFT_RDMP_RT_TH));
+    } else {
+      apTh.push_back(0.0);
+    }
+  }
+
+  for (size_t i = 0; i < NUM_OSTS; i++) {
+    double alc = 1.0 / (double)m.numReqs(i);
+    for (int k = m.ostStart[i]; k < m.ostStart[i + 1]; k++) {
+      int app = m.ostApp[k];
+      alcs[app] = min(alcs[app], alc);
+    }
+  }
+
+  double efbw[NUM_OSTS];
+  memset(efbw, 0.0, NUM_OSTS * sizeof(double));
   for (size_t i = 0; i < NUM_OSTS; i++) {
-    for (auto req : reqs[i]) {
-      flat.push_back(req);
+    for (int k = m.reqStart[i]; k < m.reqStart[i + 1]; k++) {
+      efbw[i] += alcs[m.reqApp[k]];
     }
+    //cout << efbw[i] << endl;
   }
 
-  // Determine the number of applications doing I/O
-  set<int> s = set<int>(flat.begin(), flat.end());
-  vector<int> apps(s.begin(), s.end());
-  const int numApps = (int)apps.size();
+  /* for (int i = 0; i < numApps; i++) {
+     cout << alcs[i] << endl;
+     cout << osts[i] << endl;
+     } */
 
-  unsigned int* appFreq = NULL;
-  appFreq = new unsigned int[numApps];
-  double meanFreq = 0.0;
+  int    numCoups = 0;
+  double valCoups = 0.0;
 
-  // Update the frequencies of the applications
-  for (int i = 0; i < numApps; i++) {
-    bool found = false;
-    for (auto &entry : freqDatabase) {
-      if (entry.app == (unsigned int)apps[i]) {
-        entry.num++;
-        appFreq[i] = entry.num;
-        meanFreq += entry.num;
-        found = true;
+  vector<double> bwRd(numApps, 0.0);
+  vector<int> apps_cpy(numApps);
+  iota(apps_cpy.begin(), apps_cpy.end(), 0);
+  random_shuffle(apps_cpy.begin(), apps_cpy.end());
+  for (auto index : apps_cpy) {
+    AppData_t &base = appDatabase[getAppData(m.apps[index])];
+    double bwRq = base.bw_issued - base.bw_redeemed;
+
+    if (bwRq == 0.0) {
+      continue;
+    }
+
+    double bwAv = numeric_limits<double>::infinity();
+    for (int k = m.appStart[index]; k < m.appStart[index + 1]; k++) {
+      int i = m.appOst[k];
+      if (efbw[i] == 1.0) {
+        bwAv = 0.0;
         break;
       }
+      bwAv = min(bwAv, ((1.0 - efbw[i])/(double)m.appCnt[k]));
     }
-    if (found == false) {
-      freqDatabase.push_back(AppFreq_t());
-      freqDatabase.back().app = (unsigned int)apps[i];
-      freqDatabase.back().num = 1;
-      appFreq[i] = 1;
-      meanFreq += 1;
-    }
-  }
-
-  meanFreq = meanFreq / (double)numApps;
 
-  // Determine the minimum bandwidth of each app after fair share
-  double* minBw = NULL;
-  minBw = new double[numApps];
-  fill_n(minBw, numApps, numeric_limits<double>::infinity());
+    if (bwAv == 0.0) {
+      continue;
+    }
 
-  for (size_t i = 0; i < NUM_OSTS; i++) {
-    double alloc = 1.0 / (double)reqs[i].size();
-    for (auto req : reqs[i]) {
-      int ind = (int)(find(apps.begin(), apps.end(), req) - apps.begin());
-      minBw[ind] = min(minBw[ind], alloc);
+    double bwGv = min(bwRq, bwAv * osts[index]);
+    for (int k = m.appStart[index]; k < m.appStart[index + 1]; k++) {
+      efbw[m.appOst[k]] -= ((bwGv / (double)osts[index]) * (double)m.appCnt[k]);
     }
+    base.bw_redeemed += (double)((int)(bwGv / GIFT_COUP_BW_SZ)) * GIFT_COUP_BW_SZ;
+    valCoups -= (double)((int)(bwGv / GIFT_COUP_BW_SZ)) * GIFT_COUP_BW_SZ;
+    sys_coup_rdmp += (double)((int)(bwGv / GIFT_COUP_BW_SZ)) * GIFT_COUP_BW_SZ;
+    bwRd[index] = bwGv/(double)osts[index];
   }
 
-  // Throttle some jobs' bandwidth
-  bool* thtBw = NULL;
-  thtBw = new bool[numApps];
-  for (int i = 0; i < numApps; i++) {
-    if (appFreq[i] > meanFreq) {
-      minBw[i] = minBw[i] * (1.0 - TMF_B_THRESHOLD);
-      thtBw[i] = true;
+  double* collb = NULL;
+  collb = new double[numApps];
+  double* fsbw = NULL;
+  fsbw = new double[numApps];
+  fill_n(collb, numApps, numeric_limits<double>::infinity());
+  fill_n(fsbw, numApps, numeric_limits<double>::infinity());
+
+  for (int app = 0; app < numApps; app++) {
+    if (((sys_coup_issu == 0.0) or ((sys_coup_issu != 0.0) && ((sys_coup_rdmp/sys_coup_issu) > GIFT_SYS_RDMP_T))) && (apTh[app] > 0.0)) {
+      if (apTh[app] > ((alcs[app] * GIFT_B_THRESOLD) * osts[app])) {
+        collb[app] = (alcs[app] * (1.0 - GIFT_B_THRESOLD)) + bwRd[app];
+      } else {
+        collb[app] = alcs[app] - (apTh[app] / (double)osts[app]) + bwRd[app];
+      }
     } else {
-      minBw[i] = numeric_limits<double>::infinity();
-      thtBw[i] = false;
+      collb[app] = alcs[app] + bwRd[app];
     }
-    // cout << "App " << apps[i] << " has b/w " << thtBw[i] << "." << endl;
+    fsbw[app] = alcs[app] + bwRd[app];
   }
 
-  // Increase bandwidth allocations of other jobs
-  for (size_t i = 0; i < NUM_OSTS; i++) {
-    int numJobs = 0;
-    double usedBw = 0.0;
-    for (auto req : reqs[i]) {
-      int ind = (int)(find(apps.begin(), apps.end(), req) - apps.begin());
-      if (thtBw[ind] == true) {
-        numJobs += 1;
-        usedBw += minBw[ind];
-      }
-    }
+  // Upper allocation bound for each app
+  double* colub = NULL;
+  colub = new double[numApps];
+  fill_n(colub, numApps, 1);
 
-    double alloc = (1.0 - usedBw) / ((int)reqs[i].size() - numJobs);
-    // cout << i << " " << alloc << endl;
-    for (auto req : reqs[i]) {
-      int ind = (int)(find(apps.begin(), apps.end(), req) - apps.begin());
-      if (thtBw[ind] == false) {
-        minBw[ind] = min(minBw[ind], alloc);
-      }
-    }
+  // The cooefficients of the minimum objective function
+  double* obj = NULL;
+  obj = new double[numApps];
+  for (int app = 0; app < numApps; app++) {
+    obj[app] = -osts[app];
   }
 
-  // Determine effective storage system utilization and allocation of the bandwidth
-  double totalUsedBw = 0.0;
+  vector<double> wfBw(numApps);
+  const double* cVal = maxUtilRates(m, collb, colub, obj, this->_giftLp, wfBw.data());
+  double objValue = 0.0;
+  for (int app = 0; app < numApps; app++) {
+    objValue += obj[app] * cVal[app];
+  }
+
+  bool* done = NULL;
+  done = new bool[numApps];
+  fill_n(done, numApps, false);
+
+  // Determine allocation of the bandwidth
   for (size_t i = 0; i < NUM_OSTS; i++) {
     double usedBw = 0.0;
-    for (auto req : reqs[i]) {
-      int ind = (int)(find(apps.begin(), apps.end(), req) - apps.begin());
-      usedBw += minBw[ind];
+    for (int k = m.reqStart[i]; k < m.reqStart[i + 1]; k++) {
+      usedBw += cVal[m.reqApp[k]];
     }
-    totalUsedBw += usedBw;
 
     double xtraBw = 0.0;
     if ((ALLOC_XTRA_BW == true) && (ALLOC_X_BW_EQ == true)) {
-      xtraBw = (1.0 - usedBw) / (double)reqs[i].size();
+      xtraBw = (1.0 - usedBw) / (double)m.numReqs(i);
     }
 
     AppAllocs_t alloc;
-    for (auto req : reqs[i]) {
-      int ind = (int)(find(apps.begin(), apps.end(), req) - apps.begin());
+
+    for (int k = m.reqStart[i]; k < m.reqStart[i + 1]; k++) {
+      int ind = m.reqApp[k];
       if ((ALLOC_XTRA_BW == true) && (ALLOC_X_BW_EQ == false)) {
-        xtraBw = (1.0 - usedBw) * (minBw[ind] / usedBw);
+        xtraBw = (1.0 - usedBw) * (cVal[ind] / usedBw);
+      }
+      alloc.push_back(make_tuple(m.apps[ind], cVal[ind] + xtraBw));
+
+      if ((!done[ind]) && (cVal[ind] < fsbw[ind])) {
+        done[ind] = true;
+        AppData_t &base = appDatabase[getAppData(m.apps[ind])];
+        base.bw_redeemed -= (double)((int)(((fsbw[ind] - cVal[ind]) * osts[ind]) / GIFT_COUP_BW_SZ)) * GIFT_COUP_BW_SZ;
+        numCoups += (int)(((fsbw[ind] - cVal[ind]) * osts[ind]) / GIFT_COUP_BW_SZ);
+        valCoups += (double)((int)(((fsbw[ind] - cVal[ind]) * osts[ind]) / GIFT_COUP_BW_SZ)) * GIFT_COUP_BW_SZ;
+        sys_coup_issu += (double)((int)(((fsbw[ind] - cVal[ind]) * osts[ind]) / GIFT_COUP_BW_SZ)) * GIFT_COUP_BW_SZ;
       }
-      alloc.push_back(make_tuple(req, minBw[ind] + xtraBw));
     }
     allocs.push_back(alloc);
   }
 
-  runEffStorageSysUtil.push_back(totalUsedBw);
+  numCouponsIssued.push_back((numCouponsIssued.empty() ? 0 : numCouponsIssued.back()) + numCoups);
+  valCouponsIssued.push_back((valCouponsIssued.empty() ? 0.0 : valCouponsIssued.back()) + valCoups);
 
-  delete [] appFreq;
-  delete [] thtBw;
-  delete [] minBw;
-}
+  // Determine effective storage system utilization	
+  if (objValue < 0) {
+    runEffStorageSysUtil.push_back(-1 * objValue);
+  }
 
+  delete [] alcs;
+  delete [] collb;
+  delete [] fsbw;
+  delete [] colub;
+  delete [] obj;
+  delete [] done;
+}
 
-void LnetMds::computeBwAllocationsRND(const size_t NUM_OSTS,
-                                      const std::vector<std::vector<int>> &reqs,
-                                      MapOstToAppAllocs_t &allocs)
+void LnetMds::computeBwAllocationsBSIP(const ReqIncidence_t &m,
+                                       MapOstToAppAllocs_t &allocs)
 {
-  // Create a flat vector
-  vector<int> flat;
-  for (size_t i = 0; i < NUM_OSTS; i++) {
-    for (auto req : reqs[i]) {
-      flat.push_back(req);
-    }
-  }
-
-  // Determine the number of applications doing I/O
-  set<int> s = set<int>(flat.begin(), flat.end());
-  vector<int> apps(s.begin(), s.end());
-  const int numApps = (int)apps.size();
+  const int numApps = m.numApps();
 
   // Determine the minimum bandwidth of each app after fair share
   double* minBw = NULL;
   minBw = new double[numApps];
-  fill_n(minBw, numApps, numeric_limits<double>::infinity());
+  fairShareMinBw(m, minBw);
 
-  for (size_t i = 0; i < NUM_OSTS; i++) {
-    double alloc = 1.0 / (double)reqs[i].size();
-    for (auto req : reqs[i]) {
-      int ind = (int)(find(apps.begin(), apps.end(), req) - apps.begin());
-      minBw[ind] = min(minBw[ind], alloc);
-    }
-  }
+  // Determine effective storage system utilization and allocation of the bandwidth
+  allocateMinBw(m, minBw, allocs);
 
-  // Throttle some jobs' bandwidth
+  delete [] minBw;
+}
+
+void LnetMds::computeBwAllocationsTSA(const ReqIncidence_t &m,
+                                      MapOstToAppAllocs_t &allocs)
+{
+  const int numApps = m.numApps();
+
+  // Determine the size of the applications
+  const int* appSize = m.appReqs.data();
+  double meanSize = (double)m.reqApp.size();
+
+  /* cout << "NEW" << endl;
+     for (int i = 0; i < numApps; i++) {
+     cout << "App " << m.apps[i] << " has size " << appSize[i] << "." << endl;
+     } */
+  meanSize = meanSize / (double)numApps;
+  // cout << "Mean size " << meanSize << endl;
+
+  // Throttle the jobs no larger than the mean
   bool* thtBw = NULL;
   thtBw = new bool[numApps];
-  srand(numApps);
   for (int i = 0; i < numApps; i++) {
-    if (rand() > (RAND_MAX / 2)) {
-      minBw[i] = minBw[i] * (1.0 - TMF_B_THRESHOLD);
-      thtBw[i] = true;
-    } else {
-      minBw[i] = numeric_limits<double>::infinity();
-      thtBw[i] = false;
-    }
-    // cout << "App " << apps[i] << " has b/w " << thtBw[i] << "." << endl;
+    thtBw[i] = (appSize[i] <= meanSize);
   }
 
-  // Increase bandwidth allocations of other jobs
-  for (size_t i = 0; i < NUM_OSTS; i++) {
-    int numJobs = 0;
-    double usedBw = 0.0;
-    for (auto req : reqs[i]) {
-      int ind = (int)(find(apps.begin(), apps.end(), req) - apps.begin());
-      if (thtBw[ind] == true) {
-        numJobs += 1;
-        usedBw += minBw[ind];
-      }
-    }
+  throttleAndAllocate(m, thtBw, TSA_B_THRESHOLD, allocs);
 
-    double alloc = (1.0 - usedBw) / ((int)reqs[i].size() - numJobs);
-    // cout << i << " " << alloc << endl;
-    for (auto req : reqs[i]) {
-      int ind = (int)(find(apps.begin(), apps.end(), req) - apps.begin());
-      if (thtBw[ind] == false) {
-        minBw[ind] = min(minBw[ind], alloc);
-      }
-    }
-  }
+  delete [] thtBw;
+}
 
-  // Determine effective storage system utilization and allocation of the bandwidth
-  double totalUsedBw = 0.0;
-  for (size_t i = 0; i < NUM_OSTS; i++) {
-    double usedBw = 0.0;
-    for (auto req : reqs[i]) {
-      int ind = (int)(find(apps.begin(), apps.end(), req) - apps.begin());
-      usedBw += minBw[ind];
-    }
-    totalUsedBw += usedBw;
+void LnetMds::computeBwAllocationsESA(const ReqIncidence_t &m,
+                                      MapOstToAppAllocs_t &allocs)
+{
+  const int numApps = m.numApps();
 
-    double xtraBw = 0.0;
-    if ((ALLOC_XTRA_BW == true) && (ALLOC_X_BW_EQ == true)) {
-      xtraBw = (1.0 - usedBw) / (double)reqs[i].size();
-    }
+  // Determine the size of the applications
+  const int* appSize = m.appReqs.data();
+  double meanSize = (double)m.reqApp.size();
 
-    AppAllocs_t alloc;
-    for (auto req : reqs[i]) {
-      int ind = (int)(find(apps.begin(), apps.end(), req) - apps.begin());
-      if ((ALLOC_XTRA_BW == true) && (ALLOC_X_BW_EQ == false)) {
-        xtraBw = (1.0 - usedBw) * (minBw[ind] / usedBw);
-      }
-      alloc.push_back(make_tuple(req, minBw[ind] + xtraBw));
-    }
-    allocs.push_back(alloc);
+  meanSize = meanSize / (double)numApps;
+
+  // Throttle the jobs larger than the mean
+  bool* thtBw = NULL;
+  thtBw = new bool[numApps];
+  for (int i = 0; i < numApps; i++) {
+    thtBw[i] = (appSize[i] > meanSize);
   }
 
-  runEffStorageSysUtil.push_back(totalUsedBw);
+  throttleAndAllocate(m, thtBw, ESA_B_THRESHOLD, allocs);
 
   delete [] thtBw;
-  delete [] minBw;
 }
 
-void LnetMds::computeBwAllocationsMBW(const size_t NUM_OSTS,
-                                      const std::vector<std::vector<int>> &reqs,
+void LnetMds::computeBwAllocationsTMF(const ReqIncidence_t &m,
                                       MapOstToAppAllocs_t &allocs)
 {
-  // Create a flat vector
-  vector<int> flat;
-  for (size_t i = 0; i < NUM_OSTS; i++) {
-    for (auto req : reqs[i]) {
-      flat.push_back(req);
-    }
-  }
-
-  // Determine the number of applications doing I/O
-  set<int> s = set<int>(flat.begin(), flat.end());
-  vector<int> apps(s.begin(), s.end());
-  const int numApps = (int)apps.size();
+  const int numApps = m.numApps();
 
-  // Row Order matrix
-  const bool cOrd = false;
+  unsigned int* appFreq = NULL;
+  appFreq = new unsigned int[numApps];
+  double meanFreq = 0.0;
 
-  // Row Indices
-  int *rInd = NULL;
-  rInd = new int[NUM_OSTS * numApps];
-  for (size_t i = 0; i < NUM_OSTS; i++) {
-    for (int j = 0; j < numApps; j++) {
-      rInd[(i * numApps) + j] = i;
+  // Update the frequencies of the applications
+  for (int i = 0; i < numApps; i++) {
+    auto it = freqDbIndex.find(m.apps[i]);
+    if (it != freqDbIndex.end()) {
+      AppFreq_t &entry = freqDatabase[it->second];
+      entry.num++;
+      appFreq[i] = entry.num;
+      meanFreq += entry.num;
+    } else {
+      freqDatabase.push_back(AppFreq_t());
+      freqDatabase.back().app = (unsigned int)m.apps[i];
+      freqDatabase.back().num = 1;
+      freqDbIndex[m.apps[i]] = freqDatabase.size() - 1;
+      appFreq[i] = 1;
+      meanFreq += 1;
     }
   }
 
-  // Col Indices
-  int* cInd = NULL;
-  cInd = new int[NUM_OSTS * numApps];
-  for (size_t i = 0; i < NUM_OSTS; i++) {
-    for (int j = 0; j < numApps; j++) {
-      cInd[(i * numApps) + j] = j;
-    }
+  meanFreq = meanFreq / (double)numApps;
+
+  // Throttle the jobs seen more often than the mean
+  bool* thtBw = NULL;
+  thtBw = new bool[numApps];
+  for (int i = 0; i < numApps; i++) {
+    thtBw[i] = (appFreq[i] > meanFreq);
   }
 
-  // Constraints matrix
-  double* ele = NULL;
-  ele = new double[NUM_OSTS * numApps];
-  memset(ele, 0, (NUM_OSTS * numApps) * sizeof(double));
-  for (size_t i = 0; i < NUM_OSTS; i++) {
-    for (auto req : reqs[i]) {
-      int app = (int)(find(apps.begin(), apps.end(), req) - apps.begin());
-      ele[(i * numApps) + app] += 1;
-    }
+  throttleAndAllocate(m, thtBw, TMF_B_THRESHOLD, allocs);
+
+  delete [] appFreq;
+  delete [] thtBw;
+}
+
+
+void LnetMds::computeBwAllocationsRND(const ReqIncidence_t &m,
+                                      MapOstToAppAllocs_t &allocs)
+{
+  const int numApps = m.numApps();
+
+  // Throttle a random half of the jobs
+  bool* thtBw = NULL;
+  thtBw = new bool[numApps];
+  srand(numApps);
+  for (int i = 0; i < numApps; i++) {
+    thtBw[i] = (rand() > (RAND_MAX / 2));
   }
 
-  // Number of elements in the constraints matrix
-  CoinBigIndex numels = NUM_OSTS * numApps;
+  throttleAndAllocate(m, thtBw, TMF_B_THRESHOLD, allocs);
 
-  // Make a matrix of constraints
-  const CoinPackedMatrix matrix(cOrd, rInd, cInd, ele, numels);
+  delete [] thtBw;
+}
+
+void LnetMds::computeBwAllocationsMBW(const ReqIncidence_t &m,
+                                      MapOstToAppAllocs_t &allocs)
+{
+  const size_t NUM_OSTS = m.numOsts;
+  const int numApps = m.numApps();
 
   // Lower allocation bound for each app
   double* collb = NULL;
@@ -1010,59 +1250,76 @@ void LnetMds::computeBwAllocationsMBW(const size_t NUM_OSTS,
   // The cooefficients of the minimum objective function
   double* obj = NULL;
   obj = new double[numApps];
-  memset(obj, 0, numApps * sizeof(double));
-  for (auto f : flat) {
-    int app = (int)(find(apps.begin(), apps.end(), f) - apps.begin());
-    obj[app] -= 1;
+  for (int app = 0; app < numApps; app++) {
+    obj[app] = -m.appReqs[app];
   }
 
-  // The upper and lower bounds of each OST
-  double rowlb[NUM_OSTS], rowub[NUM_OSTS];
-  memset(rowlb, 0, NUM_OSTS * sizeof(double));
-  fill_n(rowub, NUM_OSTS, 1);
-
-  ClpSimplex model;
-  model.loadProblem(matrix, collb, colub, obj, rowlb, rowub, NULL);
-  model.primal();
-  double* cVal = model.primalColumnSolution();
+  vector<double> wfBw(numApps);
+  const double* cVal = maxUtilRates(m, collb, colub, obj, this->_mbwLp, wfBw.data());
+  double objValue = 0.0;
+  for (int app = 0; app < numApps; app++) {
+    objValue += obj[app] * cVal[app];
+  }
 
   // Determine allocation of the bandwidth
   for (size_t i = 0; i < NUM_OSTS; i++) {
     double usedBw = 0.0;
-    for (auto req : reqs[i]) {
-      int ind = (int)(find(apps.begin(), apps.end(), req) - apps.begin());
-      usedBw += cVal[ind];
+    for (int k = m.reqStart[i]; k < m.reqStart[i + 1]; k++) {
+      usedBw += cVal[m.reqApp[k]];
     }
 
     double xtraBw = 0.0;
     if ((ALLOC_XTRA_BW == true) && (ALLOC_X_BW_EQ == true)) {
-      xtraBw = (1.0 - usedBw) / (double)reqs[i].size();
+      xtraBw = (1.0 - usedBw) / (double)m.numReqs(i);
     }
 
     AppAllocs_t alloc;
-    for (auto req : reqs[i]) {
-      int ind = (int)(find(apps.begin(), apps.end(), req) - apps.begin());
+    for (int k = m.reqStart[i]; k < m.reqStart[i + 1]; k++) {
+      int ind = m.reqApp[k];
       if ((ALLOC_XTRA_BW == true) && (ALLOC_X_BW_EQ == false)) {
         xtraBw = (1.0 - usedBw) * (cVal[ind] / usedBw);
       }
-      alloc.push_back(make_tuple(req, cVal[ind] + xtraBw));
+      alloc.push_back(make_tuple(m.apps[ind], cVal[ind] + xtraBw));
     }
     allocs.push_back(alloc);
   }
 
   // Determine effective storage system utilization	
-  if (model.getObjValue() < 0) {
-    runEffStorageSysUtil.push_back(-1 * model.getObjValue());
+  if (objValue < 0) {
+    runEffStorageSysUtil.push_back(-1 * objValue);
   }
 
-  delete [] rInd;
-  delete [] cInd;
-  delete [] ele;
   delete [] collb;
   delete [] colub;
   delete [] obj;
 }
 
+void LnetMds::computeBwAllocationsMMF(const ReqIncidence_t &m,
+                                      MapOstToAppAllocs_t &allocs)
+{
+  const int numApps = m.numApps();
+
+  double* collb = NULL;
+  collb = new double[numApps];
+  memset(collb, 0, numApps * sizeof(double));
+
+  double* colub = NULL;
+  colub = new double[numApps];
+  fill_n(colub, numApps, 1);
+
+  // Max-min fair rate of each app
+  double* minBw = NULL;
+  minBw = new double[numApps];
+  waterFill(m, collb, colub, minBw);
+
+  // Determine effective storage system utilization and allocation of the bandwidth
+  allocateMinBw(m, minBw, allocs);
+
+  delete [] collb;
+  delete [] colub;
+  delete [] minBw;
+}
+
 void LnetMds::printStats()
 {
 #if 0
@@ -1094,6 +1351,7 @@ void LnetMds::printStats()
 
   cout << "Effective System Util: " << avgEffStorageSysUtil << endl;
   cout << "Effective System B/w: " << this->getEffectiveSysBw() << endl;
+  this->_allocCache->printStats();
 }
 
 
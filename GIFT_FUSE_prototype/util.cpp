@@ -2,7 +2,19 @@
 #include <cstdlib>
 #include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <unistd.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+// Wait for a non-blocking fd to be ready instead of spinning on EAGAIN
+static void
+waitReady(int fd, short events)
+{
+  struct pollfd pfd = {fd, events, 0};
+  ::poll(&pfd, 1, -1);
+}
 
 ssize_t
 writeAll(int fd, const void *buf, size_t len)
@@ -13,7 +25,10 @@ writeAll(int fd, const void *buf, size_t len)
   do {
     ssize_t rc = write(fd, ptr + num_written, len - num_written);
     if (rc == -1) {
-      if (errno == EINTR || errno == EAGAIN) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        waitReady(fd, POLLOUT);
+        continue;
+      } else if (errno == EINTR) {
         continue;
       } else {
         return rc;
@@ -38,7 +53,10 @@ readAll(int fd, void *buf, size_t len)
   for (num_read = 0; num_read < len;) {
     rc = read(fd, ptr + num_read, len - num_read);
     if (rc == -1) {
-      if (errno == EINTR || errno == EAGAIN) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        waitReady(fd, POLLIN);
+        continue;
+      } else if (errno == EINTR) {
         continue;
       } else {
         return -1;
@@ -51,3 +69,134 @@ readAll(int fd, void *buf, size_t len)
   }
   return num_read;
 }
+
+// Skip the iovecs, or the parts of them, already transferred. Returns the
+// number of iovecs left.
+static int
+advanceIov(struct iovec **iov, int iovcnt, size_t done)
+{
+  while (iovcnt > 0 && done >= (*iov)->iov_len) {
+    done -= (*iov)->iov_len;
+    (*iov)++;
+    iovcnt--;
+  }
+  if (iovcnt > 0) {
+    (*iov)->iov_base = (char *)(*iov)->iov_base + done;
+    (*iov)->iov_len -= done;
+  }
+  return iovcnt;
+}
+
+// Like writeAll() for the buffers of iov, in one writev() when the socket
+// takes them all. With flags, such as MSG_MORE, fd must be a socket. iov is
+// modified.
+ssize_t
+writevAll(int fd, struct iovec *iov, int iovcnt, int flags)
+{
+  size_t num_written = 0;
+
+  while (iovcnt > 0) {
+    ssize_t rc;
+    if (flags) {
+      struct msghdr mh = {};
+      mh.msg_iov = iov;
+      mh.msg_iovlen = iovcnt;
+      rc = sendmsg(fd, &mh, flags);
+    } else {
+      rc = writev(fd, iov, iovcnt);
+    }
+    if (rc == -1) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        waitReady(fd, POLLOUT);
+        continue;
+      } else if (errno == EINTR) {
+        continue;
+      } else {
+        return rc;
+      }
+    } else if (rc == 0) {
+      break;
+    }
+    num_written += rc;
+    iovcnt = advanceIov(&iov, iovcnt, rc);
+  }
+  return num_written;
+}
+
+// Like writeAll() for len bytes of the file fd from offset, which the
+// kernel sends to the socket without copying them to user space. Stops
+// early at the end of the file.
+ssize_t
+sendfileAll(int sockfd, int fd, off_t offset, size_t len)
+{
+  size_t num_sent = 0;
+
+  while (num_sent < len) {
+    ssize_t rc = sendfile(sockfd, fd, &offset, len - num_sent);
+    if (rc == -1) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        waitReady(sockfd, POLLOUT);
+        continue;
+      } else if (errno == EINTR) {
+        continue;
+      } else {
+        return rc;
+      }
+    } else if (rc == 0) {
+      break;
+    }
+    num_sent += rc;
+  }
+  return num_sent;
+}
+
+// Like writeAll() for len bytes from the pipe pipefd into the file fd at
+// offset, which the kernel moves without copying them to user space
+ssize_t
+spliceAll(int pipefd, int fd, off_t offset, size_t len)
+{
+  size_t num_moved = 0;
+
+  while (num_moved < len) {
+    ssize_t rc = splice(pipefd, NULL, fd, &offset, len - num_moved, SPLICE_F_MOVE);
+    if (rc == -1) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        waitReady(pipefd, POLLIN);
+        continue;
+      } else if (errno == EINTR) {
+        continue;
+      } else {
+        return rc;
+      }
+    } else if (rc == 0) {
+      break;
+    }
+    num_moved += rc;
+  }
+  return num_moved;
+}
+
+ssize_t
+readvAll(int fd, struct iovec *iov, int iovcnt)
+{
+  size_t num_read = 0;
+
+  while (iovcnt > 0) {
+    ssize_t rc = readv(fd, iov, iovcnt);
+    if (rc == -1) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        waitReady(fd, POLLIN);
+        continue;
+      } else if (errno == EINTR) {
+        continue;
+      } else {
+        return -1;
+      }
+    } else if (rc == 0) {
+      break;
+    }
+    num_read += rc;
+    iovcnt = advanceIov(&iov, iovcnt, rc);
+  }
+  return num_read;
+}
@@ -3,6 +3,7 @@
 
 #include <ctype.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 
 #ifndef EXTERNC
 # ifdef __cplusplus
@@ -14,5 +15,9 @@
 
 ssize_t writeAll(int fd, const void *buf, size_t len);
 ssize_t readAll(int fd, void *buf, size_t len);
+ssize_t writevAll(int fd, struct iovec *iov, int iovcnt, int flags = 0);
+ssize_t readvAll(int fd, struct iovec *iov, int iovcnt);
+ssize_t sendfileAll(int sockfd, int fd, off_t offset, size_t len);
+ssize_t spliceAll(int pipefd, int fd, off_t offset, size_t len);
 
 #endif // ifndef _UTIL_H